@@ -0,0 +1,530 @@
+/* Microbenchmarks of the data structures the compiler is built on, with
+ * workloads shaped like the compiler's: many tiny arena allocations, short
+ * vectors, small scopes keyed by short identifiers and many small sb_printf
+ * appends. Prints ns/op and allocations/op, and writes them as JSON.
+ *
+ *   micro [--out=out/bench/micro.json] [--min-ms=N] [name prefix...]
+ *
+ * It is linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=mmap
+ * so every allocation the compiler's sources make is counted, including the
+ * regions arenas map.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "arena.h"
+#include "emit.h"
+#include "hashmap.h"
+#include "swiss.h"
+#include "vector.h"
+
+#define REPEATS 5
+#define IDENTS_LEN 4096
+/* How many identifiers the churn benchmarks keep in their map. */
+#define CHURN_LEN 48
+
+struct bench {
+  const char *name;
+  /* Does `ops` operations of the benchmark, setup and teardown included. */
+  void (*run)(size_t ops);
+};
+
+struct bench_result {
+  size_t ops;
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+static uint64_t bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t len, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+
+void *__wrap_malloc(size_t size) {
+  bench_allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t len, size_t size) {
+  bench_allocs++;
+  return __real_calloc(len, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  bench_allocs++;
+  return __real_realloc(ptr, size);
+}
+
+void *__wrap_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+  bench_allocs++;
+  return __real_mmap(addr, len, prot, flags, fd, offset);
+}
+
+/* Identifiers like the ones programs are written with: mostly short, some
+ * with a number at the end, a few long ones. */
+static struct ident idents[IDENTS_LEN];
+/* Identifiers which are in none of the maps, for lookups that miss. */
+static struct ident missing[IDENTS_LEN];
+
+static void make_idents(struct ident *out, const char *suffix) {
+  static const char *words[] = { "x", "n", "i", "acc", "tmp", "buf", "len", "fib", "count",
+    "result", "left", "right", "node", "scope", "value", "index", "printf", "malloc",
+    "count_primes", "sieve_block", "emit_expression", "next_token" };
+  size_t words_len = sizeof(words) / sizeof(words[0]);
+  char name[64];
+
+  for (size_t i = 0; i < IDENTS_LEN; i++) {
+    if (i < words_len)
+      snprintf(name, sizeof(name), "%s%s", words[i], suffix);
+    else
+      snprintf(name, sizeof(name), "%s%zu%s", words[i % words_len], i / words_len, suffix);
+
+    out[i].chars = strdup(name);
+    out[i].len = strlen(name);
+  }
+}
+
+static struct variable variable_of(struct ident ident) {
+  return (struct variable) { .ident = ident };
+}
+
+static struct hashmap *variable_map(size_t cap) {
+  return hashmap_new(sizeof(struct variable), cap, 0, 0,
+    (uint64_t(*)(const void *, uint64_t, uint64_t))variable_hash,
+    (int(*)(const void *, const void *, void *))variable_compare, NULL, NULL);
+}
+
+static struct swiss *swiss_variable_map(size_t cap) {
+  return swiss_new(sizeof(struct variable), cap, 0, 0,
+    (uint64_t(*)(const void *, uint64_t, uint64_t))variable_hash,
+    (int(*)(const void *, const void *, void *))variable_compare, NULL);
+}
+
+/* Keeps the compiler from optimising away what is computed. */
+static volatile uintptr_t bench_sink;
+
+/* Sizes of AST nodes, cycled through. */
+static const size_t node_sizes[] = { 40, 24, 48, 16, 40, 32, 56, 8 };
+
+static void bench_arena_alloc(size_t ops) {
+  struct arena *arena = arena_new();
+
+  for (size_t i = 0; i < ops; i++)
+    bench_sink = (uintptr_t)arena_alloc(arena, node_sizes[i % 8]);
+
+  arena_free(arena);
+}
+
+/* A small file: an arena, a few hundred nodes and freeing it all. */
+static void bench_arena_file(size_t ops) {
+  struct arena *arena;
+
+  for (size_t i = 0; i < ops; i++) {
+    arena = arena_new();
+
+    for (size_t j = 0; j < 256; j++)
+      bench_sink = (uintptr_t)arena_alloc(arena, node_sizes[j % 8]);
+
+    arena_free(arena);
+  }
+}
+
+struct param {
+  struct ident ident;
+  uint64_t type;
+  const char *loc;
+};
+
+/* Parameter lists: a new vector, a few pushes and taking the items. */
+static void bench_vector_push(size_t ops) {
+  struct vector *vec = NULL;
+  struct param param = { 0 }, *items;
+
+  for (size_t i = 0; i < ops; i++) {
+    if (i % 4 == 0)
+      vec = vector_new(sizeof(struct param), 4, NULL);
+
+    param.ident = idents[i % IDENTS_LEN];
+    vector_push(vec, &param);
+
+    if (i % 4 == 3) {
+      vector_into_inner(vec, (void **)&items);
+      free(items);
+    }
+  }
+
+  if (ops % 4 != 0)
+    vector_free(vec);
+}
+
+static void bench_vector_get(size_t ops) {
+  struct vector *vec = vector_new(sizeof(struct param), 1024, NULL);
+  struct param param = { 0 };
+  uintptr_t sum = 0;
+
+  for (size_t i = 0; i < 1024; i++) {
+    param.type = i;
+    vector_push(vec, &param);
+  }
+
+  for (size_t i = 0; i < ops; i++)
+    sum += ((const struct param *)vector_get(vec, i % 1024))->type;
+
+  bench_sink = sum;
+  vector_free(vec);
+}
+
+/* A block's scope: a new map, a handful of locals and freeing it. */
+static void bench_hashmap_set(size_t ops) {
+  struct hashmap *map = NULL;
+  struct variable v;
+
+  for (size_t i = 0; i < ops; i++) {
+    if (i % 6 == 0)
+      map = variable_map(16);
+
+    v = variable_of(idents[i % IDENTS_LEN]);
+    hashmap_set(map, &v);
+
+    if (i % 6 == 5)
+      hashmap_free(map);
+  }
+
+  if (ops % 6 != 0)
+    hashmap_free(map);
+}
+
+/* Looks up `ops` of the first `len` of `lookups`, over and over, in a map
+ * holding the first `len` identifiers. */
+static void bench_hashmap_get(size_t ops, size_t len, struct ident *lookups) {
+  struct hashmap *map = variable_map(16);
+  struct variable v;
+  uintptr_t found = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    v = variable_of(idents[i]);
+    hashmap_set(map, &v);
+  }
+
+  for (size_t i = 0; i < ops; i++) {
+    v = variable_of(lookups[i % len]);
+    found += hashmap_get(map, &v) != NULL;
+  }
+
+  bench_sink = found;
+  hashmap_free(map);
+}
+
+static void bench_hashmap_get_small(size_t ops) {
+  bench_hashmap_get(ops, 8, idents);
+}
+
+static void bench_hashmap_miss_small(size_t ops) {
+  bench_hashmap_get(ops, 8, missing);
+}
+
+static void bench_hashmap_get_globals(size_t ops) {
+  bench_hashmap_get(ops, IDENTS_LEN, idents);
+}
+
+/* A sliding window over the identifiers: each operation deletes the oldest,
+ * inserts a new one and looks up one in the middle. The map never grows, but
+ * fills up with deleted slots. */
+static void bench_hashmap_churn(size_t ops) {
+  struct hashmap *map = variable_map(16);
+  struct variable v;
+  uintptr_t found = 0;
+
+  for (size_t i = 0; i < CHURN_LEN; i++) {
+    v = variable_of(idents[i]);
+    hashmap_set(map, &v);
+  }
+
+  for (size_t i = 0; i < ops; i++) {
+    v = variable_of(idents[i % IDENTS_LEN]);
+    found += hashmap_delete(map, &v) != NULL;
+    v = variable_of(idents[(i + CHURN_LEN) % IDENTS_LEN]);
+    hashmap_set(map, &v);
+    v = variable_of(idents[(i + CHURN_LEN / 2) % IDENTS_LEN]);
+    found += hashmap_get(map, &v) != NULL;
+  }
+
+  if (found != ops * 2 || hashmap_count(map) != CHURN_LEN) {
+    fprintf(stderr, "hashmap/churn lost track of its items.\n");
+    exit(1);
+  }
+
+  bench_sink = found;
+  hashmap_free(map);
+}
+
+/* The hashmap benchmarks again, with swiss.h's table. */
+static void bench_swiss_set(size_t ops) {
+  struct swiss *map = NULL;
+  struct variable v;
+
+  for (size_t i = 0; i < ops; i++) {
+    if (i % 6 == 0)
+      map = swiss_variable_map(16);
+
+    v = variable_of(idents[i % IDENTS_LEN]);
+    swiss_set(map, &v);
+
+    if (i % 6 == 5)
+      swiss_free(map);
+  }
+
+  if (ops % 6 != 0)
+    swiss_free(map);
+}
+
+static void bench_swiss_get(size_t ops, size_t len, struct ident *lookups) {
+  struct swiss *map = swiss_variable_map(16);
+  struct variable v;
+  uintptr_t found = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    v = variable_of(idents[i]);
+    swiss_set(map, &v);
+  }
+
+  for (size_t i = 0; i < ops; i++) {
+    v = variable_of(lookups[i % len]);
+    found += swiss_get(map, &v) != NULL;
+  }
+
+  bench_sink = found;
+  swiss_free(map);
+}
+
+static void bench_swiss_churn(size_t ops) {
+  struct swiss *map = swiss_variable_map(16);
+  struct variable v;
+  uintptr_t found = 0;
+
+  for (size_t i = 0; i < CHURN_LEN; i++) {
+    v = variable_of(idents[i]);
+    swiss_set(map, &v);
+  }
+
+  for (size_t i = 0; i < ops; i++) {
+    v = variable_of(idents[i % IDENTS_LEN]);
+    found += swiss_delete(map, &v) != NULL;
+    v = variable_of(idents[(i + CHURN_LEN) % IDENTS_LEN]);
+    swiss_set(map, &v);
+    v = variable_of(idents[(i + CHURN_LEN / 2) % IDENTS_LEN]);
+    found += swiss_get(map, &v) != NULL;
+  }
+
+  // Deleting is the one place swiss.c leans on where probes stop, so the
+  // benchmark checks nothing went missing.
+  if (found != ops * 2 || swiss_count(map) != CHURN_LEN) {
+    fprintf(stderr, "swiss/churn lost track of its items.\n");
+    exit(1);
+  }
+
+  bench_sink = found;
+  swiss_free(map);
+}
+
+static void bench_swiss_get_small(size_t ops) {
+  bench_swiss_get(ops, 8, idents);
+}
+
+static void bench_swiss_miss_small(size_t ops) {
+  bench_swiss_get(ops, 8, missing);
+}
+
+static void bench_swiss_get_globals(size_t ops) {
+  bench_swiss_get(ops, IDENTS_LEN, idents);
+}
+
+/* Finds names through nested scopes, as emission does: a block in a
+ * procedure, in the globals. Most names are locals, some are globals. */
+static void bench_scope_find(size_t ops) {
+  struct scope *globals = scope_new(NULL), *params = scope_new(globals);
+  struct scope *block = scope_new(params);
+  struct variable v;
+  uintptr_t found = 0;
+
+  for (size_t i = 0; i < 512; i++) {
+    v = variable_of(idents[i]);
+    scope_set(globals, &v);
+  }
+
+  for (size_t i = 0; i < 4; i++) {
+    v = variable_of(idents[512 + i]);
+    scope_set(params, &v);
+    v = variable_of(idents[516 + i]);
+    scope_set(block, &v);
+  }
+
+  for (size_t i = 0; i < ops; i++)
+    found += (uintptr_t)scope_find(block, i % 4 == 3 ? &idents[i % 512] : &idents[512 + i % 8]);
+
+  bench_sink = found;
+  scope_free(block);
+  scope_free(params);
+  scope_free(globals);
+}
+
+/* An instruction as qbe.c writes it, each piece an append of its own. */
+static void bench_sb_printf(size_t ops) {
+  struct string_buffer *buf = string_buffer_new();
+
+  for (size_t i = 0; i < ops; i++) {
+    switch (i % 4) {
+      case 0: sb_printf(buf, "    "); break;
+      case 1: sb_printf(buf, "%%t_%lu =%s ", i, "l"); break;
+      case 2: sb_printf(buf, "%s", "add"); break;
+      case 3: sb_printf(buf, " %%t_%lu, %li\n", i - 3, (long)i); break;
+    }
+
+    // A procedure's worth of text at a time, like a string buffer which is
+    // dumped and cleared.
+    if (i % 4096 == 4095)
+      string_buffer_clear(buf);
+  }
+
+  string_buffer_free(buf);
+}
+
+static const struct bench benches[] = {
+  { "arena/alloc", bench_arena_alloc },
+  { "arena/file", bench_arena_file },
+  { "vector/push", bench_vector_push },
+  { "vector/get", bench_vector_get },
+  { "hashmap/set_scope", bench_hashmap_set },
+  { "hashmap/get_small", bench_hashmap_get_small },
+  { "hashmap/miss_small", bench_hashmap_miss_small },
+  { "hashmap/get_globals", bench_hashmap_get_globals },
+  { "hashmap/churn", bench_hashmap_churn },
+  { "swiss/set_scope", bench_swiss_set },
+  { "swiss/get_small", bench_swiss_get_small },
+  { "swiss/miss_small", bench_swiss_miss_small },
+  { "swiss/get_globals", bench_swiss_get_globals },
+  { "swiss/churn", bench_swiss_churn },
+  { "scope/find", bench_scope_find },
+  { "string_buffer/sb_printf", bench_sb_printf },
+};
+
+#define BENCHES_LEN (sizeof(benches) / sizeof(benches[0]))
+
+static uint64_t clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Doubles the number of operations until a run takes `min_ms`, then takes
+ * the median of REPEATS runs of that many. */
+static struct bench_result bench_run(const struct bench *bench, double min_ms) {
+  struct bench_result result = { .ops = 1024 };
+  double ns[REPEATS];
+  uint64_t start, allocs;
+
+  while (true) {
+    start = clock_ns();
+    bench->run(result.ops);
+
+    if ((clock_ns() - start) / 1e6 >= min_ms)
+      break;
+
+    result.ops *= 2;
+  }
+
+  for (size_t i = 0; i < REPEATS; i++) {
+    allocs = bench_allocs;
+    start = clock_ns();
+    bench->run(result.ops);
+    ns[i] = (double)(clock_ns() - start) / result.ops;
+    result.allocs_per_op = (double)(bench_allocs - allocs) / result.ops;
+  }
+
+  qsort(ns, REPEATS, sizeof(double), compare_doubles);
+  result.ns_per_op = ns[REPEATS / 2];
+
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  const char *out = "out/bench/micro.json";
+  double min_ms = 50;
+  bool filtered = false, selected, first = true;
+  struct bench_result result;
+  FILE *fptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--out=", 6) == 0) {
+      out = argv[i] + 6;
+    } else if (strncmp(argv[i], "--min-ms=", 9) == 0 && atof(argv[i] + 9) > 0) {
+      min_ms = atof(argv[i] + 9);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option %s.\n", argv[i]);
+      return 1;
+    } else {
+      filtered = true;
+    }
+  }
+
+  if ((fptr = fopen(out, "w")) == NULL) {
+    fprintf(stderr, "Failed to write %s. %s\n", out, strerror(errno));
+    return 1;
+  }
+
+  make_idents(idents, "");
+  make_idents(missing, "_");
+
+  printf("%-26s %12s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "ops");
+  fprintf(fptr, "{\"benchmarks\":[");
+
+  for (size_t i = 0; i < BENCHES_LEN; i++) {
+    selected = !filtered;
+
+    // Benchmarks are picked by the start of their name, like `hashmap`.
+    for (int j = 1; j < argc && !selected; j++) {
+      if (argv[j][0] != '-' && strncmp(benches[i].name, argv[j], strlen(argv[j])) == 0)
+        selected = true;
+    }
+
+    if (!selected)
+      continue;
+
+    result = bench_run(&benches[i], min_ms);
+
+    printf("%-26s %12.2f %12.4f %12zu\n", benches[i].name, result.ns_per_op,
+      result.allocs_per_op, result.ops);
+    fflush(stdout);
+
+    fprintf(fptr, "%s\n{\"name\":\"%s\",\"ns_per_op\":%.3f,\"allocs_per_op\":%.6f,\"ops\":%zu}",
+      first ? "" : ",", benches[i].name, result.ns_per_op, result.allocs_per_op, result.ops);
+    first = false;
+  }
+
+  fprintf(fptr, "\n]}\n");
+
+  if (fclose(fptr) != 0) {
+    fprintf(stderr, "Failed to write %s. %s\n", out, strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
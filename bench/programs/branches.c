@@ -0,0 +1,57 @@
+#include <stdio.h>
+
+/* Classifies pseudo-random bytes through a chain of data dependent branches,
+ * which the branch predictor can't learn. */
+#define LIMIT 20000000
+#define CHUNK 10000
+
+static long next(long x) {
+  return (long)((unsigned long)x * 6364136223846793005UL + 1442695040888963407UL);
+}
+
+static long classify(long r) {
+  if (r < 32) {
+    return 1;
+  } else if (r < 64) {
+    if (r % 2 == 0)
+      return 2;
+
+    return 3;
+  } else if (r < 128) {
+    if (r % 3 == 0)
+      return 5;
+    else if (r % 3 == 1)
+      return 7;
+
+    return 11;
+  } else if (r < 192) {
+    if ((r & 4) == 0)
+      return 13;
+
+    return r - 100;
+  } else if (r == 255) {
+    return 1000;
+  }
+
+  return r / 7;
+}
+
+int main() {
+  long x = 42, y, acc = 0;
+
+  for (long i = 0; i < LIMIT; i += CHUNK) {
+    y = x;
+
+    for (long j = i; j < i + CHUNK; j++) {
+      y = next(y);
+      acc += classify((y >> 33) & 255);
+    }
+
+    acc = (acc * 1000003 + y % 1000) % 1000000007;
+    x = next(x + i);
+  }
+
+  printf("%ld\n", acc);
+
+  return 0;
+}
@@ -0,0 +1,34 @@
+#include <stdio.h>
+
+/* Small procedures which are never inlined, called in a loop, and the
+ * Ackermann function, which is nothing but calls. */
+#define LIMIT 10000000
+
+__attribute__((noinline)) static long mix(long a, long b) {
+  return (a * 31 + b) % 1000003;
+}
+
+__attribute__((noinline)) static long step(long x, long i) {
+  return mix(mix(x, i), i + 1);
+}
+
+static long ack(long m, long n) {
+  if (m == 0)
+    return n + 1;
+
+  if (n == 0)
+    return ack(m - 1, 1);
+
+  return ack(m - 1, ack(m, n - 1));
+}
+
+int main() {
+  long x = 1;
+
+  for (long i = 0; i < LIMIT; i++)
+    x = step(x, i);
+
+  printf("%ld\n%ld\n", x, ack(3, 9));
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include <stdio.h>
+
+/* The number below LIMIT with the longest Collatz sequence, a tight loop of
+ * divisions and unpredictable branches. The numbers go through CHUNK at a
+ * time like in collatz.jh, which loops by recursing. */
+#define LIMIT 200000
+#define CHUNK 1000
+
+static long steps(long n) {
+  long acc = 0;
+
+  for (; n != 1; acc++)
+    n = n % 2 == 0 ? n / 2 : 3 * n + 1;
+
+  return acc;
+}
+
+int main() {
+  long best = 1;
+
+  for (long n = 1; n < LIMIT; n += CHUNK) {
+    for (long i = n; i < n + CHUNK; i++) {
+      if (steps(i) > steps(best))
+        best = i;
+    }
+  }
+
+  printf("%ld\n%ld\n", best, steps(best));
+
+  return 0;
+}
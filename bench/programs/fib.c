@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+/* Two calls per call, nearly all of the time goes to call overhead. */
+static long fib(long n) {
+  if (n < 2)
+    return n;
+
+  return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+  printf("%ld\n", fib(35));
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+/* Counts the primes below LIMIT, sieving 64 numbers at a time in the bits of
+ * one word, like sieve.jh, which has no arrays. */
+#define LIMIT 2097152
+#define EVENS 0x5555555555555555L
+
+static long first(long base, long d) {
+  long m = (base + d - 1) / d * d;
+
+  return m < d * d ? d * d : m;
+}
+
+int main() {
+  long count = 0, mask;
+
+  for (long base = 0; base < LIMIT; base += 64) {
+    mask = base == 0 ? EVENS - 4 + 2 : EVENS;
+
+    for (long d = 3; d * d < base + 64; d += 2) {
+      for (long m = first(base, d); m < base + 64; m += d)
+        mask |= 1L << (m - base);
+    }
+
+    for (long i = 0; i < 64; i++)
+      count += 1 - ((mask >> i) & 1);
+  }
+
+  printf("%ld\n", count);
+
+  return 0;
+}
@@ -0,0 +1,472 @@
+/* Runtime benchmark of generated code. Builds every program in the programs
+ * directory at -O0, -O1 and -O2, and its C equivalent with `cc -O2` as the
+ * reference, runs each build a few times and reports the median time, the
+ * instructions it retired and the size of the binary. The output of every
+ * build has to match the one of the C build.
+ *
+ *   runtime [--compiler=path] [--programs=bench/programs] [--dir=out/bench/programs]
+ *     [--runs=N] [program...]
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RUNS 64
+#define MAX_PROGRAMS 64
+
+/* The C build comes first, the others are compared against it. */
+enum build {
+  BUILD_CC,
+  BUILD_O0,
+  BUILD_O1,
+  BUILD_O2,
+  BUILDS_LEN,
+};
+
+static const char *build_names[] = {
+  [BUILD_CC] = "cc",
+  [BUILD_O0] = "O0",
+  [BUILD_O1] = "O1",
+  [BUILD_O2] = "O2",
+};
+
+struct measurement {
+  bool ok;
+  double ms;
+  /* 0 when the instructions couldn't be counted. */
+  uint64_t instructions;
+  size_t bytes;
+};
+
+static char *read_file(const char *path) {
+  FILE *fptr = fopen(path, "r");
+  char *chars;
+  long len;
+
+  if (fptr == NULL)
+    return NULL;
+
+  fseek(fptr, 0, SEEK_END);
+  len = ftell(fptr);
+  fseek(fptr, 0, SEEK_SET);
+
+  chars = malloc(len + 1);
+  chars[fread(chars, 1, len, fptr)] = 0;
+  fclose(fptr);
+
+  return chars;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double median(double *values, size_t len) {
+  qsort(values, len, sizeof(double), compare_doubles);
+
+  return len % 2 == 1 ? values[len / 2] : (values[len / 2 - 1] + values[len / 2]) / 2;
+}
+
+static uint64_t clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Runs `argv` in `dir`, or here if it is NULL, with stdout and stderr going
+ * to `log`. */
+static bool run_command(char *argv[], const char *dir, const char *log) {
+  int status, fd;
+  pid_t pid = fork();
+
+  if (pid < 0)
+    return false;
+
+  if (pid == 0) {
+    fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if ((dir != NULL && chdir(dir) != 0) || fd < 0)
+      _exit(127);
+
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+
+  if (waitpid(pid, &status, 0) < 0)
+    return false;
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Opens a counter of the user space instructions `pid` retires once it
+ * calls exec, or returns -1 if the machine won't count them. */
+static int count_instructions(pid_t pid) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Runs the program at `path` once, with its output going to `out`. The
+ * child waits for its counter to be opened before it calls exec. */
+static bool run_program(const char *path, const char *out, double *ms, uint64_t *instructions) {
+  int fds[2], status, fd, counter;
+  uint64_t start;
+  char c = 0;
+  pid_t pid;
+
+  if (pipe(fds) != 0)
+    return false;
+
+  if ((pid = fork()) < 0)
+    return false;
+
+  if (pid == 0) {
+    close(fds[1]);
+    fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0 || read(fds[0], &c, 1) != 1)
+      _exit(127);
+
+    dup2(fd, STDOUT_FILENO);
+    execl(path, path, (char *)NULL);
+    _exit(127);
+  }
+
+  close(fds[0]);
+  counter = count_instructions(pid);
+  start = clock_ns();
+
+  if (write(fds[1], &c, 1) != 1)
+    kill(pid, SIGKILL);
+
+  close(fds[1]);
+
+  if (waitpid(pid, &status, 0) < 0)
+    return false;
+
+  *ms = (clock_ns() - start) / 1e6;
+  *instructions = 0;
+
+  if (counter >= 0) {
+    if (read(counter, instructions, sizeof(*instructions)) != sizeof(*instructions))
+      *instructions = 0;
+
+    close(counter);
+  }
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Builds `name` as `build` into `dir`/`name`-`build`. Jotunheim writes the
+ * executable next to its input, so each level compiles a copy of it. */
+static bool build_program(const char *compiler, const char *programs, const char *dir,
+  const char *name, enum build build, const char *exe)
+{
+  char source[PATH_MAX], copy[PATH_MAX + 256], file[256], log[PATH_MAX], level[4], *chars;
+  FILE *fptr;
+  bool ok;
+
+  snprintf(log, sizeof(log), "%s/%s-%s.log", dir, name, build_names[build]);
+
+  if (build == BUILD_CC) {
+    snprintf(source, sizeof(source), "%s/%s.c", programs, name);
+
+    return run_command((char *[]) { "cc", "-O2", "-o", (char *)exe, source, NULL }, NULL, log);
+  }
+
+  snprintf(source, sizeof(source), "%s/%s.jh", programs, name);
+  snprintf(file, sizeof(file), "%s-%s.jh", name, build_names[build]);
+  snprintf(copy, sizeof(copy), "%s/%s", dir, file);
+  snprintf(level, sizeof(level), "-%s", build_names[build]);
+
+  if ((chars = read_file(source)) == NULL || (fptr = fopen(copy, "w")) == NULL) {
+    fprintf(stderr, "Failed to copy %s to %s. %s\n", source, copy, strerror(errno));
+    free(chars);
+    return false;
+  }
+
+  fputs(chars, fptr);
+  fclose(fptr);
+  free(chars);
+
+  ok = run_command((char *[]) { (char *)compiler, "--no-cache", level, file, NULL }, dir, log);
+
+  if (!ok)
+    fprintf(stderr, "Failed to build %s at %s, see %s.\n", name, level, log);
+
+  return ok;
+}
+
+static void bench_program(const char *compiler, const char *programs, const char *dir,
+  const char *name, size_t runs, struct measurement measurements[BUILDS_LEN])
+{
+  char exe[PATH_MAX], out[PATH_MAX + 4], *expected = NULL, *output;
+  double ms[MAX_RUNS], instructions[MAX_RUNS];
+  uint64_t count;
+  struct stat st;
+  struct measurement *m;
+
+  for (size_t i = 0; i < BUILDS_LEN; i++) {
+    m = &measurements[i];
+    memset(m, 0, sizeof(*m));
+    snprintf(exe, sizeof(exe), "%s/%s-%s", dir, name, build_names[i]);
+    snprintf(out, sizeof(out), "%s.out", exe);
+
+    if (!build_program(compiler, programs, dir, name, i, exe))
+      continue;
+
+    stat(exe, &st);
+    m->bytes = st.st_size;
+    m->ok = true;
+
+    for (size_t j = 0; j < runs && m->ok; j++) {
+      m->ok = run_program(exe, out, &ms[j], &count);
+      instructions[j] = count;
+    }
+
+    if (!m->ok) {
+      fprintf(stderr, "Running %s failed.\n", exe);
+      continue;
+    }
+
+    m->ms = median(ms, runs);
+    m->instructions = median(instructions, runs);
+    output = read_file(out);
+
+    if (i == BUILD_CC) {
+      expected = output;
+    } else {
+      if (expected != NULL && (output == NULL || strcmp(output, expected) != 0)) {
+        fprintf(stderr, "%s printed something else than %s-cc, see %s.\n", exe, name, out);
+        m->ok = false;
+      }
+
+      free(output);
+    }
+  }
+
+  free(expected);
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/* Finds the programs which have both a .jh and a .c file. */
+static size_t find_programs(const char *programs, char **names) {
+  char path[PATH_MAX];
+  struct dirent *entry;
+  size_t names_len = 0, len;
+  DIR *dir = opendir(programs);
+
+  if (dir == NULL)
+    return 0;
+
+  while ((entry = readdir(dir)) != NULL && names_len < MAX_PROGRAMS) {
+    len = strlen(entry->d_name);
+
+    if (len < 4 || strcmp(entry->d_name + len - 3, ".jh") != 0)
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%.*s.c", programs, (int)len - 3, entry->d_name);
+
+    if (access(path, R_OK) == 0)
+      names[names_len++] = strndup(entry->d_name, len - 3);
+  }
+
+  closedir(dir);
+  qsort(names, names_len, sizeof(char *), compare_names);
+
+  return names_len;
+}
+
+static void print_results(char **names, size_t names_len,
+  struct measurement (*results)[BUILDS_LEN])
+{
+  struct measurement *m, *cc;
+
+  printf("%-12s %-6s %12s %8s %16s %12s\n", "program", "build", "time (ms)", "vs cc",
+    "instructions", "size (KiB)");
+
+  for (size_t i = 0; i < names_len; i++) {
+    cc = &results[i][BUILD_CC];
+
+    for (size_t j = 0; j < BUILDS_LEN; j++) {
+      m = &results[i][j];
+
+      if (!m->ok) {
+        printf("%-12s %-6s %12s\n", names[i], build_names[j], "failed");
+        continue;
+      }
+
+      printf("%-12s %-6s %12.1f", names[i], build_names[j], m->ms);
+
+      if (cc->ok && cc->ms > 0)
+        printf(" %7.2fx", m->ms / cc->ms);
+      else
+        printf(" %8s", "-");
+
+      if (m->instructions > 0)
+        printf(" %16lu", m->instructions);
+      else
+        printf(" %16s", "-");
+
+      printf(" %12.1f\n", m->bytes / 1024.0);
+    }
+  }
+}
+
+static bool write_results(const char *path, size_t runs, char **names, size_t names_len,
+  struct measurement (*results)[BUILDS_LEN])
+{
+  FILE *fptr = fopen(path, "w");
+  struct measurement *m;
+
+  if (fptr == NULL) {
+    fprintf(stderr, "Failed to write %s. %s\n", path, strerror(errno));
+    return false;
+  }
+
+  fprintf(fptr, "{\"runs\":%zu,\"programs\":{", runs);
+
+  for (size_t i = 0; i < names_len; i++) {
+    fprintf(fptr, "%s\n\"%s\":{", i == 0 ? "" : ",", names[i]);
+
+    for (size_t j = 0; j < BUILDS_LEN; j++) {
+      m = &results[i][j];
+      fprintf(fptr, "%s\"%s\":", j == 0 ? "" : ",", build_names[j]);
+
+      if (m->ok) {
+        fprintf(fptr, "{\"ms\":%.3f,\"instructions\":%lu,\"bytes\":%zu}", m->ms,
+          m->instructions, m->bytes);
+      } else {
+        fprintf(fptr, "null");
+      }
+    }
+
+    fprintf(fptr, "}");
+  }
+
+  fprintf(fptr, "\n}}\n");
+
+  return fclose(fptr) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *compiler = "out/release/jotunheim", *programs = "bench/programs";
+  const char *dir = "out/bench/programs";
+  char compiler_path[PATH_MAX], path[PATH_MAX], *names[MAX_PROGRAMS], *name;
+  size_t runs = 5, names_len, selected_len = 0;
+  struct measurement (*results)[BUILDS_LEN];
+  bool found, ok = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--compiler=", 11) == 0) {
+      compiler = argv[i] + 11;
+    } else if (strncmp(argv[i], "--programs=", 11) == 0) {
+      programs = argv[i] + 11;
+    } else if (strncmp(argv[i], "--dir=", 6) == 0) {
+      dir = argv[i] + 6;
+    } else if (strncmp(argv[i], "--runs=", 7) == 0 && atoi(argv[i] + 7) > 0) {
+      runs = atoi(argv[i] + 7) < MAX_RUNS ? atoi(argv[i] + 7) : MAX_RUNS;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option %s.\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // The compiler runs in `dir`, so that what it writes ends up there.
+  if (realpath(compiler, compiler_path) == NULL) {
+    fprintf(stderr, "Failed to find the compiler %s. %s\n", compiler, strerror(errno));
+    return 1;
+  }
+
+  if ((names_len = find_programs(programs, names)) == 0) {
+    fprintf(stderr, "Failed to find any programs in %s.\n", programs);
+    return 1;
+  }
+
+  // Programs named on the command line are the only ones run.
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-')
+      continue;
+
+    found = false;
+
+    for (size_t j = selected_len; j < names_len && !found; j++) {
+      if (strcmp(argv[i], names[j]) == 0) {
+        name = names[j];
+        names[j] = names[selected_len];
+        names[selected_len++] = name;
+        found = true;
+      }
+    }
+
+    if (!found) {
+      fprintf(stderr, "Unknown program %s.\n", argv[i]);
+      return 1;
+    }
+  }
+
+  for (size_t i = selected_len; i < names_len && selected_len > 0; i++)
+    free(names[i]);
+
+  if (selected_len > 0)
+    names_len = selected_len;
+
+  mkdir(dir, 0755);
+  results = calloc(names_len, sizeof(*results));
+
+  for (size_t i = 0; i < names_len; i++) {
+    fprintf(stderr, "Running %s...\n", names[i]);
+    bench_program(compiler_path, programs, dir, names[i], runs, results[i]);
+
+    for (size_t j = 0; j < BUILDS_LEN; j++)
+      ok = ok && results[i][j].ok;
+  }
+
+  print_results(names, names_len, results);
+
+  snprintf(path, sizeof(path), "%s/results.json", dir);
+
+  if (!write_results(path, runs, names, names_len, results))
+    ok = false;
+
+  for (size_t i = 0; i < names_len; i++)
+    free(names[i]);
+
+  free(results);
+
+  return ok ? 0 : 1;
+}
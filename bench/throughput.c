@@ -0,0 +1,570 @@
+/* Compiler throughput benchmark. Generates .jh corpora of one shape each,
+ * compiles every one a few times with --time-report=file.json, and writes
+ * the medians and the rates of each phase to results.json. When there is a
+ * baseline from an earlier run, the results are compared against it.
+ *
+ *   throughput [--compiler=path] [--dir=out/bench] [--scale=N] [--runs=N]
+ *     [--threshold=percent] [--save-baseline] [corpus...]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_RUNS 64
+
+/* How many operands one long expression has. */
+#define EXPR_OPERANDS 2000
+/* How deep the ifs nest inside the last else of each chain. */
+#define BRANCH_DEPTH 48
+#define BRANCH_CHAIN 16
+#define STRING_LEN (16 * 1024)
+
+enum phase {
+  PHASE_LEX,
+  PHASE_PARSE,
+  PHASE_EMIT,
+  PHASE_PASSES,
+  PHASE_SSA,
+  PHASE_QBE,
+  PHASE_CC,
+  PHASES_LEN,
+};
+
+static const char *phase_names[] = {
+  [PHASE_LEX] = "lex",
+  [PHASE_PARSE] = "parse",
+  [PHASE_EMIT] = "emit",
+  [PHASE_PASSES] = "passes",
+  [PHASE_SSA] = "ssa",
+  [PHASE_QBE] = "qbe",
+  [PHASE_CC] = "cc",
+};
+
+/* The phases which count what they go through, and what the rate of each is
+ * called in the results. */
+enum rate {
+  RATE_TOKENS,
+  RATE_NODES,
+  RATE_INSTS,
+  RATE_SSA_BYTES,
+  RATES_LEN,
+};
+
+static const struct {
+  enum phase phase;
+  const char *item, *name, *label;
+} rates[] = {
+  [RATE_TOKENS] = { PHASE_LEX, "tokens", "tokens", "tokens/s" },
+  [RATE_NODES] = { PHASE_PARSE, "nodes", "nodes", "nodes/s" },
+  [RATE_INSTS] = { PHASE_EMIT, "insts", "insts", "insts/s" },
+  [RATE_SSA_BYTES] = { PHASE_SSA, "bytes", "ssa_bytes", "ssa B/s" },
+};
+
+struct result {
+  size_t source_bytes;
+  double total_ms;
+  double phase_ms[PHASES_LEN];
+  double items[RATES_LEN];
+  double per_sec[RATES_LEN];
+};
+
+struct corpus {
+  const char *name;
+  /* Writes the corpus at `scale` to `fptr`. */
+  void (*generate)(FILE *fptr, size_t scale);
+  /* Extra arguments to compile it with, or NULL. */
+  const char *option;
+};
+
+static const char *prelude = "printf :: proc (fmt: i64, ..) -> i32;\n"
+  "puts :: proc (s: i64) -> i32;\n"
+  "fmt :: \"%ld\\n\";\n\n";
+
+/* `scale` thousand procedures, calling each other as a binary tree so that
+ * every one of them is reachable from main but none recurses deeply. */
+static void generate_procs(FILE *fptr, size_t scale) {
+  size_t procs = scale * 1000;
+
+  fputs(prelude, fptr);
+
+  for (size_t i = 0; i < procs; i++) {
+    fprintf(fptr, "p%zu :: proc (n: i64, m: i64) -> i64 {\n", i);
+    fprintf(fptr, "  a := n * %zu + m;\n", i % 13 + 2);
+    fprintf(fptr, "  b := a / 3 - n %% %zu;\n", i % 7 + 2);
+    fprintf(fptr, "  if a < b { a = b - %zu; }\n", i);
+
+    if (2 * i + 2 < procs)
+      fprintf(fptr, "  return p%zu(a, b - 1) + p%zu(b, a + 1);\n", 2 * i + 1, 2 * i + 2);
+    else if (2 * i + 1 < procs)
+      fprintf(fptr, "  return p%zu(a, b);\n", 2 * i + 1);
+    else
+      fprintf(fptr, "  return a + b;\n");
+
+    fprintf(fptr, "}\n\n");
+  }
+
+  fprintf(fptr, "main :: proc () {\n  printf(fmt, p0(3, 4));\n  return 0;\n}\n");
+}
+
+/* else if chains, each ending in an else with deeply nested ifs. */
+static void generate_branches(FILE *fptr, size_t scale) {
+  size_t procs = scale * 200;
+
+  fputs(prelude, fptr);
+
+  for (size_t i = 0; i < procs; i++) {
+    fprintf(fptr, "b%zu :: proc (n: i64) -> i64 {\n  if n == 0 {\n    return %zu;\n  }", i, i);
+
+    for (size_t j = 1; j < BRANCH_CHAIN; j++)
+      fprintf(fptr, " else if n == %zu {\n    return n * %zu;\n  }", j, i + j);
+
+    fprintf(fptr, " else {\n");
+
+    for (size_t j = 0; j < BRANCH_DEPTH; j++)
+      fprintf(fptr, "%*sif n > %zu {\n", (int)(j + 2) * 2, "", j + BRANCH_CHAIN);
+
+    fprintf(fptr, "%*sreturn n - %zu;\n", BRANCH_DEPTH * 2 + 4, "", i);
+
+    for (size_t j = BRANCH_DEPTH; j > 0; j--)
+      fprintf(fptr, "%*s} else {\n%*sn = n + 1;\n%*s}\n", (int)(j + 1) * 2, "",
+        (int)(j + 2) * 2, "", (int)(j + 1) * 2, "");
+
+    fprintf(fptr, "  }\n  return n;\n}\n\n");
+  }
+
+  fprintf(fptr, "main :: proc () {\n  acc := 0;\n");
+
+  for (size_t i = 0; i < procs; i++)
+    fprintf(fptr, "  acc = acc + b%zu(%zu);\n", i, i % 64);
+
+  fprintf(fptr, "  printf(fmt, acc);\n  return 0;\n}\n");
+}
+
+/* Long expressions, alternating between operators of two precedences so the
+ * parser's operator stack stays shallow. */
+static void generate_expressions(FILE *fptr, size_t scale) {
+  static const char *ops[] = { "+", "*", "-", "/", "+", "%" };
+  size_t procs = scale * 20;
+
+  fputs(prelude, fptr);
+
+  for (size_t i = 0; i < procs; i++) {
+    fprintf(fptr, "e%zu :: proc (a: i64, b: i64) -> i64 {\n  x := a", i);
+
+    for (size_t j = 1; j < EXPR_OPERANDS; j++) {
+      fprintf(fptr, " %s %s", ops[j % 6], j % 3 == 0 ? "b" : j % 3 == 1 ? "a" : "7");
+
+      if (j % 16 == 0)
+        fprintf(fptr, "\n   ");
+    }
+
+    fprintf(fptr, ";\n  return x;\n}\n\n");
+  }
+
+  fprintf(fptr, "main :: proc () {\n  acc := 0;\n");
+
+  for (size_t i = 0; i < procs; i++)
+    fprintf(fptr, "  acc = acc + e%zu(%zu, 3);\n", i, i + 1);
+
+  fprintf(fptr, "  printf(fmt, acc);\n  return 0;\n}\n");
+}
+
+/* Constants, built with --keep-unused so that all of them are emitted. */
+static void generate_globals(FILE *fptr, size_t scale) {
+  size_t globals = scale * 5000;
+
+  fputs(prelude, fptr);
+
+  for (size_t i = 0; i < globals; i++) {
+    if (i % 4 == 3)
+      fprintf(fptr, "g%zu :: g%zu * 3 + g%zu;\n", i, i - 1, i - 3);
+    else
+      fprintf(fptr, "g%zu :: %zu;\n", i, i * 7 + 1);
+  }
+
+  fprintf(fptr, "\nmain :: proc () {\n  printf(fmt, g%zu);\n  return 0;\n}\n", globals - 1);
+}
+
+/* Huge string constants, all printed by main. */
+static void generate_strings(FILE *fptr, size_t scale) {
+  size_t strings = scale * 64;
+
+  fputs(prelude, fptr);
+
+  for (size_t i = 0; i < strings; i++) {
+    fprintf(fptr, "s%zu :: \"", i);
+
+    for (size_t j = 0; j < STRING_LEN; j++)
+      fputc('a' + (i + j) % 26, fptr);
+
+    fprintf(fptr, "\";\n");
+  }
+
+  fprintf(fptr, "\nmain :: proc () {\n");
+
+  for (size_t i = 0; i < strings; i++)
+    fprintf(fptr, "  puts(s%zu);\n", i);
+
+  fprintf(fptr, "  return 0;\n}\n");
+}
+
+static const struct corpus corpora[] = {
+  { "procs", generate_procs, NULL },
+  { "branches", generate_branches, NULL },
+  { "expressions", generate_expressions, NULL },
+  { "globals", generate_globals, "--keep-unused" },
+  { "strings", generate_strings, NULL },
+};
+
+#define CORPORA_LEN (sizeof(corpora) / sizeof(corpora[0]))
+
+static char *read_file(const char *path) {
+  FILE *fptr = fopen(path, "r");
+  char *chars;
+  long len;
+
+  if (fptr == NULL)
+    return NULL;
+
+  fseek(fptr, 0, SEEK_END);
+  len = ftell(fptr);
+  fseek(fptr, 0, SEEK_SET);
+
+  chars = malloc(len + 1);
+  chars[fread(chars, 1, len, fptr)] = 0;
+  fclose(fptr);
+
+  return chars;
+}
+
+/* Finds `"field":` in the JSON object called `object` in `json`, which is
+ * only as nested as the reports and results are. */
+static bool json_number(const char *json, const char *object, const char *field, double *value) {
+  char key[64];
+  const char *start, *end, *found;
+
+  snprintf(key, sizeof(key), "\"%s\":{", object);
+
+  if ((start = strstr(json, key)) == NULL)
+    return false;
+
+  start += strlen(key);
+  end = strchr(start, '}');
+  snprintf(key, sizeof(key), "\"%s\":", field);
+
+  if ((found = strstr(start, key)) == NULL || (end != NULL && found > end))
+    return false;
+
+  *value = strtod(found + strlen(key), NULL);
+
+  return true;
+}
+
+/* Compiles `source` in `dir` once, with stdout and stderr going to `log`. */
+static bool compile(const char *compiler, const char *dir, const char *source,
+  const char *option, const char *report, const char *log)
+{
+  char *argv[] = { (char *)compiler, (char *)source, "--no-cache", (char *)report,
+    (char *)option, NULL };
+  int status, fd;
+  pid_t pid = fork();
+
+  if (pid < 0)
+    return false;
+
+  if (pid == 0) {
+    fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (chdir(dir) != 0 || fd < 0)
+      _exit(127);
+
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    execv(compiler, argv);
+    _exit(127);
+  }
+
+  if (waitpid(pid, &status, 0) < 0)
+    return false;
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double median(double *values, size_t len) {
+  qsort(values, len, sizeof(double), compare_doubles);
+
+  return len % 2 == 1 ? values[len / 2] : (values[len / 2 - 1] + values[len / 2]) / 2;
+}
+
+static bool bench_corpus(const struct corpus *corpus, const char *compiler, const char *dir,
+  size_t scale, size_t runs, struct result *result)
+{
+  char file[64], source[PATH_MAX], report_path[PATH_MAX], report[80], log[PATH_MAX], *json;
+  double total[MAX_RUNS], phases[PHASES_LEN][MAX_RUNS], items[RATES_LEN][MAX_RUNS];
+  FILE *fptr;
+  struct stat st;
+
+  memset(result, 0, sizeof(*result));
+  memset(phases, 0, sizeof(phases));
+  memset(items, 0, sizeof(items));
+
+  snprintf(file, sizeof(file), "%s.jh", corpus->name);
+  snprintf(source, sizeof(source), "%s/%s", dir, file);
+  snprintf(report, sizeof(report), "--time-report=%s.report.json", corpus->name);
+  snprintf(report_path, sizeof(report_path), "%s/%s.report.json", dir, corpus->name);
+  snprintf(log, sizeof(log), "%s/%s.log", dir, corpus->name);
+
+  if ((fptr = fopen(source, "w")) == NULL) {
+    fprintf(stderr, "Failed to write %s. %s\n", source, strerror(errno));
+    return false;
+  }
+
+  corpus->generate(fptr, scale);
+  fclose(fptr);
+
+  stat(source, &st);
+  result->source_bytes = st.st_size;
+
+  for (size_t i = 0; i < runs; i++) {
+    if (!compile(compiler, dir, file, corpus->option, report, log)) {
+      fprintf(stderr, "Failed to compile %s, see %s.\n", source, log);
+      return false;
+    }
+
+    json = read_file(report_path);
+
+    if (json == NULL || !json_number(json, "total", "wall_ms", &total[i])) {
+      fprintf(stderr, "Failed to read the report of %s.\n", source);
+      free(json);
+      return false;
+    }
+
+    for (size_t j = 0; j < PHASES_LEN; j++)
+      json_number(json, phase_names[j], "wall_ms", &phases[j][i]);
+
+    for (size_t j = 0; j < RATES_LEN; j++)
+      json_number(json, phase_names[rates[j].phase], rates[j].item, &items[j][i]);
+
+    free(json);
+  }
+
+  result->total_ms = median(total, runs);
+
+  for (size_t i = 0; i < PHASES_LEN; i++)
+    result->phase_ms[i] = median(phases[i], runs);
+
+  for (size_t i = 0; i < RATES_LEN; i++) {
+    result->items[i] = median(items[i], runs);
+
+    if (result->phase_ms[rates[i].phase] > 0)
+      result->per_sec[i] = result->items[i] / (result->phase_ms[rates[i].phase] / 1000);
+  }
+
+  return true;
+}
+
+static bool write_results(const char *path, size_t scale, size_t runs,
+  const bool *selected, const struct result *results)
+{
+  FILE *fptr = fopen(path, "w");
+  bool first = true;
+
+  if (fptr == NULL) {
+    fprintf(stderr, "Failed to write %s. %s\n", path, strerror(errno));
+    return false;
+  }
+
+  fprintf(fptr, "{\"scale\":%zu,\"runs\":%zu,\"corpora\":{", scale, runs);
+
+  for (size_t i = 0; i < CORPORA_LEN; i++) {
+    if (!selected[i])
+      continue;
+
+    fprintf(fptr, "%s\n\"%s\":{\"source_bytes\":%zu,\"total_ms\":%.3f", first ? "" : ",",
+      corpora[i].name, results[i].source_bytes, results[i].total_ms);
+
+    for (size_t j = 0; j < PHASES_LEN; j++)
+      fprintf(fptr, ",\"%s_ms\":%.3f", phase_names[j], results[i].phase_ms[j]);
+
+    for (size_t j = 0; j < RATES_LEN; j++) {
+      fprintf(fptr, ",\"%s\":%.0f,\"%s_per_sec\":%.0f", rates[j].name, results[i].items[j],
+        rates[j].name, results[i].per_sec[j]);
+    }
+
+    fprintf(fptr, "}");
+    first = false;
+  }
+
+  fprintf(fptr, "\n}}\n");
+
+  return fclose(fptr) == 0;
+}
+
+static void print_results(const bool *selected, const struct result *results) {
+  printf("%-12s %10s %10s", "corpus", "src (KiB)", "total (ms)");
+
+  for (size_t i = 0; i < RATES_LEN; i++)
+    printf(" %12s", rates[i].label);
+
+  printf("\n");
+
+  for (size_t i = 0; i < CORPORA_LEN; i++) {
+    if (!selected[i])
+      continue;
+
+    printf("%-12s %10zu %10.1f", corpora[i].name, results[i].source_bytes / 1024,
+      results[i].total_ms);
+
+    for (size_t j = 0; j < RATES_LEN; j++)
+      printf(" %12.3g", results[i].per_sec[j]);
+
+    printf("\n");
+  }
+}
+
+/* Prints how the end-to-end time and the rates changed since the baseline.
+ * Returns false if any of them got worse by more than `threshold` percent. */
+static bool compare_results(const char *baseline, const bool *selected,
+  const struct result *results, double threshold)
+{
+  char name[64];
+  double before, after, change;
+  bool ok = true, worse;
+
+  printf("\n%-12s %-18s %14s %14s %9s\n", "corpus", "metric", "baseline", "current", "change");
+
+  for (size_t i = 0; i < CORPORA_LEN; i++) {
+    if (!selected[i])
+      continue;
+
+    for (size_t j = 0; j <= RATES_LEN; j++) {
+      // The end-to-end time comes first, lower is better for it and higher
+      // is better for the rates.
+      if (j == 0) {
+        snprintf(name, sizeof(name), "total_ms");
+        after = results[i].total_ms;
+      } else {
+        snprintf(name, sizeof(name), "%s_per_sec", rates[j - 1].name);
+        after = results[i].per_sec[j - 1];
+      }
+
+      if (!json_number(baseline, corpora[i].name, name, &before) || before == 0)
+        continue;
+
+      change = (after - before) / before * 100;
+      worse = j == 0 ? change > threshold : change < -threshold;
+      ok = ok && !worse;
+
+      printf("%-12s %-18s %14.6g %14.6g %+8.1f%%%s\n", corpora[i].name, name, before, after,
+        change, worse ? "  regressed" : "");
+    }
+  }
+
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  const char *compiler = "out/release/jotunheim", *dir = "out/bench";
+  char compiler_path[PATH_MAX], path[PATH_MAX], *baseline;
+  size_t scale = 1, runs = 5;
+  double threshold = 10;
+  bool save_baseline = false, filtered = false, found, selected[CORPORA_LEN] = { 0 };
+  struct result results[CORPORA_LEN];
+  int status = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--compiler=", 11) == 0) {
+      compiler = argv[i] + 11;
+    } else if (strncmp(argv[i], "--dir=", 6) == 0) {
+      dir = argv[i] + 6;
+    } else if (strncmp(argv[i], "--scale=", 8) == 0 && atoi(argv[i] + 8) > 0) {
+      scale = atoi(argv[i] + 8);
+    } else if (strncmp(argv[i], "--runs=", 7) == 0 && atoi(argv[i] + 7) > 0) {
+      runs = atoi(argv[i] + 7) < MAX_RUNS ? atoi(argv[i] + 7) : MAX_RUNS;
+    } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+      threshold = strtod(argv[i] + 12, NULL);
+    } else if (strcmp(argv[i], "--save-baseline") == 0) {
+      save_baseline = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option %s.\n", argv[i]);
+      return 1;
+    } else {
+      found = false;
+
+      for (size_t j = 0; j < CORPORA_LEN; j++) {
+        if (strcmp(argv[i], corpora[j].name) == 0)
+          found = selected[j] = true;
+      }
+
+      if (!found) {
+        fprintf(stderr, "Unknown corpus %s.\n", argv[i]);
+        return 1;
+      }
+
+      filtered = true;
+    }
+  }
+
+  // The compiler runs in `dir`, so that what it writes ends up there.
+  if (realpath(compiler, compiler_path) == NULL) {
+    fprintf(stderr, "Failed to find the compiler %s. %s\n", compiler, strerror(errno));
+    return 1;
+  }
+
+  mkdir(dir, 0755);
+
+  for (size_t i = 0; i < CORPORA_LEN; i++) {
+    if (filtered && !selected[i])
+      continue;
+
+    fprintf(stderr, "Compiling %s...\n", corpora[i].name);
+    selected[i] = bench_corpus(&corpora[i], compiler_path, dir, scale, runs, &results[i]);
+
+    if (!selected[i])
+      status = 1;
+  }
+
+  print_results(selected, results);
+
+  snprintf(path, sizeof(path), "%s/results.json", dir);
+
+  if (!write_results(path, scale, runs, selected, results))
+    return 1;
+
+  snprintf(path, sizeof(path), "%s/baseline.json", dir);
+
+  if (save_baseline) {
+    if (!write_results(path, scale, runs, selected, results))
+      return 1;
+
+    printf("\nSaved the baseline to %s.\n", path);
+  } else if ((baseline = read_file(path)) != NULL) {
+    snprintf(path, sizeof(path), "{\"scale\":%zu,", scale);
+
+    // Rates don't compare across scales, the fixed costs weigh differently.
+    if (strncmp(baseline, path, strlen(path)) != 0)
+      printf("\nThe baseline was measured at another scale, not comparing.\n");
+    else if (!compare_results(baseline, selected, results, threshold))
+      status = 1;
+
+    free(baseline);
+  }
+
+  return status;
+}
@@ -107,3 +107,16 @@ size_t arena_used(struct arena *arena) {
   return total;
 }
 
+size_t arena_regions(struct arena *arena, size_t *used, size_t *capacity, size_t len) {
+  struct region *region = arena->first;
+  size_t regions = 0;
+
+  for (; region != NULL; region = region->next, regions++) {
+    if (regions < len) {
+      used[regions] = region->size * sizeof(uintptr_t);
+      capacity[regions] = region->capacity * sizeof(uintptr_t);
+    }
+  }
+
+  return regions;
+}
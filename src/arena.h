@@ -13,5 +13,8 @@ void arena_reset(struct arena *arena);
 void arena_free(struct arena *arena);
 
 size_t arena_used(struct arena *arena);
+/* Fills in how many bytes of each region of `arena` are used, and how big
+ * they are, for up to `len` regions. Returns how many regions there are. */
+size_t arena_regions(struct arena *arena, size_t *used, size_t *capacity, size_t len);
 
 #endif
@@ -1 +1,130 @@
 #include "ast.h"
+
+#include <string.h>
+
+static const struct ast_type_info ast_type_infos[] = {
+  [TYPE_NONE] = { "<none>", 0, false },
+  [TYPE_UNTYPED_INT] = { "untyped integer", 8, true },
+  [TYPE_I8] = { "i8", 1, true },
+  [TYPE_I16] = { "i16", 2, true },
+  [TYPE_I32] = { "i32", 4, true },
+  [TYPE_I64] = { "i64", 8, true },
+  [TYPE_U8] = { "u8", 1, false },
+  [TYPE_U16] = { "u16", 2, false },
+  [TYPE_U32] = { "u32", 4, false },
+  [TYPE_U64] = { "u64", 8, false },
+};
+
+const struct ast_type_info *ast_type_info(ast_type type) {
+  return &ast_type_infos[type];
+}
+
+const char *ast_type_tostring(ast_type type) {
+  return ast_type_infos[type].name;
+}
+
+bool ast_type_from_ident(struct ident *ident, ast_type *type) {
+  for (ast_type t = TYPE_I8; t <= TYPE_U64; t++) {
+    if (strncmp(ast_type_infos[t].name, ident->chars, ident->len) == 0
+      && ast_type_infos[t].name[ident->len] == 0)
+    {
+      *type = t;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool ast_type_fits(ast_type type, int64_t value) {
+  const struct ast_type_info *info = &ast_type_infos[type];
+  int bits = info->size * 8;
+
+  if (bits == 64)
+    return info->is_signed || value >= 0;
+
+  if (info->is_signed)
+    return value >= -((int64_t)1 << (bits - 1)) && value < ((int64_t)1 << (bits - 1));
+
+  return value >= 0 && value < ((int64_t)1 << bits);
+}
+
+static size_t ast_expr_nodes(const struct ast_expr *expr) {
+  size_t nodes = 1;
+
+  switch (expr->type) {
+    case TERM_INT:
+    case TERM_IDENT:
+      break;
+
+    case TERM_FN_CALL: {
+      nodes += ast_expr_nodes(expr->as.fn_call->fn);
+
+      for (size_t i = 0; i < expr->as.fn_call->args_len; i++)
+        nodes += ast_expr_nodes(expr->as.fn_call->args[i]);
+    } break;
+
+    case EXPR_OPERATION: {
+      nodes += ast_expr_nodes(expr->as.op.lhs);
+
+      if (expr->as.op.op != OP_NEG)
+        nodes += ast_expr_nodes(expr->as.op.rhs);
+    } break;
+  }
+
+  return nodes;
+}
+
+static size_t ast_stmts_nodes(size_t stmts_len, struct ast_stmt **stmts) {
+  size_t nodes = 0;
+  struct ast_stmt *stmt;
+  struct ast_if *if_;
+
+  for (size_t i = 0; i < stmts_len; i++) {
+    stmt = stmts[i];
+    nodes++;
+
+    switch (stmt->type) {
+      case STMT_EXPR:
+      case STMT_RET: {
+        if (stmt->as.expr != NULL)
+          nodes += ast_expr_nodes(stmt->as.expr);
+      } break;
+
+      case STMT_LET:
+      case STMT_ASSIGN: {
+        if (stmt->as.let->expr != NULL)
+          nodes += ast_expr_nodes(stmt->as.let->expr);
+      } break;
+
+      case STMT_IF: {
+        if_ = stmt->as.if_;
+
+        for (size_t j = 0; j < if_->branches_len; j++) {
+          nodes += 1 + ast_expr_nodes(if_->branches[j].cond);
+          nodes += ast_stmts_nodes(if_->branches[j].stmts_len, if_->branches[j].stmts);
+        }
+
+        nodes += ast_stmts_nodes(if_->else_stmts_len, if_->else_stmts);
+      } break;
+    }
+  }
+
+  return nodes;
+}
+
+size_t ast_nodes(const struct ast *ast) {
+  size_t nodes = ast->consts_len;
+  const struct ast_const *c;
+
+  for (size_t i = 0; i < ast->consts_len; i++) {
+    c = &ast->consts[i];
+
+    if (c->type == CONST_PROC)
+      nodes += c->as.proc.params_len + ast_stmts_nodes(c->as.proc.stmts_len, c->as.proc.stmts);
+    else if ((c->type == CONST_EXPR || c->type == CONST_RUN) && c->as.expr != NULL)
+      nodes += ast_expr_nodes(c->as.expr);
+  }
+
+  return nodes;
+}
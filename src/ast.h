@@ -1,6 +1,7 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -23,6 +24,22 @@ typedef enum {
   OP_NEG,
 } expr_op;
 
+typedef enum {
+  /* No type was written, it is inferred from the value. */
+  TYPE_NONE,
+  /* Integer literals and integer constants, which take on whichever integer
+   * type their context needs. */
+  TYPE_UNTYPED_INT,
+  TYPE_I8, TYPE_I16, TYPE_I32, TYPE_I64,
+  TYPE_U8, TYPE_U16, TYPE_U32, TYPE_U64,
+} ast_type;
+
+struct ast_type_info {
+  const char *name;
+  size_t size;
+  bool is_signed;
+};
+
 typedef enum {
   STMT_EXPR,
   STMT_RET,
@@ -31,11 +48,24 @@ typedef enum {
   STMT_IF,
 } ast_stmt_type;
 
+typedef enum {
+  PROC_EMPTY = 0,
+  PROC_EXPORT = 1 << 0,
+  PROC_FORCE_INLINE = 1 << 1,
+  PROC_NO_INLINE = 1 << 2,
+  /* Declared with a trailing `..`, extra arguments are passed as is. */
+  PROC_VARIADIC = 1 << 3,
+  /* Declared as `proc ();`, calls to it are not checked. */
+  PROC_UNCHECKED = 1 << 4,
+} ast_proc_flags;
+
 typedef enum {
   CONST_PROC,
   CONST_EXPR,
   CONST_STRING,
   CONST_PROC_DECLARATION,
+  /* `#run expr`, which may call procedures at compile time. */
+  CONST_RUN,
 } ast_const_type;
 
 struct ident {
@@ -52,6 +82,8 @@ struct ast_expr;
 
 struct ast_assign {
   struct ident ident;
+  /* Only set for `let`s with a type, `x : i32 = 0;`. */
+  ast_type type;
   struct ast_expr *expr;
 };
 
@@ -85,9 +117,17 @@ struct ast_operation {
   struct ast_expr *lhs, *rhs;
 };
 
+struct ast_param {
+  struct ident ident;
+  ast_type type;
+};
+
 struct ast_proc {
-  size_t args_len;
-  struct ident *idents;
+  ast_proc_flags flags;
+  size_t params_len;
+  struct ast_param *params;
+  /* TYPE_I64 when no return type is written. */
+  ast_type ret_type;
   size_t stmts_len;
   struct ast_stmt **stmts;
 };
@@ -120,13 +160,38 @@ struct ast_const_as {
 
 struct ast_const {
   struct ident ident;
+  /* The source of the file the constant is defined in. */
+  const char *src;
   ast_const_type type;
   struct ast_const_as as;
 };
 
+/* `#load "file.jh";` includes a file relative to the one loading it,
+ * `#import "name";` also looks for name.jh on the import path. Either way the
+ * constants of every file end up in the same global scope. */
+struct ast_import {
+  bool search;
+  struct string path;
+  /* The file name token, for diagnostics. */
+  const char *loc;
+  size_t len;
+};
+
 struct ast {
   size_t consts_len;
   struct ast_const *consts;
+  size_t imports_len;
+  struct ast_import *imports;
 };
 
+const struct ast_type_info *ast_type_info(ast_type type);
+const char *ast_type_tostring(ast_type type);
+bool ast_type_from_ident(struct ident *ident, ast_type *type);
+/* Whether the integer `value` can be represented by `type`. */
+bool ast_type_fits(ast_type type, int64_t value);
+
+/* How many constants, statements, expressions, branches and parameters
+ * `ast` is made of. */
+size_t ast_nodes(const struct ast *ast);
+
 #endif /* AST_H */
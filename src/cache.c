@@ -0,0 +1,183 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hashmap.h"
+
+void cache_key_add(struct cache_key *key, const void *data, size_t len) {
+  // Two independent hashes chained through their seeds, so every field
+  // changes the key, and a collision needs both to collide.
+  key->hash[0] = hashmap_xxhash3(data, len, key->hash[0], len);
+  key->hash[1] = hashmap_sip(data, len, key->hash[1], len);
+}
+
+void cache_key_add_string(struct cache_key *key, const char *string) {
+  // The terminator is included, so "ab" "c" and "a" "bc" differ.
+  cache_key_add(key, string, strlen(string) + 1);
+}
+
+void cache_key_add_tool(struct cache_key *key, const char *name) {
+  const char *path = getenv("PATH"), *end;
+  char full_path[4096];
+  struct stat st;
+
+  while (path != NULL && *path != 0) {
+    end = strchr(path, ':');
+
+    if (end == NULL)
+      end = path + strlen(path);
+
+    snprintf(full_path, sizeof(full_path), "%.*s/%s", (int)(end - path), path, name);
+
+    if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode)) {
+      cache_key_add_string(key, full_path);
+      cache_key_add(key, &st.st_size, sizeof(st.st_size));
+      cache_key_add(key, &st.st_mtim, sizeof(st.st_mtim));
+
+      return;
+    }
+
+    path = *end == ':' ? end + 1 : end;
+  }
+
+  cache_key_add_string(key, name);
+}
+
+void cache_key_add_self(struct cache_key *key) {
+  char path[4096];
+  struct stat st;
+  ssize_t len;
+
+  len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+  if (len < 0 || stat("/proc/self/exe", &st) != 0) {
+    // Without /proc, each build can only be told apart by the version.
+    cache_key_add_string(key, "self");
+    return;
+  }
+
+  path[len] = 0;
+  cache_key_add_string(key, path);
+  cache_key_add(key, &st.st_size, sizeof(st.st_size));
+  cache_key_add(key, &st.st_mtim, sizeof(st.st_mtim));
+}
+
+char *cache_path(struct cache_key *key, const char *suffix) {
+  const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+  char dir[4096], *path;
+  size_t len;
+
+  if (xdg != NULL && xdg[0] == '/') {
+    snprintf(dir, sizeof(dir), "%s", xdg);
+  } else if (home != NULL && home[0] != 0) {
+    snprintf(dir, sizeof(dir), "%s/.cache", home);
+  } else {
+    return NULL;
+  }
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return NULL;
+
+  len = strlen(dir);
+  snprintf(dir + len, sizeof(dir) - len, "/jotunheim");
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return NULL;
+
+  len = strlen(dir) + strlen(suffix) + 34;
+  path = malloc(len);
+  snprintf(path, len, "%s/%016lx%016lx%s", dir, key->hash[0], key->hash[1], suffix);
+
+  return path;
+}
+
+static bool cache_copy(const char *from, const char *to) {
+  char buf[65536];
+  ssize_t n = 0;
+  int in, out;
+
+  in = open(from, O_RDONLY);
+
+  if (in < 0)
+    return false;
+
+  out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+
+  while ((n = read(in, buf, sizeof(buf))) > 0) {
+    if (write(out, buf, n) != n) {
+      n = -1;
+      break;
+    }
+  }
+
+  close(in);
+
+  if (close(out) != 0 || n < 0) {
+    unlink(to);
+    return false;
+  }
+
+  return true;
+}
+
+/* Copies `from` to a temporary name next to `to`, then renames it over `to`,
+ * so `to` is either left as it was or replaced whole. */
+static bool cache_replace(const char *from, const char *to) {
+  size_t len = strlen(to) + 32;
+  char *tmp = malloc(len);
+  bool ok;
+
+  snprintf(tmp, len, "%s.%ld.tmp", to, (long)getpid());
+  ok = cache_copy(from, tmp);
+
+  if (ok && rename(tmp, to) != 0) {
+    unlink(tmp);
+    ok = false;
+  }
+
+  free(tmp);
+
+  return ok;
+}
+
+bool cache_fetch(struct cache_key *key, const char *out_filename) {
+  char *path = cache_path(key, "");
+  bool ok;
+
+  if (path == NULL)
+    return false;
+
+  // A miss leaves the output alone, so a failed rebuild keeps the old one.
+  // A hit is copied rather than linked, so a later strip or edit of the
+  // output can't corrupt the cache.
+  ok = access(path, R_OK) == 0 && cache_replace(path, out_filename);
+  free(path);
+
+  return ok;
+}
+
+void cache_store_executable(struct cache_key *key, const char *out_filename) {
+  char *path = cache_path(key, "");
+
+  if (path != NULL)
+    cache_store(path, out_filename);
+
+  free(path);
+}
+
+bool cache_store(const char *path, const char *filename) {
+  // Written under a temporary name first, so a concurrent build never sees
+  // a partial file.
+  return cache_replace(filename, path);
+}
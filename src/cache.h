@@ -0,0 +1,41 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Executables are cached in $XDG_CACHE_HOME/jotunheim, or ~/.cache/jotunheim,
+ * named after a 128-bit hash of everything that went into building them. */
+struct cache_key {
+  uint64_t hash[2];
+};
+
+void cache_key_add(struct cache_key *key, const void *data, size_t len);
+void cache_key_add_string(struct cache_key *key, const char *string);
+
+/* Adds the path, size and modification time of the program `name` in PATH,
+ * which changes whenever the program is upgraded, without running it. */
+void cache_key_add_tool(struct cache_key *key, const char *name);
+
+/* Adds the path, size and modification time of this compiler's own binary,
+ * so a rebuilt compiler doesn't reuse what the old one built. */
+void cache_key_add_self(struct cache_key *key);
+
+/* Returns the path of the cache entry for `key` with `suffix`, creating the
+ * cache directory if needed, or NULL if there is nowhere to put it. */
+char *cache_path(struct cache_key *key, const char *suffix);
+
+/* Copies the cached executable for `key` to `out_filename`.
+ * Returns false, leaving `out_filename` untouched, if there is none. */
+bool cache_fetch(struct cache_key *key, const char *out_filename);
+
+/* Copies `out_filename` into the cache as the executable for `key`. Failing
+ * to do so is not an error, the next build just won't find it. */
+void cache_store_executable(struct cache_key *key, const char *out_filename);
+
+/* Copies `filename` into the cache entry at `path`. Returns false if that
+ * failed, which only matters when the entry is used right away. */
+bool cache_store(const char *path, const char *filename);
+
+#endif /* CACHE_H */
@@ -1,5 +1,6 @@
 #include "emit.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,12 @@
 #include "hashmap.h"
 #include "error.h"
 #include "expression.h"
+#include "ir.h"
+#include "opt.h"
+#include "eval.h"
+#include "mem.h"
+#include "perf.h"
+#include "trace.h"
 
 struct string_buffer {
   size_t cap, len;
@@ -15,10 +22,10 @@ struct string_buffer {
 };
 
 struct string_buffer *string_buffer_new() {
-  struct string_buffer *buf = malloc(sizeof(struct string_buffer));
+  struct string_buffer *buf = mem_malloc(MEM_STRING_BUFFER, sizeof(struct string_buffer));
   buf->len = 0;
   buf->cap = 16;
-  buf->buf = malloc(16);
+  buf->buf = mem_malloc(MEM_STRING_BUFFER, 16);
   buf->buf[0] = 0;
 
   return buf;
@@ -26,9 +33,20 @@ struct string_buffer *string_buffer_new() {
 
 void string_buffer_free(struct string_buffer *buf) {
   if (buf->buf != NULL)
-    free(buf->buf);
+    mem_free(MEM_STRING_BUFFER, buf->buf);
   
-  free(buf);
+  mem_free(MEM_STRING_BUFFER, buf);
+}
+
+void string_buffer_clear(struct string_buffer *buf) {
+  buf->len = 0;
+  buf->buf[0] = 0;
+}
+
+const char *string_buffer_chars(struct string_buffer *buf, size_t *len) {
+  *len = buf->len;
+
+  return buf->buf;
 }
 
 void string_buffer_dump_to_file(struct string_buffer *buf, FILE *fptr) {
@@ -43,7 +61,7 @@ void string_buffer_dump_to_sb(struct string_buffer *src, struct string_buffer *d
     while (src->len + dest->len + 1 >= dest->cap)
       dest->cap *= 2;
 
-    dest->buf = realloc(dest->buf, dest->cap);
+    dest->buf = mem_realloc(MEM_STRING_BUFFER, dest->buf, dest->cap);
   }
 
   memcpy(&dest->buf[dest->len], src->buf, src->len + 1);
@@ -70,7 +88,7 @@ void vsb_printf(struct string_buffer *buf, const char *fmt,  va_list vargs) {
      while (buf->len + required_len + 1 >= buf->cap)
        buf->cap *= 2;
 
-     buf->buf = realloc(buf->buf, buf->cap);
+     buf->buf = mem_realloc(MEM_STRING_BUFFER, buf->buf, buf->cap);
   }
 
   vsprintf(&buf->buf[buf->len], fmt, vargs2);
@@ -105,9 +123,10 @@ int variable_compare(const struct variable *a, const struct variable *b, void *u
 }
 
 struct scope *scope_new(struct scope *parent) {
-  struct scope *scope = malloc(sizeof(struct scope));
+  struct scope *scope = mem_malloc(MEM_EMIT, sizeof(struct scope));
   scope->parent = parent;
-  scope->members = hashmap_new(sizeof(struct variable), 16, 0, 0,
+  scope->members = hashmap_new_with_allocator(mem_hashmap_malloc, mem_hashmap_realloc,
+    mem_hashmap_free, sizeof(struct variable), 16, 0, 0,
     (uint64_t(*)(const void *, uint64_t, uint64_t))variable_hash,
     (int(*)(const void *, const void *, void *))variable_compare,
     NULL, NULL);
@@ -117,11 +136,36 @@ struct scope *scope_new(struct scope *parent) {
 
 void scope_free(struct scope *scope) {
   hashmap_free(scope->members);
-  free(scope);
+  mem_free(MEM_EMIT, scope);
 }
 
 struct variable *scope_set(struct scope *scope, struct variable *v) {
-  return (struct variable *)hashmap_set(scope->members, (void *)v);
+  struct perf_sample start;
+  struct variable *var;
+
+  if (!perf_active())
+    return (struct variable *)hashmap_set(scope->members, (void *)v);
+
+  perf_read(&start);
+  var = (struct variable *)hashmap_set(scope->members, (void *)v);
+  trace_count(TRACE_SCOPE, &start);
+
+  return var;
+}
+
+/* Looks `v` up in `scope` alone. */
+static struct variable *scope_lookup(struct scope *scope, struct variable *v) {
+  struct perf_sample start;
+  struct variable *var;
+
+  if (!perf_active())
+    return (struct variable *)hashmap_get(scope->members, v);
+
+  perf_read(&start);
+  var = (struct variable *)hashmap_get(scope->members, v);
+  trace_count(TRACE_SCOPE, &start);
+
+  return var;
 }
 
 bool scope_get_immediate_variable(struct scope *scope, struct emit_ctx *ctx, struct ident *ident, struct variable *out) {
@@ -132,30 +176,27 @@ bool scope_get_immediate_variable(struct scope *scope, struct emit_ctx *ctx, str
 
   v.ident = *ident;
 
-  var = (struct variable *)hashmap_get(scope->members, &v);
+  var = scope_lookup(scope, &v);
   if (var == NULL)
     return scope_get_variable(scope->parent, ctx, ident, out);
 
 
+  if ((var->flags & VF_GLOBAL) && (var->flags & VF_VISITING)
+    && var->as.global->type == CONST_PROC)
+  {
+    // Procedures may reference themselves, directly or through another
+    // procedure, only the address is needed and that is already known.
+    *out = *var;
+    return true;
+  }
+
   if ((var->flags & VF_GLOBAL) && !(var->flags & VF_VISITED)) {
     if (var->flags & VF_VISITING)
       // Cycle
       return false;
 
-    struct scope *scope = ctx->scope;
-    ctx->scope = ctx->global;
-
-    var->flags |= VF_VISITING;
-    if (!emit_constant(ctx->out, ctx, var->as.global))
+    if (!emit_global(ctx, var))
       return false;
-
-    ctx->scope = scope;
-
-    var->flags &= ~VF_VISITING;
-    var->flags |= VF_VISITED;
-
-    if (var->as.global->type == CONST_EXPR)
-      var->flags |= VF_LOAD;
   }
 
   *out = *var;
@@ -172,40 +213,103 @@ bool scope_get_variable(struct scope *scope, struct emit_ctx *ctx, struct ident
   return true;
 }
 
-bool emit_ast(struct string_buffer *out, const char *src, struct ast *ast) {
+/* Emits the global `var` refers to, or evaluates it if it is a constant
+ * expression, whose value is then used as an immediate. */
+bool emit_global(struct emit_ctx *ctx, struct variable *var) {
+  struct scope *scope = ctx->scope;
+  struct ast_const *c = var->as.global;
+  const char *src = ctx->src;
+  bool ok;
+
+  ctx->scope = ctx->global;
+  ctx->src = c->src;
+  var->flags |= VF_VISITING;
+
+  if (c->type == CONST_EXPR || c->type == CONST_RUN) {
+    ok = eval_constant(ctx, c, &var->value, &var->type);
+    var->flags |= VF_IMMEDIATE;
+  } else {
+    ok = emit_constant(ctx, c);
+  }
+
+  ctx->scope = scope;
+  ctx->src = src;
+
+  // A global which failed stays VF_VISITING, so it isn't tried again.
+  if (!ok)
+    return false;
+
+  var->flags &= ~VF_VISITING;
+  var->flags |= VF_VISITED;
+
+  return true;
+}
+
+static bool global_is_root(struct ast_const *c) {
+  if (c->ident.len == 4 && strncmp(c->ident.chars, "main", 4) == 0)
+    return true;
+
+  return c->type == CONST_PROC && (c->as.proc.flags & PROC_EXPORT);
+}
+
+bool emit_ast(struct ir_module *module, struct ast *ast, const struct emit_options *options) {
   size_t i;
   struct variable *var, v = { .flags = VF_GLOBAL, };
   struct emit_ctx ctx;
-  ctx.src = src;
+  ctx.src = NULL;
+  ctx.options = options;
   ctx.scope = scope_new(NULL);
   ctx.global = ctx.scope;
-  ctx.out = out;
-  ctx.t = 0;
-  ctx.l = 0;
-  ctx.temp = (struct temporary) {0};
+  ctx.module = module;
+  ctx.proc = NULL;
+  ctx.block = NULL;
+  ctx.body = NULL;
+  ctx.decl = NULL;
+  ctx.param_slots = NULL;
+  ctx.inline_ = NULL;
+  ctx.value = ir_value_none();
+  ctx.type = TYPE_NONE;
 
   for (i = 0; i < ast->consts_len; i++) {
     v.as.global = &ast->consts[i];
     v.ident = ast->consts[i].ident;
+    var = scope_find(ctx.scope, &v.ident);
+
+    // Files can declare the same foreign procedure, anything else has to be
+    // defined once.
+    if (var != NULL && (var->as.global->type != CONST_PROC_DECLARATION
+      || v.as.global->type != CONST_PROC_DECLARATION))
+    {
+      fprint_error(stderr, "'%.*s' is already defined", v.ident.len, v.ident.chars);
+      fprint_error_ctx(stderr, v.as.global->src, 1, 0, v.ident.len, v.ident.chars, "defined again here");
+      fprint_info_ctx(stderr, var->as.global->src, 1, 0, var->ident.len, var->ident.chars, "first defined here");
+      scope_free(ctx.scope);
+
+      return false;
+    }
 
-    scope_set(ctx.scope, &v);
+    if (var == NULL)
+      scope_set(ctx.scope, &v);
   }
 
-  i = 0;
+  // Only the roots are emitted here, everything they reference is emitted
+  // on first use by scope_get_immediate_variable, so globals which are
+  // unreachable from a root are never emitted. Roots are visited in source
+  // order rather than hash order, so the output only depends on the source.
+  for (i = 0; i < ast->consts_len; i++) {
+    var = scope_find(ctx.scope, &ast->consts[i].ident);
+
+    if (var->as.global != &ast->consts[i] || var->flags & VF_VISITED)
+      continue;
 
-  while (hashmap_iter(ctx.scope->members, &i, (void **)&var)) {
-    if (var->flags & VF_VISITED)
+    if (!options->keep_unused && !global_is_root(var->as.global))
       continue;
 
-    var->flags |= VF_VISITING;
-    if (!emit_constant(out, &ctx, var->as.global)) {
+    if (!emit_global(&ctx, var)) {
       scope_free(ctx.scope);
 
       return false;
     }
-
-    var->flags &= ~VF_VISITING;
-    var->flags |= VF_VISITED;
   }
 
   scope_free(ctx.scope);
@@ -213,130 +317,298 @@ bool emit_ast(struct string_buffer *out, const char *src, struct ast *ast) {
   return true;
 }
 
-bool emit_constant(struct string_buffer *out, struct emit_ctx *ctx, struct ast_const *c) {
-  size_t t = ctx->t, l = ctx->l;
-  struct string_buffer *buf = string_buffer_new();
-  ctx->t = 0;
-  ctx->l = 0;
-
+bool emit_constant(struct emit_ctx *ctx, struct ast_const *c) {
   switch (c->type) {
     case CONST_PROC: {
-      if (!emit_proc(buf, ctx, &c->ident, &c->as.proc)) {
-        string_buffer_free(buf);
+      if (!emit_proc(ctx, &c->ident, &c->as.proc))
         return false;
-      }
     } break;
 
     case CONST_PROC_DECLARATION: {
         
     } break;
 
-    case CONST_EXPR: {
-      if (c->as.expr->type != TERM_INT) {
-        fprint_error(stderr, "expressions cannot be assigned to constants");
-        fprint_error_ctx(stderr, ctx->src, 1, 0, c->as.expr->len, c->as.expr->loc, "this expression");
-        fprint_help(stderr, "only literals can be assigned to constants");
-
-        string_buffer_free(buf);
-        return false;
-      }
-
-      if (!emit_integer_constant(buf, ctx, &c->ident, &c->as.expr->as.integer)) {
-        string_buffer_free(buf);
-        return false;
-      }
+    case CONST_EXPR:
+    case CONST_RUN: {
+      // Constant expressions are evaluated by emit_global and inlined as
+      // immediates wherever they are used, so there is nothing to emit
+      // unless something needs their address.
     } break;
 
     case CONST_STRING: {
-      if (!emit_string_constant(buf, ctx, &c->ident, &c->as.string)) {
-        string_buffer_free(buf);
+      if (!emit_string_constant(ctx, &c->ident, &c->as.string))
         return false;
-      }
     } break;
   }
 
-  string_buffer_dump_to_sb(buf, out);
-  string_buffer_free(buf);
+  return true;
+}
+
+bool emit_string_constant(struct emit_ctx *ctx, struct ident *ident, struct string *string) {
+  struct ir_data data = {
+    .ident = *ident,
+    .kind = IR_DATA_STRING,
+    .as.string = *string,
+  };
 
-  ctx->t = t;
-  ctx->l = l;
+  ir_module_add_data(ctx->module, &data);
 
   return true;
 }
 
-bool emit_string_constant(struct string_buffer *out, struct emit_ctx *ctx, struct ident *ident, struct string *string) {
-  sb_printf(out, "data $%.*s = { b \"%.*s\", b 0 }\n", ident->len, ident->chars, string->len, string->chars);
+bool emit_integer_constant(struct emit_ctx *ctx, struct ident *ident, int64_t *i) {
+  struct ir_data data = {
+    .ident = *ident,
+    .kind = IR_DATA_INTEGER,
+    .as.integer = *i,
+  };
+
+  ir_module_add_data(ctx->module, &data);
 
   return true;
 }
 
-bool emit_integer_constant(struct string_buffer *out, struct emit_ctx *ctx, struct ident *ident, int64_t *i) {
-  sb_printf(out, "data $%.*s = { l %li }\n", ident->len, ident->chars, *i);
+void emit_start_block(struct emit_ctx *ctx, struct ir_block *block) {
+  ir_proc_add_block(ctx->proc, block);
+  ctx->block = block;
+}
 
-  return true;
+/* Values are kept in a word or long temporary, and sub-word values are
+ * kept sign or zero extended to a word. */
+static ir_type type_class(ast_type type) {
+  return ast_type_info(type)->size == 8 ? IR_TYPE_L : IR_TYPE_W;
+}
+
+static ir_type type_memory(ast_type type) {
+  const struct ast_type_info *info = ast_type_info(type);
+
+  switch (info->size) {
+    case 1: return info->is_signed ? IR_TYPE_SB : IR_TYPE_UB;
+    case 2: return info->is_signed ? IR_TYPE_SH : IR_TYPE_UH;
+    case 4: return IR_TYPE_W;
+    default: return IR_TYPE_L;
+  }
+}
+
+struct ir_value emit_inst(struct emit_ctx *ctx, ir_op op, ir_type type, struct ir_value lhs, struct ir_value rhs) {
+  struct ir_inst inst = {
+    .op = op,
+    .type = type,
+    .dest = ir_proc_new_temp(ctx->proc),
+    .args = { lhs, rhs },
+  };
+
+  ir_block_push(ctx->block, &inst);
+
+  return ir_value_temp(inst.dest);
+}
+
+struct ir_value emit_compare(struct emit_ctx *ctx, ir_op op, ir_type arg_type, struct ir_value lhs, struct ir_value rhs) {
+  struct ir_inst inst = {
+    .op = op,
+    .type = IR_TYPE_L,
+    .arg_type = arg_type,
+    .dest = ir_proc_new_temp(ctx->proc),
+    .args = { lhs, rhs },
+  };
+
+  ir_block_push(ctx->block, &inst);
+
+  return ir_value_temp(inst.dest);
+}
+
+struct ir_value emit_load(struct emit_ctx *ctx, ast_type type, size_t slot) {
+  struct ir_inst inst = {
+    .op = IR_LOAD,
+    .type = type_class(type),
+    .arg_type = type_memory(type),
+    .dest = ir_proc_new_temp(ctx->proc),
+    .args = { ir_value_temp(slot), ir_value_none() },
+  };
+
+  ir_block_push(ctx->block, &inst);
+
+  return ir_value_temp(inst.dest);
+}
+
+void emit_store(struct emit_ctx *ctx, ast_type type, struct ir_value value, struct ir_value address) {
+  struct ir_inst inst = {
+    .op = IR_STORE,
+    .type = IR_TYPE_NONE,
+    .arg_type = type_memory(type),
+    .args = { value, address },
+  };
+
+  ir_block_push(ctx->block, &inst);
+}
+
+/* Calls through a value, or to a procedure declared as `proc ();`, have no
+ * prototype and return an i64. */
+struct ir_value emit_call(struct emit_ctx *ctx, struct ast_proc *proto, struct ir_value fn,
+  size_t args_len, struct ir_value *args, ir_type *types)
+{
+  struct ir_inst inst = {
+    .op = IR_CALL,
+    .type = proto != NULL ? type_class(proto->ret_type) : IR_TYPE_L,
+    .dest = ir_proc_new_temp(ctx->proc),
+    .args = { fn, ir_value_none() },
+    .call_args_len = args_len,
+    .call_args = args,
+    .call_types = types,
+    .call_variadic = proto != NULL && (proto->flags & PROC_VARIADIC),
+    .call_fixed_len = proto != NULL ? proto->params_len : args_len,
+  };
+
+  // The IR frees the arguments along with the instruction.
+  mem_disown(MEM_EMIT, args);
+  mem_disown(MEM_EMIT, types);
+  ir_block_push(ctx->block, &inst);
+
+  return ir_value_temp(inst.dest);
 }
 
-bool emit_proc(struct string_buffer *out, struct emit_ctx *ctx, struct ident *ident, struct ast_proc *proc) {
-  sb_printf(out, "export function l $%.*s ( ) {\n", ident->len, ident->chars);
-  sb_printf(out, "@start\n");
+size_t emit_alloc(struct emit_ctx *ctx, ast_type type) {
+  struct ir_block *block = ctx->block;
+  size_t slot;
+
+  // Stack slots are allocated up front in the entry block.
+  ctx->block = ctx->proc->blocks[0];
+  slot = emit_inst(ctx, IR_ALLOC, IR_TYPE_L, ir_value_const(ast_type_info(type)->size), ir_value_none()).as.temp;
+  ctx->block = block;
+
+  return slot;
+}
+
+void emit_jump(struct emit_ctx *ctx, ir_jump_kind kind, struct ir_value arg, struct ir_block *target0, struct ir_block *target1) {
+  ctx->block->jump = (struct ir_jump) {
+    .kind = kind,
+    .arg = arg,
+    .targets = { target0, target1 },
+  };
+}
+
+bool emit_proc(struct emit_ctx *ctx, struct ident *ident, struct ast_proc *proc) {
+  struct ir_proc *ir_proc = ctx->proc;
+  struct ir_block *block = ctx->block, *body = ctx->body, *entry;
+  struct ast_proc *decl = ctx->decl;
+  size_t *param_slots = ctx->param_slots;
+  struct emit_inline *inline_ = ctx->inline_;
+  struct trace_mark mark = trace_mark();
+  struct variable v;
+
+  if (proc->flags & PROC_VARIADIC) {
+    fprint_error(stderr, "'%.*s' is variadic but has a body", ident->len, ident->chars);
+    fprint_error_ctx(stderr, ctx->src, 1, 0, ident->len, ident->chars, "this procedure");
+    fprint_help(stderr, "only declarations of foreign procedures can take '..'");
+
+    return false;
+  }
+
+  ctx->proc = ir_module_add_proc(ctx->module, ident, proc->flags);
+  ctx->decl = proc;
+  ctx->param_slots = mem_malloc(MEM_EMIT, sizeof(size_t) * proc->params_len);
+  ctx->inline_ = NULL;
+
+  ctx->proc->ret_type = type_class(proc->ret_type);
+  ctx->proc->params_len = proc->params_len;
+  ctx->proc->params = malloc(sizeof(size_t) * proc->params_len);
+  ctx->proc->param_types = malloc(sizeof(ir_type) * proc->params_len);
+
+  // The entry block only holds the stack slots of locals, and spills the
+  // parameters to theirs.
+  entry = ir_block_new(ctx->proc);
+  ctx->body = ir_block_new(ctx->proc);
+
+  emit_start_block(ctx, entry);
 
   struct scope *scope = scope_new(ctx->scope);
   ctx->scope = scope;
 
+  for (size_t i = 0; i < proc->params_len; i++) {
+    v.ident = proc->params[i].ident;
+    v.flags = VF_LOAD;
+    v.type = proc->params[i].type;
+    v.as.slot = emit_alloc(ctx, v.type);
+
+    scope_set(scope, &v);
+
+    ctx->param_slots[i] = v.as.slot;
+    ctx->proc->params[i] = ir_proc_new_temp(ctx->proc);
+    ctx->proc->param_types[i] = type_class(v.type);
+
+    emit_store(ctx, v.type, ir_value_temp(ctx->proc->params[i]), ir_value_temp(v.as.slot));
+  }
+
+  emit_jump(ctx, IR_JUMP_JMP, ir_value_none(), ctx->body, NULL);
+  emit_start_block(ctx, ctx->body);
+
   for (size_t i = 0; i < proc->stmts_len; i++) {
-    if (!emit_statement(out, ctx, proc->stmts[i]))
+    if (!emit_statement(ctx, proc->stmts[i]))
       return false;
   }
 
+  if (ctx->block->jump.kind == IR_JUMP_NONE)
+    emit_jump(ctx, IR_JUMP_RET, ir_value_none(), NULL, NULL);
+
   ctx->scope = scope->parent;
   scope_free(scope);
 
-  sb_printf(out, "}\n");
+  mem_free(MEM_EMIT, ctx->param_slots);
+
+  ctx->proc = ir_proc;
+  ctx->block = block;
+  ctx->body = body;
+  ctx->decl = decl;
+  ctx->param_slots = param_slots;
+  ctx->inline_ = inline_;
+
+  trace_span(TRACE_PROC, ident->len, ident->chars, mark, 0);
 
   return true;
 }
 
-bool emit_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_stmt *stmt) {
+bool emit_statement(struct emit_ctx *ctx, struct ast_stmt *stmt) {
+  // Statements following a return are unreachable, but still need a block.
+  if (ctx->block->jump.kind != IR_JUMP_NONE)
+    emit_start_block(ctx, ir_block_new(ctx->proc));
+
   switch (stmt->type) {
     case STMT_EXPR: {
-      if (!emit_expression(out, ctx, stmt->as.expr))
+      if (!emit_expression(ctx, stmt->as.expr))
         return false;
     } break;
 
     case STMT_RET: {
-      struct temporary expr;
-        
+      if (ctx->inline_ != NULL)
+        return emit_inline_return(ctx, stmt->as.ret);
+
+      if (ctx->options->tail_calls && emit_is_self_call(ctx, stmt->as.ret))
+        return emit_tail_call(ctx, stmt->as.ret);
+
       if (stmt->as.ret == NULL) {
-        sb_printf(out, "    ret\n");
+        emit_jump(ctx, IR_JUMP_RET, ir_value_none(), NULL, NULL);
 
         return true;
       }
 
-      if (!emit_expression(out, ctx, stmt->as.ret))
+      if (!emit_expression(ctx, stmt->as.ret) || !emit_coerce(ctx, stmt->as.ret, ctx->decl->ret_type))
         return false;
 
-      expr = ctx->temp;
-
-      if (expr.flags & VF_LOAD) {
-        sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, expr.id);
-        expr.id = ctx->t++;
-      }
-
-      sb_printf(out, "    ret %%t_%lu\n", expr.id);
+      emit_jump(ctx, IR_JUMP_RET, ctx->value, NULL, NULL);
     } break;
 
     case STMT_LET: {
-      if (!emit_let_statement(out, ctx, stmt->as.let))
+      if (!emit_let_statement(ctx, stmt->as.let))
         return false;
     } break;
 
     case STMT_ASSIGN: {
-      if (!emit_assign_statement(out, ctx, stmt->as.assign))
+      if (!emit_assign_statement(ctx, stmt->as.assign))
         return false;
     } break;
 
     case STMT_IF: {
-      if (!emit_if_statement(out, ctx, stmt->as.if_))
+      if (!emit_if_statement(ctx, stmt->as.if_))
         return false;
     } break;
   }
@@ -344,76 +616,76 @@ bool emit_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_
   return true;
 }
 
-bool emit_expression(struct string_buffer *out, struct emit_ctx *ctx, struct ast_expr *expr) {
+bool emit_expression(struct emit_ctx *ctx, struct ast_expr *expr) {
   switch (expr->type) {
     case TERM_INT: {
-      sb_printf(out, "    %%t_%lu =l copy %li\n", ctx->t, expr->as.integer);
-
-      ctx->temp.flags &= ~VF_LOAD;
-      ctx->temp.id = ctx->t++;
+      ctx->value = ir_value_const(expr->as.integer);
+      ctx->type = TYPE_UNTYPED_INT;
     } break;
 
     case TERM_IDENT: {
       struct variable v;
+
       if (!scope_get_variable(ctx->scope, ctx, &expr->as.ident, &v))
         // variable not found
         return false;
 
-      char scope = (v.flags & VF_GLOBAL) ? '$' : '%';
-
-      // if (v.flags & VF_LOAD)
-      //   sb_printf(out, "    %%t_%lu =l loadl %c%.*s\n", ctx->t++, scope, v.ident.len, v.ident.chars);
-      // else
-      //   sb_printf(out, "    %%t_%lu =l copy %c%.*s\n", ctx->t++, scope, v.ident.len, v.ident.chars);
-
-      sb_printf(out, "    %%t_%lu =l copy %c%.*s\n", ctx->t, scope, v.ident.len, v.ident.chars);
-
-      ctx->temp.flags &= ~VF_LOAD;
-      ctx->temp.flags |= v.flags & VF_LOAD;
-      ctx->temp.id = ctx->t++;
+      if (v.flags & VF_IMMEDIATE) {
+        ctx->value = ir_value_const(v.value);
+        ctx->type = v.type;
+      } else if (v.flags & VF_LOAD) {
+        ctx->value = emit_load(ctx, v.type, v.as.slot);
+        ctx->type = v.type;
+      } else {
+        ctx->value = emit_inst(ctx, IR_COPY, IR_TYPE_L, ir_value_global(v.ident), ir_value_none());
+        ctx->type = TYPE_I64;
+      }
     } break;
       
     case TERM_FN_CALL: {
-      struct string_buffer *buf = string_buffer_new();
-      struct temporary fn, arg;
+      struct ast_fn_call *fn_call = expr->as.fn_call;
+      struct ir_value fn, *args;
+      ir_type *types;
+      ast_type type;
+      struct ast_const *callee;
+      struct ast_proc *proto;
+
+      // Calling a type converts the argument to it, i32(x).
+      if (fn_call->fn->type == TERM_IDENT && ast_type_from_ident(&fn_call->fn->as.ident, &type)) {
+        if (!emit_conversion(ctx, expr, type))
+          return false;
 
-      if (!emit_expression(out, ctx, expr->as.fn_call->fn))
-        return false;
+        break;
+      }
 
-      fn = ctx->temp;
+      callee = emit_inline_candidate(ctx, fn_call);
 
-      if (fn.flags & VF_LOAD) {
-        sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, fn.id);
-        fn.id = ctx->t++;
+      if (ctx->options->tail_calls && ctx->options->report && emit_is_self_call(ctx, expr)) {
+        fprint_note(stderr, "%.*s: the recursive call on line %zu is not a tail call",
+          (int)ctx->proc->ident.len, ctx->proc->ident.chars, get_linenum(ctx->src, expr->loc) + 1);
       }
 
-      for (size_t i = 0; i < expr->as.fn_call->args_len; i++) {
-        if (!emit_expression(out, ctx, expr->as.fn_call->args[i]))
+      if (callee != NULL) {
+        if (!emit_inline_call(ctx, expr, callee))
           return false;
 
-        arg = ctx->temp;
-
-        if (arg.flags & VF_LOAD) {
-          sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, arg.id);
-          arg.id = ctx->t++;
-        }
-
-        sb_printf(buf, "l %%t_%lu, ", arg.id);
+        break;
       }
 
-      sb_printf(out, "    %%t_%lu =l call %%t_%lu ( ", ctx->t, fn.id);
+      if (!emit_callee(ctx, fn_call->fn, &proto))
+        return false;
 
-      string_buffer_dump_to_sb(buf, out);
-      string_buffer_free(buf);
+      fn = ctx->value;
 
-      sb_printf(out, ")\n");
+      if (!emit_call_args(ctx, expr, proto, &args, &types))
+        return false;
 
-      ctx->temp.flags &= ~VF_LOAD;
-      ctx->temp.id = ctx->t++;
+      ctx->value = emit_call(ctx, proto, fn, fn_call->args_len, args, types);
+      ctx->type = proto != NULL ? proto->ret_type : TYPE_I64;
     } break;
 
     case EXPR_OPERATION: {
-      if (!emit_operation(out, ctx, &expr->as.op))
+      if (!emit_operation(ctx, expr))
         return false;
     } break;
   }
@@ -421,157 +693,621 @@ bool emit_expression(struct string_buffer *out, struct emit_ctx *ctx, struct ast
   return true;
 }
 
-static const char *qbe_operations[] = {
-  [OP_EQ] = "ceql", [OP_NEQ] = "cnel",
-  [OP_GT] = "csgtl", [OP_LT] = "csltl", [OP_GTE] = "csgel", [OP_LTE] = "cslel",
-  [OP_BOR] = "or", [OP_BXOR] = "xor", [OP_BAND] = "and",
-  [OP_SHL] = "shl", [OP_SHR] = "shr",
-  [OP_ADD] = "add", [OP_SUB] = "sub",
-  [OP_MUL] = "mul", [OP_DIV] = "div", [OP_MOD] = "rem",
-  [OP_NEG] = "neg",
-};
+static size_t expr_cost(struct ast_expr *expr) {
+  size_t cost = 1;
 
-bool emit_operation(struct string_buffer *out, struct emit_ctx *ctx, struct ast_operation *op) {
-  struct temporary lhs, rhs;
-  if (operator_is_unary(op->op)) {
-    if (!emit_expression(out, ctx, op->lhs))
-      return false;
+  switch (expr->type) {
+    case TERM_INT:
+    case TERM_IDENT:
+      break;
+
+    case TERM_FN_CALL: {
+      // A call that stays a call costs about as much as the sequence around it.
+      cost += 2 + expr_cost(expr->as.fn_call->fn);
 
-    lhs = ctx->temp;
+      for (size_t i = 0; i < expr->as.fn_call->args_len; i++)
+        cost += expr_cost(expr->as.fn_call->args[i]);
+    } break;
+
+    case EXPR_OPERATION: {
+      cost += expr_cost(expr->as.op.lhs);
+
+      if (expr->as.op.rhs != NULL)
+        cost += expr_cost(expr->as.op.rhs);
+    } break;
+  }
+
+  return cost;
+}
+
+static size_t stmts_cost(size_t stmts_len, struct ast_stmt **stmts) {
+  size_t cost = 0;
+  struct ast_stmt *stmt;
+  struct ast_if *if_;
+
+  for (size_t i = 0; i < stmts_len; i++) {
+    stmt = stmts[i];
+    cost++;
+
+    switch (stmt->type) {
+      case STMT_EXPR:
+      case STMT_RET: {
+        if (stmt->as.expr != NULL)
+          cost += expr_cost(stmt->as.expr);
+      } break;
+
+      case STMT_LET:
+      case STMT_ASSIGN: {
+        cost += expr_cost(stmt->as.assign->expr);
+      } break;
+
+      case STMT_IF: {
+        if_ = stmt->as.if_;
+
+        for (size_t j = 0; j < if_->branches_len; j++) {
+          cost += expr_cost(if_->branches[j].cond);
+          cost += stmts_cost(if_->branches[j].stmts_len, if_->branches[j].stmts);
+        }
 
-    if (lhs.flags & VF_LOAD) {
-      sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, lhs.id);
-      lhs.id = ctx->t++;
+        cost += stmts_cost(if_->else_stmts_len, if_->else_stmts);
+      } break;
     }
-    
-    sb_printf(out, "    %%t_%lu =l %s %%t_%lu\n", ctx->t++, qbe_operations[op->op], lhs.id);
+  }
+
+  return cost;
+}
+
+struct variable *scope_find(struct scope *scope, struct ident *ident) {
+  struct variable *var, v = { .ident = *ident };
+
+  for (; scope != NULL; scope = scope->parent) {
+    var = scope_lookup(scope, &v);
+
+    if (var != NULL)
+      return var;
+  }
+
+  return NULL;
+}
+
+/* Returns the procedure `fn_call` calls if its body should be inlined at the
+ * call site. The lookup doesn't emit the callee, so a procedure which is
+ * inlined everywhere is never emitted on its own. */
+struct ast_const *emit_inline_candidate(struct emit_ctx *ctx, struct ast_fn_call *fn_call) {
+  struct variable *var;
+  struct ast_const *c;
+  struct ast_proc *proc;
+
+  if (fn_call->fn->type != TERM_IDENT)
+    return NULL;
+
+  var = scope_find(ctx->scope, &fn_call->fn->as.ident);
+
+  if (var == NULL || !(var->flags & VF_GLOBAL) || var->as.global->type != CONST_PROC)
+    return NULL;
+
+  c = var->as.global;
+  proc = &c->as.proc;
+
+  // Calls with the wrong number of arguments are reported by the regular
+  // call path.
+  if (fn_call->args_len != proc->params_len)
+    return NULL;
+
+  // Recursive calls are never inlined, whether the recursion goes through
+  // procedures being emitted or through procedures being inlined.
+  if (var->flags & VF_VISITING)
+    return NULL;
+
+  for (struct emit_inline *frame = ctx->inline_; frame != NULL; frame = frame->parent) {
+    if (frame->callee == c)
+      return NULL;
+  }
+
+  if (proc->flags & PROC_NO_INLINE)
+    return NULL;
+
+  if (!(proc->flags & PROC_FORCE_INLINE)
+    && stmts_cost(proc->stmts_len, proc->stmts) > ctx->options->inline_threshold)
+  {
+    return NULL;
+  }
+
+  return c;
+}
+
+/* Emits the body of `callee` in place of a call to it. Its parameters and
+ * locals get fresh stack slots in a scope of their own, and its returns store
+ * the result in a slot and jump to the block following the call. */
+bool emit_inline_call(struct emit_ctx *ctx, struct ast_expr *expr, struct ast_const *callee) {
+  struct scope *scope = ctx->scope;
+  const char *src = ctx->src;
+  struct ast_proc *proc = &callee->as.proc;
+  struct ir_value *args;
+  ir_type *types;
+  struct variable v;
+  struct emit_inline frame = {
+    .callee = callee,
+    .slot = emit_alloc(ctx, proc->ret_type),
+    .cont = ir_block_new(ctx->proc),
+    .parent = ctx->inline_,
+  };
+
+  // The arguments are evaluated in the caller's scope.
+  if (!emit_call_args(ctx, expr, proc, &args, &types))
+    return false;
+
+  ctx->inline_ = &frame;
+  ctx->scope = scope_new(ctx->global);
+  ctx->src = callee->src;
+
+  for (size_t i = 0; i < proc->params_len; i++) {
+    v.ident = proc->params[i].ident;
+    v.flags = VF_LOAD;
+    v.type = proc->params[i].type;
+    v.as.slot = emit_alloc(ctx, v.type);
+
+    scope_set(ctx->scope, &v);
+    emit_store(ctx, v.type, args[i], ir_value_temp(v.as.slot));
+  }
+
+  mem_free(MEM_EMIT, args);
+  mem_free(MEM_EMIT, types);
+
+  for (size_t i = 0; i < proc->stmts_len; i++) {
+    if (!emit_statement(ctx, proc->stmts[i]))
+      return false;
+  }
+
+  if (ctx->block->jump.kind == IR_JUMP_NONE && !emit_inline_return(ctx, NULL))
+    return false;
+
+  scope_free(ctx->scope);
+  ctx->scope = scope;
+  ctx->src = src;
+  ctx->inline_ = frame.parent;
+
+  emit_start_block(ctx, frame.cont);
+  ctx->value = emit_load(ctx, proc->ret_type, frame.slot);
+  ctx->type = proc->ret_type;
+
+  return true;
+}
+
+bool emit_inline_return(struct emit_ctx *ctx, struct ast_expr *ret) {
+  ast_type type = ctx->inline_->callee->as.proc.ret_type;
+
+  ctx->value = ir_value_const(0);
+
+  if (ret != NULL && (!emit_expression(ctx, ret) || !emit_coerce(ctx, ret, type)))
+    return false;
+
+  emit_store(ctx, type, ctx->value, ir_value_temp(ctx->inline_->slot));
+  emit_jump(ctx, IR_JUMP_JMP, ir_value_none(), ctx->inline_->cont, NULL);
+
+  return true;
+}
+
+/* Whether `expr` is a call of the procedure being emitted, by name. */
+bool emit_is_self_call(struct emit_ctx *ctx, struct ast_expr *expr) {
+  struct variable *var;
+  struct ident *ident;
+
+  if (expr == NULL || expr->type != TERM_FN_CALL || expr->as.fn_call->fn->type != TERM_IDENT)
+    return false;
+
+  ident = &expr->as.fn_call->fn->as.ident;
+  var = scope_find(ctx->scope, ident);
+
+  return var != NULL && (var->flags & VF_GLOBAL) && var->as.global->type == CONST_PROC
+    && ident->len == ctx->proc->ident.len
+    && strncmp(ident->chars, ctx->proc->ident.chars, ident->len) == 0;
+}
+
+/* Lowers `return f(...)` inside f to a jump back to the start of its body,
+ * so self recursion runs in constant stack space. Every argument is
+ * evaluated before any parameter is overwritten, as they may refer to them. */
+bool emit_tail_call(struct emit_ctx *ctx, struct ast_expr *expr) {
+  struct ir_value *args;
+  ir_type *types;
+
+  if (!emit_call_args(ctx, expr, ctx->decl, &args, &types))
+    return false;
+
+  for (size_t i = 0; i < ctx->decl->params_len; i++)
+    emit_store(ctx, ctx->decl->params[i].type, args[i], ir_value_temp(ctx->param_slots[i]));
+
+  mem_free(MEM_EMIT, args);
+  mem_free(MEM_EMIT, types);
+
+  emit_jump(ctx, IR_JUMP_JMP, ir_value_none(), ctx->body, NULL);
+
+  return true;
+}
+
+/* Calls to a procedure known at compile time are emitted as direct calls,
+ * only computed callees go through a temporary. `proto` is set to the
+ * procedure called, if it is known and has a checked signature. */
+bool emit_callee(struct emit_ctx *ctx, struct ast_expr *fn, struct ast_proc **proto) {
+  struct variable v;
+
+  *proto = NULL;
+
+  if (fn->type != TERM_IDENT)
+    return emit_expression(ctx, fn);
+
+  if (!scope_get_variable(ctx->scope, ctx, &fn->as.ident, &v))
+    return false;
+
+  if ((v.flags & VF_GLOBAL) && (v.as.global->type == CONST_PROC
+    || v.as.global->type == CONST_PROC_DECLARATION))
+  {
+    ctx->value = ir_value_global(v.ident);
+    ctx->type = TYPE_I64;
+
+    if (!(v.as.global->as.proc.flags & PROC_UNCHECKED))
+      *proto = &v.as.global->as.proc;
+
+    return true;
+  }
+
+  return emit_expression(ctx, fn);
+}
+
+/* Evaluates the arguments of the call `expr`, converting each to the type of
+ * its parameter. Without a prototype, and past the parameters of a variadic
+ * procedure, untyped constants are passed as i64. */
+bool emit_call_args(struct emit_ctx *ctx, struct ast_expr *expr, struct ast_proc *proto,
+  struct ir_value **args, ir_type **types)
+{
+  struct ast_fn_call *fn_call = expr->as.fn_call;
+  ast_type type;
+
+  if (proto != NULL && (fn_call->args_len < proto->params_len
+    || (fn_call->args_len > proto->params_len && !(proto->flags & PROC_VARIADIC))))
+  {
+    fprint_error(stderr, "expected %s%zu argument%s, got %zu",
+      proto->flags & PROC_VARIADIC ? "at least " : "", proto->params_len,
+      proto->params_len == 1 ? "" : "s", fn_call->args_len);
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this call");
+
+    return false;
+  }
+
+  *args = mem_malloc(MEM_EMIT, sizeof(struct ir_value) * fn_call->args_len);
+  *types = mem_malloc(MEM_EMIT, sizeof(ir_type) * fn_call->args_len);
+
+  for (size_t i = 0; i < fn_call->args_len; i++) {
+    if (!emit_expression(ctx, fn_call->args[i]))
+      goto fail;
+
+    if (proto != NULL && i < proto->params_len)
+      type = proto->params[i].type;
+    else
+      type = ctx->type == TYPE_UNTYPED_INT ? TYPE_I64 : ctx->type;
+
+    if (!emit_coerce(ctx, fn_call->args[i], type))
+      goto fail;
+
+    (*args)[i] = ctx->value;
+    (*types)[i] = type_class(ctx->type);
+  }
+
+  return true;
+
+fail:
+  mem_free(MEM_EMIT, *args);
+  mem_free(MEM_EMIT, *types);
+
+  return false;
+}
+
+static const ir_op ir_operations[] = {
+  [OP_EQ] = IR_CEQ, [OP_NEQ] = IR_CNE,
+  [OP_GT] = IR_CSGT, [OP_LT] = IR_CSLT, [OP_GTE] = IR_CSGE, [OP_LTE] = IR_CSLE,
+  [OP_BOR] = IR_OR, [OP_BXOR] = IR_XOR, [OP_BAND] = IR_AND,
+  [OP_SHL] = IR_SHL, [OP_SHR] = IR_SAR,
+  [OP_ADD] = IR_ADD, [OP_SUB] = IR_SUB,
+  [OP_MUL] = IR_MUL, [OP_DIV] = IR_DIV, [OP_MOD] = IR_REM,
+  [OP_NEG] = IR_NEG,
+};
+
+static const ir_op ir_unsigned_operations[] = {
+  [OP_EQ] = IR_CEQ, [OP_NEQ] = IR_CNE,
+  [OP_GT] = IR_CUGT, [OP_LT] = IR_CULT, [OP_GTE] = IR_CUGE, [OP_LTE] = IR_CULE,
+  [OP_BOR] = IR_OR, [OP_BXOR] = IR_XOR, [OP_BAND] = IR_AND,
+  [OP_SHL] = IR_SHL, [OP_SHR] = IR_SHR,
+  [OP_ADD] = IR_ADD, [OP_SUB] = IR_SUB,
+  [OP_MUL] = IR_MUL, [OP_DIV] = IR_UDIV, [OP_MOD] = IR_UREM,
+  [OP_NEG] = IR_NEG,
+};
+
+/* The IR operation of `op` on operands of `type`. */
+ir_op emit_ir_op(expr_op op, ast_type type) {
+  return ast_type_info(type)->is_signed ? ir_operations[op] : ir_unsigned_operations[op];
+}
+
+/* Sub-word results are extended again, as the operation may have carried
+ * into the upper bits of the word. */
+static void emit_normalize(struct emit_ctx *ctx, ast_type type) {
+  const struct ast_type_info *info = ast_type_info(type);
+  ir_op op;
 
+  if (info->size >= 4)
+    return;
+
+  if (info->size == 1)
+    op = info->is_signed ? IR_EXTSB : IR_EXTUB;
+  else
+    op = info->is_signed ? IR_EXTSH : IR_EXTUH;
+
+  ctx->value = emit_inst(ctx, op, IR_TYPE_W, ctx->value, ir_value_none());
+}
+
+/* Checks that the value of `expr` can be used as a `type`. Untyped integer
+ * constants take on the type, if they fit in it. */
+bool emit_coerce(struct emit_ctx *ctx, struct ast_expr *expr, ast_type type) {
+  if (ctx->type == type)
     return true;
+
+  if (ctx->type != TYPE_UNTYPED_INT) {
+    fprint_error(stderr, "expected %s, got %s", ast_type_tostring(type), ast_type_tostring(ctx->type));
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this expression");
+    fprint_help(stderr, "convert it with %s(...)", ast_type_tostring(type));
+
+    return false;
   }
 
+  if (!ast_type_fits(type, ctx->value.as.integer)) {
+    fprint_error(stderr, "%li does not fit in %s", ctx->value.as.integer, ast_type_tostring(type));
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this expression");
 
-  if (!emit_expression(out, ctx, op->lhs))
     return false;
+  }
+
+  ctx->type = type;
 
-  lhs = ctx->temp;
+  return true;
+}
 
-  if (lhs.flags & VF_LOAD) {
-    sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, lhs.id);
-    lhs.id = ctx->t++;
+/* Lowers `type(x)`, which converts x by truncating or extending it. */
+bool emit_conversion(struct emit_ctx *ctx, struct ast_expr *expr, ast_type type) {
+  struct ast_fn_call *fn_call = expr->as.fn_call;
+  const struct ast_type_info *from, *to = ast_type_info(type);
+
+  if (fn_call->args_len != 1) {
+    fprint_error(stderr, "conversions take exactly one argument, got %zu", fn_call->args_len);
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this conversion");
+
+    return false;
   }
 
-  if (!emit_expression(out, ctx, op->rhs))
+  if (!emit_expression(ctx, fn_call->args[0]))
     return false;
 
-  rhs = ctx->temp;
+  if (ctx->type == TYPE_UNTYPED_INT)
+    return emit_coerce(ctx, fn_call->args[0], type);
 
-  if (rhs.flags & VF_LOAD) {
-    sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, rhs.id);
-    rhs.id = ctx->t++;
+  from = ast_type_info(ctx->type);
+
+  if (to->size == 8 && from->size < 8) {
+    ctx->value = emit_inst(ctx, from->is_signed ? IR_EXTSW : IR_EXTUW, IR_TYPE_L, ctx->value, ir_value_none());
+  } else if (to->size == 4 && from->size == 8) {
+    // Longs can be used as words, which only sees their lower half.
+    ctx->value = emit_inst(ctx, IR_COPY, IR_TYPE_W, ctx->value, ir_value_none());
+  } else if (to->size < 4) {
+    emit_normalize(ctx, type);
   }
 
-  sb_printf(out, "    %%t_%lu =l %s %%t_%lu, %%t_%lu\n", ctx->t, qbe_operations[op->op], lhs.id, rhs.id);
+  ctx->type = type;
 
-  ctx->temp.id = ctx->t++;
-  ctx->temp.flags &= ~VF_LOAD;
-  
   return true;
 }
 
-bool emit_let_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_assign *let) {
+bool emit_operation(struct emit_ctx *ctx, struct ast_expr *expr) {
+  struct ast_operation *op = &expr->as.op;
+  struct ir_value lhs, rhs;
+  ast_type lhs_type, type;
+  int64_t result;
+  ir_op ir_op;
+
+  if (!emit_expression(ctx, op->lhs))
+    return false;
+
+  lhs = ctx->value;
+  lhs_type = ctx->type;
+
+  if (operator_is_unary(op->op)) {
+    if (lhs_type == TYPE_UNTYPED_INT) {
+      opt_fold_operation(IR_NEG, IR_TYPE_L, IR_TYPE_NONE, lhs.as.integer, 0, &result);
+      ctx->value = ir_value_const(result);
+
+      return true;
+    }
+
+    ctx->value = emit_inst(ctx, ir_operations[op->op], type_class(lhs_type), lhs, ir_value_none());
+    emit_normalize(ctx, lhs_type);
+
+    return true;
+  }
+
+  if (!emit_expression(ctx, op->rhs))
+    return false;
+
+  rhs = ctx->value;
+
+  // Operations on untyped constants are evaluated right away, so that the
+  // result is still an untyped constant.
+  if (lhs_type == TYPE_UNTYPED_INT && ctx->type == TYPE_UNTYPED_INT) {
+    if (!opt_fold_operation(ir_operations[op->op], IR_TYPE_L, IR_TYPE_L,
+      lhs.as.integer, rhs.as.integer, &result))
+    {
+      fprint_error(stderr, "division by zero in a constant expression");
+      fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this expression");
+
+      return false;
+    }
+
+    ctx->value = ir_value_const(result);
+
+    return true;
+  }
+
+  if (lhs_type == TYPE_UNTYPED_INT) {
+    type = ctx->type;
+    ctx->value = lhs;
+    ctx->type = lhs_type;
+
+    if (!emit_coerce(ctx, op->lhs, type))
+      return false;
+  } else if (ctx->type == TYPE_UNTYPED_INT) {
+    type = lhs_type;
+
+    if (!emit_coerce(ctx, op->rhs, type))
+      return false;
+  } else if (lhs_type != ctx->type) {
+    fprint_error(stderr, "mismatched types %s and %s", ast_type_tostring(lhs_type), ast_type_tostring(ctx->type));
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this expression");
+    fprint_help(stderr, "convert one side with %s(...)", ast_type_tostring(lhs_type));
+
+    return false;
+  } else {
+    type = lhs_type;
+  }
+
+  ir_op = emit_ir_op(op->op, type);
+
+  if (ir_op_is_comparison(ir_op)) {
+    ctx->value = emit_compare(ctx, ir_op, type_class(type), lhs, rhs);
+    ctx->type = TYPE_I64;
+
+    return true;
+  }
+
+  ctx->value = emit_inst(ctx, ir_op, type_class(type), lhs, rhs);
+  ctx->type = type;
+  emit_normalize(ctx, type);
+
+  return true;
+}
+
+bool emit_let_statement(struct emit_ctx *ctx, struct ast_assign *let) {
   struct variable v;
+
   if (scope_get_immediate_variable(ctx->scope, ctx, &let->ident, &v))
     // Redefinition
     return false;
   
-  if (!emit_expression(out, ctx, let->expr))
+  if (!emit_expression(ctx, let->expr))
+    return false;
+
+  // Without a type, the variable takes the type of its value.
+  if (let->type != TYPE_NONE && !emit_coerce(ctx, let->expr, let->type))
     return false;
 
+  if (ctx->type == TYPE_UNTYPED_INT)
+    ctx->type = TYPE_I64;
+
   v.ident = let->ident;
   v.flags = VF_LOAD;
+  v.type = ctx->type;
+  v.as.slot = emit_alloc(ctx, v.type);
 
   scope_set(ctx->scope, &v);
 
-  sb_printf(out, "    %%%.*s =l alloc8 8\n", let->ident.len, let->ident.chars);
-  sb_printf(out, "    storel %%t_%lu, %%%.*s\n", ctx->temp.id, let->ident.len, let->ident.chars);
+  emit_store(ctx, v.type, ctx->value, ir_value_temp(v.as.slot));
   
   return true;
 }
 
-bool emit_assign_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_assign *let) {
+bool emit_assign_statement(struct emit_ctx *ctx, struct ast_assign *let) {
   struct variable v;
-  if (!scope_get_immediate_variable(ctx->scope, ctx, &let->ident, &v))
+
+  if (!scope_get_variable(ctx->scope, ctx, &let->ident, &v))
     // Not defined
     return false;
-  
-  if (!emit_expression(out, ctx, let->expr))
-    return false;
 
-  v.ident = let->ident;
-  v.flags = VF_LOAD;
+  if (!(v.flags & VF_LOAD)) {
+    fprint_error(stderr, "cannot assign to the constant '%.*s'", let->ident.len, let->ident.chars);
+    fprint_help(stderr, "declare a variable with ':=' instead");
 
-  scope_set(ctx->scope, &v);
+    return false;
+  }
+  
+  if (!emit_expression(ctx, let->expr) || !emit_coerce(ctx, let->expr, v.type))
+    return false;
 
-  sb_printf(out, "    storel %%t_%lu, %%%.*s\n", ctx->t - 1, let->ident.len, let->ident.chars);
+  emit_store(ctx, v.type, ctx->value, ir_value_temp(v.as.slot));
   
   return true;
 }
 
-bool emit_if_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_if *if_) {
-  size_t true_, false_, final;
-  struct temporary temp;
+static bool emit_value_is_comparison(struct emit_ctx *ctx) {
+  struct ir_inst *last;
+
+  if (ctx->value.kind != IR_VALUE_TEMP || ctx->block->insts_len == 0)
+    return false;
+
+  last = &ctx->block->insts[ctx->block->insts_len - 1];
+
+  return last->dest == ctx->value.as.temp && ir_op_is_comparison(last->op);
+}
+
+bool emit_if_statement(struct emit_ctx *ctx, struct ast_if *if_) {
+  struct ir_block *true_, *false_, *final;
   struct ast_if_branch *branch;
 
-  final = ctx->l++;
+  final = ir_block_new(ctx->proc);
 
   for (size_t i = 0; i < if_->branches_len; i++) {
     branch = &if_->branches[i];
 
-    if (!emit_expression(out, ctx, branch->cond))
+    if (!emit_expression(ctx, branch->cond))
       return false;
 
-    temp = ctx->temp;
+    // jnz only tests the lower 32 bits of its argument, so anything but a
+    // comparison is compared against zero first.
+    if (!emit_value_is_comparison(ctx))
+      ctx->value = emit_compare(ctx, IR_CNE, type_class(ctx->type), ctx->value, ir_value_const(0));
 
-    if (temp.flags & VF_LOAD) {
-      sb_printf(out, "    %%t_%lu =l loadl %%t_%lu\n", ctx->t, temp.id);
-      temp.id = ctx->t++;
-    }
-
-    true_ = ctx->l++;
-    false_ = ctx->l++;
+    true_ = ir_block_new(ctx->proc);
+    false_ = ir_block_new(ctx->proc);
 
-    sb_printf(out, "    jnz %%t_%lu, @L_%lu, @L_%lu\n", temp.id, true_, false_);
-    sb_printf(out, "@L_%lu\n", true_);
+    emit_jump(ctx, IR_JUMP_JNZ, ctx->value, true_, false_);
+    emit_start_block(ctx, true_);
 
     struct scope *scope = scope_new(ctx->scope);
     ctx->scope = scope;
 
     for (size_t i = 0; i < branch->stmts_len; i++) {
-      if (!emit_statement(out, ctx, branch->stmts[i]))
+      if (!emit_statement(ctx, branch->stmts[i]))
         return false;
     }
 
     ctx->scope = scope->parent;
     scope_free(scope);
 
-    sb_printf(out, "    jmp @L_%lu\n", final);
-    sb_printf(out, "@L_%lu\n", false_);
+    if (ctx->block->jump.kind == IR_JUMP_NONE)
+      emit_jump(ctx, IR_JUMP_JMP, ir_value_none(), final, NULL);
+
+    emit_start_block(ctx, false_);
   }
 
   struct scope *scope = scope_new(ctx->scope);
   ctx->scope = scope;
 
   for (size_t i = 0; i < if_->else_stmts_len; i++) {
-    if (!emit_statement(out, ctx, if_->else_stmts[i]))
+    if (!emit_statement(ctx, if_->else_stmts[i]))
       return false;
   }
 
   ctx->scope = scope->parent;
   scope_free(scope);
 
-  sb_printf(out, "    jmp @L_%lu\n", final);
-  sb_printf(out, "@L_%lu\n", final);
+  if (ctx->block->jump.kind == IR_JUMP_NONE)
+    emit_jump(ctx, IR_JUMP_JMP, ir_value_none(), final, NULL);
+
+  emit_start_block(ctx, final);
 
   return true;
 }
-
@@ -7,11 +7,14 @@
 
 #include "hashmap.h"
 #include "ast.h"
+#include "ir.h"
 
 struct string_buffer;
 
 struct string_buffer *string_buffer_new();
 void string_buffer_free(struct string_buffer *buf);
+void string_buffer_clear(struct string_buffer *buf);
+const char *string_buffer_chars(struct string_buffer *buf, size_t *len);
 void string_buffer_dump_to_file(struct string_buffer *buf, FILE *fptr);
 void string_buffer_dump_to_sb(struct string_buffer *src, struct string_buffer *dest);
 
@@ -39,23 +42,25 @@ typedef enum {
   VF_VISITING = 1 << 2,
   VF_VISITED = 1 << 3,
   VF_LOAD = 1 << 4,
+  VF_IMMEDIATE = 1 << 5,
 } variable_flags;
 
 union variable_as {
   struct ast_const *global;
+  /* The temporary holding the address of a local's stack slot. */
+  size_t slot;
 };
 
 struct variable {
   variable_flags flags;
   struct ident ident;
+  /* The type of a local, or of an immediate. */
+  ast_type type;
+  /* The value of an immediate. */
+  int64_t value;
   union variable_as as;
 };
 
-struct temporary {
-  variable_flags flags;
-  size_t id;
-};
-
 uint64_t variable_hash(const struct variable *v, uint64_t seed0, uint64_t seed1);
 int variable_compare(const struct variable *a, const struct variable *b, void *udata);
 
@@ -64,13 +69,46 @@ struct scope {
   struct scope *parent;
 };
 
+struct emit_options {
+  /* Emit every global, even those unreachable from main or an #export proc. */
+  bool keep_unused;
+  /* Procedures whose body costs at most this many AST nodes are inlined,
+   * unless they are #no_inline. #force_inline procedures always are. */
+  size_t inline_threshold;
+  /* Turn `return f()` inside f into a jump back to the start of f. */
+  bool tail_calls;
+  /* Note the recursive calls which could not be turned into jumps. */
+  bool report;
+};
+
+/* A call whose callee body is being emitted in place. */
+struct emit_inline {
+  struct ast_const *callee;
+  /* Returns store the result in this stack slot and jump to `cont`. */
+  size_t slot;
+  struct ir_block *cont;
+  struct emit_inline *parent;
+};
+
+/* Lowers the AST into the IR, one procedure or data definition at a time. */
 struct emit_ctx {
   const char *src;
+  const struct emit_options *options;
   struct scope *global;
   struct scope *scope;
-  struct string_buffer *out;
-  struct temporary temp;
-  size_t t, l;
+  struct ir_module *module;
+  struct ir_proc *proc;
+  struct ir_block *block;
+  /* The first block after the stack slots, self tail calls jump here. */
+  struct ir_block *body;
+  /* The procedure being emitted, and the stack slots of its parameters. */
+  struct ast_proc *decl;
+  size_t *param_slots;
+  /* The innermost call being inlined, if any. */
+  struct emit_inline *inline_;
+  /* The value of the last expression emitted, and its type. */
+  struct ir_value value;
+  ast_type type;
 };
 
 struct scope *scope_new(struct scope *parent);
@@ -80,20 +118,45 @@ struct variable *scope_set(struct scope *scope, struct variable *v);
 
 bool scope_get_immediate_variable(struct scope *scope, struct emit_ctx *ctx, struct ident *ident, struct variable *v);
 bool scope_get_variable(struct scope *scope, struct emit_ctx *ctx, struct ident *ident, struct variable *v);
-
-bool emit_ast(struct string_buffer *out, const char *src, struct ast *ast);
-bool emit_constant(struct string_buffer *out, struct emit_ctx *ctx, struct ast_const *c);
-bool emit_proc(struct string_buffer *out, struct emit_ctx *ctx, struct ident *ident, struct ast_proc *proc);
-bool emit_string_constant(struct string_buffer *out, struct emit_ctx *ctx, struct ident *ident, struct string *string);
-bool emit_integer_constant(struct string_buffer *out, struct emit_ctx *ctx, struct ident *ident, int64_t *i);
-
-bool emit_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_stmt *stmt);
-bool emit_expression(struct string_buffer *out, struct emit_ctx *ctx, struct ast_expr *expr);
-bool emit_operation(struct string_buffer *out, struct emit_ctx *ctx, struct ast_operation *op);
-
-bool emit_let_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_assign *let);
-bool emit_assign_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_assign *let);
-
-bool emit_if_statement(struct string_buffer *out, struct emit_ctx *ctx, struct ast_if *if_);
+/* Looks `ident` up without emitting the global it may refer to. */
+struct variable *scope_find(struct scope *scope, struct ident *ident);
+
+void emit_start_block(struct emit_ctx *ctx, struct ir_block *block);
+struct ir_value emit_inst(struct emit_ctx *ctx, ir_op op, ir_type type, struct ir_value lhs, struct ir_value rhs);
+struct ir_value emit_compare(struct emit_ctx *ctx, ir_op op, ir_type arg_type, struct ir_value lhs, struct ir_value rhs);
+/* Returns the temporary holding the address of a new stack slot. */
+size_t emit_alloc(struct emit_ctx *ctx, ast_type type);
+struct ir_value emit_load(struct emit_ctx *ctx, ast_type type, size_t slot);
+void emit_store(struct emit_ctx *ctx, ast_type type, struct ir_value value, struct ir_value address);
+struct ir_value emit_call(struct emit_ctx *ctx, struct ast_proc *proto, struct ir_value fn,
+  size_t args_len, struct ir_value *args, ir_type *types);
+void emit_jump(struct emit_ctx *ctx, ir_jump_kind kind, struct ir_value arg, struct ir_block *target0, struct ir_block *target1);
+
+bool emit_ast(struct ir_module *module, struct ast *ast, const struct emit_options *options);
+bool emit_global(struct emit_ctx *ctx, struct variable *var);
+bool emit_constant(struct emit_ctx *ctx, struct ast_const *c);
+bool emit_proc(struct emit_ctx *ctx, struct ident *ident, struct ast_proc *proc);
+bool emit_string_constant(struct emit_ctx *ctx, struct ident *ident, struct string *string);
+bool emit_integer_constant(struct emit_ctx *ctx, struct ident *ident, int64_t *i);
+
+bool emit_statement(struct emit_ctx *ctx, struct ast_stmt *stmt);
+bool emit_expression(struct emit_ctx *ctx, struct ast_expr *expr);
+bool emit_callee(struct emit_ctx *ctx, struct ast_expr *fn, struct ast_proc **proto);
+bool emit_call_args(struct emit_ctx *ctx, struct ast_expr *expr, struct ast_proc *proto,
+  struct ir_value **args, ir_type **types);
+struct ast_const *emit_inline_candidate(struct emit_ctx *ctx, struct ast_fn_call *fn_call);
+bool emit_inline_call(struct emit_ctx *ctx, struct ast_expr *expr, struct ast_const *callee);
+bool emit_inline_return(struct emit_ctx *ctx, struct ast_expr *ret);
+bool emit_is_self_call(struct emit_ctx *ctx, struct ast_expr *expr);
+bool emit_tail_call(struct emit_ctx *ctx, struct ast_expr *expr);
+bool emit_operation(struct emit_ctx *ctx, struct ast_expr *expr);
+ir_op emit_ir_op(expr_op op, ast_type type);
+bool emit_conversion(struct emit_ctx *ctx, struct ast_expr *expr, ast_type type);
+bool emit_coerce(struct emit_ctx *ctx, struct ast_expr *expr, ast_type type);
+
+bool emit_let_statement(struct emit_ctx *ctx, struct ast_assign *let);
+bool emit_assign_statement(struct emit_ctx *ctx, struct ast_assign *let);
+
+bool emit_if_statement(struct emit_ctx *ctx, struct ast_if *if_);
 
 #endif /* EMIT_H */
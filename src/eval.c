@@ -0,0 +1,462 @@
+#include "eval.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "expression.h"
+#include "ir.h"
+#include "opt.h"
+
+/* Limits on the work done at compile time, so that runaway recursion in a
+ * #run is reported rather than hanging or crashing the compiler. */
+#define EVAL_MAX_DEPTH 1000
+#define EVAL_MAX_STEPS 100000000
+
+struct eval_local {
+  struct ident ident;
+  ast_type type;
+  int64_t value;
+};
+
+/* The locals of a procedure being interpreted. */
+struct eval_frame {
+  struct ast_proc *proc;
+  size_t locals_len, locals_cap;
+  struct eval_local *locals;
+  /* Set by a return, the rest of the procedure is skipped. */
+  bool returned;
+};
+
+/* Values are passed around in ctx->value and ctx->type like in the emitter,
+ * so emit_coerce's checks and messages apply as is. */
+struct eval {
+  struct emit_ctx *ctx;
+  struct ast_const *c;
+  struct eval_frame *frame;
+  size_t depth, steps;
+};
+
+static bool eval_expression(struct eval *ev, struct ast_expr *expr);
+static bool eval_statements(struct eval *ev, size_t stmts_len, struct ast_stmt **stmts);
+
+static void eval_set(struct eval *ev, int64_t value, ast_type type) {
+  ev->ctx->value = ir_value_const(value);
+  ev->ctx->type = type;
+}
+
+static ir_type eval_class(ast_type type) {
+  return ast_type_info(type)->size == 8 ? IR_TYPE_L : IR_TYPE_W;
+}
+
+/* Truncates `value` to the width of `type` and extends it back, which is
+ * what the emitted code keeps in a temporary. */
+static int64_t eval_normalize(ast_type type, int64_t value) {
+  const struct ast_type_info *info = ast_type_info(type);
+  uint64_t mask;
+
+  if (info->size == 8)
+    return value;
+
+  mask = (UINT64_C(1) << (info->size * 8)) - 1;
+
+  if (info->is_signed && (value & (mask ^ (mask >> 1))))
+    return (int64_t)((uint64_t)value | ~mask);
+
+  return (int64_t)((uint64_t)value & mask);
+}
+
+static struct eval_local *eval_find_local(struct eval_frame *frame, struct ident *ident) {
+  // Searched backwards, so that the innermost declaration wins.
+  for (size_t i = frame->locals_len; i > 0; i--) {
+    struct eval_local *local = &frame->locals[i - 1];
+
+    if (local->ident.len == ident->len && strncmp(local->ident.chars, ident->chars, ident->len) == 0)
+      return local;
+  }
+
+  return NULL;
+}
+
+static void eval_push_local(struct eval_frame *frame, struct ident *ident, ast_type type, int64_t value) {
+  if (frame->locals_len >= frame->locals_cap) {
+    frame->locals_cap = frame->locals_cap == 0 ? 8 : frame->locals_cap * 2;
+    frame->locals = realloc(frame->locals, sizeof(struct eval_local) * frame->locals_cap);
+  }
+
+  frame->locals[frame->locals_len++] = (struct eval_local) {
+    .ident = *ident,
+    .type = type,
+    .value = value,
+  };
+}
+
+static bool eval_ident(struct eval *ev, struct ast_expr *expr) {
+  struct ident *ident = &expr->as.ident;
+  struct eval_local *local = eval_find_local(ev->frame, ident);
+  struct variable *var;
+
+  if (local != NULL) {
+    eval_set(ev, local->value, local->type);
+
+    return true;
+  }
+
+  var = scope_find(ev->ctx->global, ident);
+
+  if (var == NULL) {
+    fprint_error(stderr, "unknown identifier '%.*s'", ident->len, ident->chars);
+    fprint_error_ctx(stderr, ev->ctx->src, 1, 0, expr->len, expr->loc, "used here");
+
+    return false;
+  }
+
+  if (var->as.global->type != CONST_EXPR && var->as.global->type != CONST_RUN) {
+    fprint_error(stderr, "'%.*s' has no value at compile time", ident->len, ident->chars);
+    fprint_error_ctx(stderr, ev->ctx->src, 1, 0, expr->len, expr->loc, "used here");
+    fprint_help(stderr, "only integers can be computed at compile time");
+
+    return false;
+  }
+
+  if (var->flags & VF_VISITING) {
+    fprint_error(stderr, "the value of '%.*s' depends on itself", ident->len, ident->chars);
+    fprint_error_ctx(stderr, ev->ctx->src, 1, 0, expr->len, expr->loc, "used here");
+
+    return false;
+  }
+
+  if (!(var->flags & VF_VISITED) && !emit_global(ev->ctx, var))
+    return false;
+
+  eval_set(ev, var->value, var->type);
+
+  return true;
+}
+
+static bool eval_operation(struct eval *ev, struct ast_expr *expr) {
+  struct emit_ctx *ctx = ev->ctx;
+  struct ast_operation *op = &expr->as.op;
+  int64_t lhs, result;
+  ast_type lhs_type, type;
+  ir_op ir_op;
+
+  if (!eval_expression(ev, op->lhs))
+    return false;
+
+  lhs = ctx->value.as.integer;
+  lhs_type = ctx->type;
+
+  if (operator_is_unary(op->op)) {
+    opt_fold_operation(emit_ir_op(op->op, lhs_type), eval_class(lhs_type), IR_TYPE_NONE, lhs, 0, &result);
+    eval_set(ev, eval_normalize(lhs_type, result), lhs_type);
+
+    return true;
+  }
+
+  if (!eval_expression(ev, op->rhs))
+    return false;
+
+  // The same typing rules as emit_operation.
+  if (lhs_type == TYPE_UNTYPED_INT && ctx->type == TYPE_UNTYPED_INT) {
+    type = TYPE_UNTYPED_INT;
+  } else if (lhs_type == TYPE_UNTYPED_INT) {
+    struct ir_value rhs = ctx->value;
+
+    type = ctx->type;
+    eval_set(ev, lhs, lhs_type);
+
+    if (!emit_coerce(ctx, op->lhs, type))
+      return false;
+
+    ctx->value = rhs;
+  } else if (ctx->type == TYPE_UNTYPED_INT) {
+    type = lhs_type;
+
+    if (!emit_coerce(ctx, op->rhs, type))
+      return false;
+  } else if (lhs_type != ctx->type) {
+    fprint_error(stderr, "mismatched types %s and %s", ast_type_tostring(lhs_type), ast_type_tostring(ctx->type));
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this expression");
+    fprint_help(stderr, "convert one side with %s(...)", ast_type_tostring(lhs_type));
+
+    return false;
+  } else {
+    type = lhs_type;
+  }
+
+  ir_op = emit_ir_op(op->op, type);
+
+  if (!opt_fold_operation(ir_op, eval_class(type), eval_class(type), lhs, ctx->value.as.integer, &result)) {
+    fprint_error(stderr, "division by zero in a constant expression");
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this expression");
+
+    return false;
+  }
+
+  if (type == TYPE_UNTYPED_INT)
+    eval_set(ev, result, type);
+  else if (ir_op_is_comparison(ir_op))
+    eval_set(ev, result, TYPE_I64);
+  else
+    eval_set(ev, eval_normalize(type, result), type);
+
+  return true;
+}
+
+static bool eval_conversion(struct eval *ev, struct ast_expr *expr, ast_type type) {
+  struct ast_fn_call *fn_call = expr->as.fn_call;
+
+  if (fn_call->args_len != 1) {
+    fprint_error(stderr, "conversions take exactly one argument, got %zu", fn_call->args_len);
+    fprint_error_ctx(stderr, ev->ctx->src, 1, 0, expr->len, expr->loc, "this conversion");
+
+    return false;
+  }
+
+  if (!eval_expression(ev, fn_call->args[0]))
+    return false;
+
+  if (ev->ctx->type == TYPE_UNTYPED_INT)
+    return emit_coerce(ev->ctx, fn_call->args[0], type);
+
+  eval_set(ev, eval_normalize(type, ev->ctx->value.as.integer), type);
+
+  return true;
+}
+
+static bool eval_call(struct eval *ev, struct ast_expr *expr) {
+  struct emit_ctx *ctx = ev->ctx;
+  struct ast_fn_call *fn_call = expr->as.fn_call;
+  struct eval_frame frame = { .returned = false }, *caller = ev->frame;
+  struct variable *var = NULL;
+  struct ast_proc *proc;
+  const char *src = ctx->src;
+  ast_type type;
+  bool ok;
+
+  if (fn_call->fn->type == TERM_IDENT && ast_type_from_ident(&fn_call->fn->as.ident, &type))
+    return eval_conversion(ev, expr, type);
+
+  if (ev->c->type != CONST_RUN) {
+    fprint_error(stderr, "procedures are only called at compile time by #run");
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this call");
+    fprint_help(stderr, "write '%.*s :: #run ...;'", ev->c->ident.len, ev->c->ident.chars);
+
+    return false;
+  }
+
+  if (fn_call->fn->type == TERM_IDENT)
+    var = scope_find(ctx->global, &fn_call->fn->as.ident);
+
+  if (var == NULL || (var->as.global->type != CONST_PROC && var->as.global->type != CONST_PROC_DECLARATION)) {
+    fprint_error(stderr, "only procedures can be called at compile time");
+    fprint_error_ctx(stderr, ctx->src, 1, 0, fn_call->fn->len, fn_call->fn->loc, "this is not a procedure");
+
+    return false;
+  }
+
+  if (var->as.global->type == CONST_PROC_DECLARATION) {
+    fprint_error(stderr, "'%.*s' has no body to run at compile time", var->ident.len, var->ident.chars);
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this call");
+    fprint_note(stderr, "foreign procedures are only available at run time");
+
+    return false;
+  }
+
+  proc = &var->as.global->as.proc;
+
+  if (fn_call->args_len != proc->params_len) {
+    fprint_error(stderr, "expected %zu argument%s, got %zu", proc->params_len,
+      proc->params_len == 1 ? "" : "s", fn_call->args_len);
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this call");
+
+    return false;
+  }
+
+  if (ev->depth >= EVAL_MAX_DEPTH) {
+    fprint_error(stderr, "calls at compile time are nested more than %d deep", EVAL_MAX_DEPTH);
+    fprint_error_ctx(stderr, ctx->src, 1, 0, expr->len, expr->loc, "this call");
+
+    return false;
+  }
+
+  frame.proc = proc;
+
+  // The arguments are evaluated in the caller's frame.
+  for (size_t i = 0; i < fn_call->args_len; i++) {
+    if (!eval_expression(ev, fn_call->args[i]) || !emit_coerce(ctx, fn_call->args[i], proc->params[i].type)) {
+      free(frame.locals);
+      return false;
+    }
+
+    eval_push_local(&frame, &proc->params[i].ident, ctx->type, ctx->value.as.integer);
+  }
+
+  ev->frame = &frame;
+  ev->depth++;
+  ctx->src = var->as.global->src;
+
+  ok = eval_statements(ev, proc->stmts_len, proc->stmts);
+
+  ctx->src = src;
+  ev->depth--;
+  ev->frame = caller;
+  free(frame.locals);
+
+  // Falling off the end returns zero, like an inlined call does.
+  if (ok && !frame.returned)
+    eval_set(ev, 0, proc->ret_type);
+
+  return ok;
+}
+
+static bool eval_expression(struct eval *ev, struct ast_expr *expr) {
+  switch (expr->type) {
+    case TERM_INT: {
+      eval_set(ev, expr->as.integer, TYPE_UNTYPED_INT);
+    } break;
+
+    case TERM_IDENT: {
+      if (!eval_ident(ev, expr))
+        return false;
+    } break;
+
+    case TERM_FN_CALL: {
+      if (!eval_call(ev, expr))
+        return false;
+    } break;
+
+    case EXPR_OPERATION: {
+      if (!eval_operation(ev, expr))
+        return false;
+    } break;
+  }
+
+  return true;
+}
+
+static bool eval_statement(struct eval *ev, struct ast_stmt *stmt) {
+  struct emit_ctx *ctx = ev->ctx;
+  struct eval_frame *frame = ev->frame;
+  struct ast_assign *assign;
+  struct eval_local *local;
+
+  switch (stmt->type) {
+    case STMT_EXPR: {
+      if (!eval_expression(ev, stmt->as.expr))
+        return false;
+    } break;
+
+    case STMT_RET: {
+      if (stmt->as.ret == NULL)
+        eval_set(ev, 0, frame->proc->ret_type);
+      else if (!eval_expression(ev, stmt->as.ret) || !emit_coerce(ctx, stmt->as.ret, frame->proc->ret_type))
+        return false;
+
+      frame->returned = true;
+    } break;
+
+    case STMT_LET: {
+      assign = stmt->as.let;
+
+      if (eval_find_local(frame, &assign->ident) != NULL) {
+        fprint_error(stderr, "'%.*s' is already defined", assign->ident.len, assign->ident.chars);
+        fprint_error_ctx(stderr, ctx->src, 1, 0, assign->ident.len, assign->ident.chars, "defined again here");
+
+        return false;
+      }
+
+      if (!eval_expression(ev, assign->expr))
+        return false;
+
+      if (assign->type != TYPE_NONE && !emit_coerce(ctx, assign->expr, assign->type))
+        return false;
+
+      if (ctx->type == TYPE_UNTYPED_INT)
+        ctx->type = TYPE_I64;
+
+      eval_push_local(frame, &assign->ident, ctx->type, ctx->value.as.integer);
+    } break;
+
+    case STMT_ASSIGN: {
+      assign = stmt->as.assign;
+      local = eval_find_local(frame, &assign->ident);
+
+      if (local == NULL) {
+        fprint_error(stderr, "cannot assign to '%.*s'", assign->ident.len, assign->ident.chars);
+        fprint_error_ctx(stderr, ctx->src, 1, 0, assign->ident.len, assign->ident.chars, "not a variable");
+        fprint_help(stderr, "declare a variable with ':=' instead");
+
+        return false;
+      }
+
+      if (!eval_expression(ev, assign->expr) || !emit_coerce(ctx, assign->expr, local->type))
+        return false;
+
+      // Evaluating the value may have grown the locals, find it again.
+      local = eval_find_local(frame, &assign->ident);
+      local->value = ctx->value.as.integer;
+    } break;
+
+    case STMT_IF: {
+      struct ast_if *if_ = stmt->as.if_;
+
+      for (size_t i = 0; i < if_->branches_len; i++) {
+        if (!eval_expression(ev, if_->branches[i].cond))
+          return false;
+
+        if (ctx->value.as.integer != 0)
+          return eval_statements(ev, if_->branches[i].stmts_len, if_->branches[i].stmts);
+      }
+
+      return eval_statements(ev, if_->else_stmts_len, if_->else_stmts);
+    } break;
+  }
+
+  return true;
+}
+
+/* Runs a block, whose locals go out of scope at its end. */
+static bool eval_statements(struct eval *ev, size_t stmts_len, struct ast_stmt **stmts) {
+  size_t locals_len = ev->frame->locals_len;
+
+  for (size_t i = 0; i < stmts_len && !ev->frame->returned; i++) {
+    if (++ev->steps > EVAL_MAX_STEPS) {
+      fprint_error(stderr, "evaluating '%.*s' takes more than %d steps", ev->c->ident.len, ev->c->ident.chars, EVAL_MAX_STEPS);
+      fprint_error_ctx(stderr, ev->ctx->src, 1, 0, ev->c->ident.len, ev->c->ident.chars, "this constant");
+
+      return false;
+    }
+
+    if (!eval_statement(ev, stmts[i]))
+      return false;
+  }
+
+  ev->frame->locals_len = locals_len;
+
+  return true;
+}
+
+bool eval_constant(struct emit_ctx *ctx, struct ast_const *c, int64_t *value, ast_type *type) {
+  struct ir_value saved_value = ctx->value;
+  ast_type saved_type = ctx->type;
+  struct eval_frame frame = { .proc = NULL, .returned = false };
+  struct eval ev = {
+    .ctx = ctx,
+    .c = c,
+    .frame = &frame,
+    .depth = 0,
+    .steps = 0,
+  };
+  bool ok = eval_expression(&ev, c->as.expr);
+
+  *value = ctx->value.as.integer;
+  *type = ctx->type;
+
+  ctx->value = saved_value;
+  ctx->type = saved_type;
+  free(frame.locals);
+
+  return ok;
+}
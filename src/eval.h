@@ -0,0 +1,15 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ast.h"
+#include "emit.h"
+
+/* Evaluates a constant expression, or the procedure calls of a #run
+ * constant, by interpreting the AST at compile time. The result has the type
+ * of the expression, which is untyped for plain integer arithmetic. */
+bool eval_constant(struct emit_ctx *ctx, struct ast_const *c, int64_t *value, ast_type *type);
+
+#endif /* EVAL_H */
@@ -7,6 +7,7 @@
 #include "lexer.h"
 #include "ast.h"
 #include "arena.h"
+#include "mem.h"
 
 typedef enum {
   EPS_UNARY,
@@ -61,17 +62,23 @@ bool expression_parser_should_pop(struct expression_ctx *ctx, expr_op op) {
   if (ctx->operator_stack_ptr <= 0)
     return false;
 
-  expr_op stack_top = (expr_op)ctx->operator_stack[ctx->operator_stack_ptr - 1].op;
-  int precedence_diff = operator_precedence(stack_top) - operator_precedence(op);
+  op_marker marker = ctx->operator_stack[ctx->operator_stack_ptr - 1].op;
+
+  // Brackets and calls are only popped by their closing bracket, and have
+  // no precedence.
+  if (marker == MKR_LBRACKET || marker == MKR_FUNCTION)
+    return false;
 
-  // TODO: check for (
+  expr_op stack_top = (expr_op)marker;
+  int precedence_diff = operator_precedence(stack_top) - operator_precedence(op);
 
   return precedence_diff > 0 || precedence_diff == 0 && operator_is_left_associative(op);
 }
 
 void expression_parser_pop_op(struct expression_ctx *ctx) {
   struct operation_item op = ctx->operator_stack[--ctx->operator_stack_ptr];
-  struct ast_expr *lhs, *rhs, *expr = arena_alloc(ctx->arena, sizeof(struct ast_expr));
+  struct ast_expr *lhs, *rhs, *expr = mem_arena_alloc(ctx->arena, MEM_NODE_EXPR,
+    sizeof(struct ast_expr));
 
   expr->type = EXPR_OPERATION;
 
@@ -113,11 +120,13 @@ void expression_parser_push_op(struct expression_ctx *ctx, expr_op op, size_t le
   };
 }
 
+bool expression_parser_binary(struct expression_ctx *ctx, struct token *tk);
+
 bool expression_parser_unary(struct expression_ctx *ctx, struct token *tk) {
   switch (tk->type) {
     case TT_INTEGER: {
       char *end;
-      struct ast_expr *expr = arena_alloc(ctx->arena, sizeof(struct ast_expr));
+      struct ast_expr *expr = mem_arena_alloc(ctx->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
 
       expr->as.integer = strtoll(tk->loc, &end, 10);
       expr->type = TERM_INT;
@@ -130,7 +139,7 @@ bool expression_parser_unary(struct expression_ctx *ctx, struct token *tk) {
     } break;
 
     case TT_IDENT: {
-      struct ast_expr *expr = arena_alloc(ctx->arena, sizeof(struct ast_expr));
+      struct ast_expr *expr = mem_arena_alloc(ctx->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
 
       expr->as.ident.len = tk->len;
       expr->as.ident.chars = tk->loc;
@@ -167,6 +176,18 @@ bool expression_parser_unary(struct expression_ctx *ctx, struct token *tk) {
       ctx->state = EPS_UNARY;
     } break;
 
+    case TT_R_BRACKET: {
+      /* A function call with no arguments, e.g. f() */
+      if (ctx->operator_stack_ptr > 0
+        && ctx->operator_stack[ctx->operator_stack_ptr - 1].op == MKR_FUNCTION
+        && ctx->operand_stack[ctx->operand_stack_ptr - 1] == NULL)
+      {
+        return expression_parser_binary(ctx, tk);
+      }
+
+      ctx->state = EPS_STOP;
+    } break;
+
     default: {
       ctx->state = EPS_STOP;
     } break;
@@ -206,16 +227,17 @@ bool expression_parser_binary(struct expression_ctx *ctx, struct token *tk) {
 
         while (ctx->operand_stack[--ctx->operand_stack_ptr] != NULL) {}
 
-        fn_call = arena_alloc(ctx->arena, sizeof(struct ast_fn_call));
+        fn_call = mem_arena_alloc(ctx->arena, MEM_NODE_FN_CALL, sizeof(struct ast_fn_call));
         fn_call->args_len = stack_ptr - ctx->operand_stack_ptr - 1;
 
-        fn_call->args = arena_alloc(ctx->arena, sizeof(struct ast_expr *) * fn_call->args_len);
+        fn_call->args = mem_arena_alloc(ctx->arena, MEM_NODE_LIST,
+          sizeof(struct ast_expr *) * fn_call->args_len);
         mempcpy(fn_call->args, &ctx->operand_stack[ctx->operand_stack_ptr + 1],
           sizeof(struct ast_expr *) * fn_call->args_len);
 
         fn_call->fn = ctx->operand_stack[--ctx->operand_stack_ptr];
 
-        expr = arena_alloc(ctx->arena, sizeof(struct ast_expr));
+        expr = mem_arena_alloc(ctx->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
         expr->type = TERM_FN_CALL;
         expr->as.fn_call = fn_call;
         expr->loc = fn_call->fn->loc;
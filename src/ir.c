@@ -0,0 +1,390 @@
+#include "ir.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+
+struct ir_module *ir_module_new() {
+  struct ir_module *module = malloc(sizeof(struct ir_module));
+  module->items_len = 0;
+  module->items_cap = 16;
+  module->items = malloc(sizeof(struct ir_item) * module->items_cap);
+
+  return module;
+}
+
+static void ir_proc_free(struct ir_proc *proc) {
+  for (size_t i = 0; i < proc->blocks_len; i++)
+    ir_block_free(proc->blocks[i]);
+
+  free(proc->blocks);
+  free(proc->params);
+  free(proc->param_types);
+  free(proc);
+}
+
+void ir_module_free(struct ir_module *module) {
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind == IR_ITEM_PROC)
+      ir_proc_free(module->items[i].as.proc);
+  }
+
+  free(module->items);
+  free(module);
+}
+
+static struct ir_item *ir_module_push(struct ir_module *module) {
+  if (module->items_len >= module->items_cap) {
+    module->items_cap *= 2;
+    module->items = realloc(module->items, sizeof(struct ir_item) * module->items_cap);
+  }
+
+  return &module->items[module->items_len++];
+}
+
+struct ir_proc *ir_module_add_proc(struct ir_module *module, struct ident *ident, ast_proc_flags flags) {
+  struct ir_item *item = ir_module_push(module);
+  struct ir_proc *proc = malloc(sizeof(struct ir_proc));
+
+  proc->ident = *ident;
+  proc->flags = flags;
+  proc->blocks_len = 0;
+  proc->blocks_cap = 8;
+  proc->blocks = malloc(sizeof(struct ir_block *) * proc->blocks_cap);
+  proc->params_len = 0;
+  proc->params = NULL;
+  proc->param_types = NULL;
+  proc->ret_type = IR_TYPE_L;
+  proc->temps_len = 0;
+  proc->next_block_id = 0;
+
+  item->kind = IR_ITEM_PROC;
+  item->as.proc = proc;
+
+  return proc;
+}
+
+void ir_module_add_data(struct ir_module *module, struct ir_data *data) {
+  struct ir_item *item = ir_module_push(module);
+
+  item->kind = IR_ITEM_DATA;
+  item->as.data = *data;
+}
+
+struct ir_proc *ir_module_find_proc(struct ir_module *module, struct ident *ident) {
+  struct ir_proc *proc;
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind != IR_ITEM_PROC)
+      continue;
+
+    proc = module->items[i].as.proc;
+
+    if (proc->ident.len == ident->len && strncmp(proc->ident.chars, ident->chars, ident->len) == 0)
+      return proc;
+  }
+
+  return NULL;
+}
+
+size_t ir_module_insts(struct ir_module *module) {
+  struct ir_proc *proc;
+  size_t insts = 0;
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind != IR_ITEM_PROC)
+      continue;
+
+    proc = module->items[i].as.proc;
+
+    for (size_t j = 0; j < proc->blocks_len; j++)
+      insts += proc->blocks[j]->insts_len;
+  }
+
+  return insts;
+}
+
+struct ir_block *ir_block_new(struct ir_proc *proc) {
+  struct ir_block *block = malloc(sizeof(struct ir_block));
+
+  block->id = proc->next_block_id++;
+  block->insts_len = 0;
+  block->insts_cap = 0;
+  block->insts = NULL;
+  block->jump = (struct ir_jump) { .kind = IR_JUMP_NONE };
+
+  return block;
+}
+
+void ir_proc_add_block(struct ir_proc *proc, struct ir_block *block) {
+  if (proc->blocks_len >= proc->blocks_cap) {
+    proc->blocks_cap *= 2;
+    proc->blocks = realloc(proc->blocks, sizeof(struct ir_block *) * proc->blocks_cap);
+  }
+
+  proc->blocks[proc->blocks_len++] = block;
+}
+
+void ir_block_free(struct ir_block *block) {
+  for (size_t i = 0; i < block->insts_len; i++)
+    ir_inst_free(&block->insts[i]);
+
+  free(block->insts);
+  free(block);
+}
+
+size_t ir_proc_new_temp(struct ir_proc *proc) {
+  return proc->temps_len++;
+}
+
+struct ir_inst *ir_block_push(struct ir_block *block, struct ir_inst *inst) {
+  if (block->insts_len >= block->insts_cap) {
+    block->insts_cap = block->insts_cap == 0 ? 16 : block->insts_cap * 2;
+    block->insts = realloc(block->insts, sizeof(struct ir_inst) * block->insts_cap);
+  }
+
+  block->insts[block->insts_len] = *inst;
+
+  return &block->insts[block->insts_len++];
+}
+
+void ir_inst_free(struct ir_inst *inst) {
+  free(inst->call_args);
+  free(inst->call_types);
+
+  inst->call_args = NULL;
+  inst->call_types = NULL;
+  inst->call_args_len = 0;
+}
+
+bool ir_value_equal(struct ir_value *a, struct ir_value *b) {
+  return ir_value_compare(a, b) == 0;
+}
+
+int ir_value_compare(struct ir_value *a, struct ir_value *b) {
+  int diff = a->kind - b->kind;
+
+  if (diff != 0)
+    return diff;
+
+  switch (a->kind) {
+    case IR_VALUE_NONE:
+      return 0;
+
+    case IR_VALUE_TEMP:
+      return (a->as.temp > b->as.temp) - (a->as.temp < b->as.temp);
+
+    case IR_VALUE_CONST:
+      return (a->as.integer > b->as.integer) - (a->as.integer < b->as.integer);
+
+    case IR_VALUE_GLOBAL: {
+      diff = a->as.global.len - b->as.global.len;
+
+      if (diff != 0)
+        return diff;
+
+      return strncmp(a->as.global.chars, b->as.global.chars, a->as.global.len);
+    }
+  }
+
+  return 0;
+}
+
+static const char *ir_op_strings[] = {
+  [IR_COPY] = "copy",
+  [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "mul", [IR_DIV] = "div", [IR_REM] = "rem",
+  [IR_UDIV] = "udiv", [IR_UREM] = "urem", [IR_NEG] = "neg",
+  [IR_AND] = "and", [IR_OR] = "or", [IR_XOR] = "xor", [IR_SHL] = "shl", [IR_SHR] = "shr", [IR_SAR] = "sar",
+  [IR_EXTSB] = "extsb", [IR_EXTUB] = "extub", [IR_EXTSH] = "extsh", [IR_EXTUH] = "extuh",
+  [IR_EXTSW] = "extsw", [IR_EXTUW] = "extuw",
+  [IR_CEQ] = "ceq", [IR_CNE] = "cne", [IR_CSGT] = "csgt", [IR_CSLT] = "cslt", [IR_CSGE] = "csge", [IR_CSLE] = "csle",
+  [IR_CUGT] = "cugt", [IR_CULT] = "cult", [IR_CUGE] = "cuge", [IR_CULE] = "cule",
+  [IR_ALLOC] = "alloc",
+  [IR_LOAD] = "load",
+  [IR_STORE] = "store",
+  [IR_CALL] = "call",
+};
+
+const char *ir_op_tostring(ir_op op) {
+  return ir_op_strings[op];
+}
+
+bool ir_op_is_pure(ir_op op) {
+  return op < IR_ALLOC;
+}
+
+bool ir_op_is_unary(ir_op op) {
+  return op == IR_COPY || op == IR_NEG || (op >= IR_EXTSB && op <= IR_EXTUW)
+    || op == IR_ALLOC || op == IR_LOAD;
+}
+
+bool ir_op_is_comparison(ir_op op) {
+  return op >= IR_CEQ && op <= IR_CULE;
+}
+
+bool ir_op_is_commutative(ir_op op) {
+  switch (op) {
+    case IR_ADD: case IR_MUL:
+    case IR_AND: case IR_OR: case IR_XOR:
+    case IR_CEQ: case IR_CNE:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void ir_proc_map_values(struct ir_proc *proc, void (*fn)(struct ir_value *value, void *udata), void *udata) {
+  struct ir_block *block;
+  struct ir_inst *inst;
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    for (size_t j = 0; j < block->insts_len; j++) {
+      inst = &block->insts[j];
+
+      fn(&inst->args[0], udata);
+      fn(&inst->args[1], udata);
+
+      for (size_t k = 0; k < inst->call_args_len; k++)
+        fn(&inst->call_args[k], udata);
+    }
+
+    fn(&block->jump.arg, udata);
+  }
+}
+
+static void replace_temp(struct ir_value *value, void *udata) {
+  struct ir_value *map = udata;
+
+  // Replacements may themselves have been replaced.
+  while (value->kind == IR_VALUE_TEMP && map[value->as.temp].kind != IR_VALUE_NONE)
+    *value = map[value->as.temp];
+}
+
+void ir_proc_replace_temps(struct ir_proc *proc, struct ir_value *map) {
+  ir_proc_map_values(proc, replace_temp, map);
+}
+
+size_t ir_block_succs(struct ir_block *block, struct ir_block *succs[2]) {
+  switch (block->jump.kind) {
+    case IR_JUMP_JMP: {
+      succs[0] = block->jump.targets[0];
+      return 1;
+    }
+
+    case IR_JUMP_JNZ: {
+      succs[0] = block->jump.targets[0];
+      succs[1] = block->jump.targets[1];
+      return 2;
+    }
+
+    default:
+      return 0;
+  }
+}
+
+struct verify_ctx {
+  struct ir_proc *proc;
+  const char *after;
+  size_t *defs;
+  bool ok;
+};
+
+static void verify_error(struct verify_ctx *ctx, const char *fmt, ...) {
+  char msg[128];
+  va_list vargs;
+
+  va_start(vargs, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, vargs);
+  va_end(vargs);
+
+  fprint_error(stderr, "invalid IR in %.*s after %s: %s",
+    ctx->proc->ident.len, ctx->proc->ident.chars, ctx->after, msg);
+
+  ctx->ok = false;
+}
+
+static void verify_use(struct ir_value *value, void *udata) {
+  struct verify_ctx *ctx = udata;
+
+  if (value->kind != IR_VALUE_TEMP)
+    return;
+
+  if (value->as.temp >= ctx->proc->temps_len)
+    verify_error(ctx, "use of unknown temporary %%t_%zu", value->as.temp);
+  else if (ctx->defs[value->as.temp] == 0)
+    verify_error(ctx, "use of undefined temporary %%t_%zu", value->as.temp);
+}
+
+/* Checks the structural invariants the passes and the emitter rely on.
+ * `after` names the last pass to have run, for the error message. */
+bool ir_proc_verify(struct ir_proc *proc, const char *after) {
+  struct ir_block *block, *succs[2];
+  struct ir_inst *inst;
+  size_t succs_len;
+  struct verify_ctx ctx = {
+    .proc = proc,
+    .after = after,
+    .defs = calloc(proc->temps_len + 1, sizeof(size_t)),
+    .ok = true,
+  };
+
+  if (proc->blocks_len == 0)
+    verify_error(&ctx, "procedure has no blocks");
+
+  for (size_t i = 0; i < proc->params_len; i++) {
+    if (proc->params[i] >= proc->temps_len)
+      verify_error(&ctx, "parameter %zu is an unknown temporary", i);
+    else if (ctx.defs[proc->params[i]]++ > 0)
+      verify_error(&ctx, "temporary %%t_%zu is defined more than once", proc->params[i]);
+  }
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    if (block->jump.kind == IR_JUMP_NONE)
+      verify_error(&ctx, "block @L_%zu has no jump", block->id);
+
+    if (block->jump.kind == IR_JUMP_JNZ && block->jump.arg.kind == IR_VALUE_NONE)
+      verify_error(&ctx, "block @L_%zu jumps on nothing", block->id);
+
+    succs_len = ir_block_succs(block, succs);
+
+    for (size_t j = 0; j < succs_len; j++) {
+      size_t k;
+
+      for (k = 0; k < proc->blocks_len && proc->blocks[k] != succs[j]; k++) {}
+
+      if (k == proc->blocks_len)
+        verify_error(&ctx, "block @L_%zu jumps to a block outside the procedure", block->id);
+      else if (k == 0)
+        verify_error(&ctx, "block @L_%zu jumps to the entry block", block->id);
+    }
+
+    for (size_t j = 0; j < block->insts_len; j++) {
+      inst = &block->insts[j];
+
+      if (inst->op == IR_ALLOC && i != 0)
+        verify_error(&ctx, "alloc outside of the entry block in @L_%zu", block->id);
+
+      if (inst->type == IR_TYPE_NONE)
+        continue;
+
+      if (inst->dest >= proc->temps_len)
+        verify_error(&ctx, "definition of unknown temporary %%t_%zu", inst->dest);
+      else if (ctx.defs[inst->dest]++ > 0)
+        verify_error(&ctx, "temporary %%t_%zu is defined more than once", inst->dest);
+    }
+  }
+
+  ir_proc_map_values(proc, verify_use, &ctx);
+
+  free(ctx.defs);
+
+  return ctx.ok;
+}
@@ -0,0 +1,210 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+/* The mid-level IR sits between `struct ast` and the QBE text emitter.
+ * Procedures are a control flow graph of basic blocks, each of which holds a
+ * list of typed three address instructions and ends in a single jump.
+ * Temporaries are only ever assigned by one instruction, locals live in
+ * stack slots created by IR_ALLOC in the entry block. */
+
+typedef enum {
+  IR_TYPE_NONE,
+  IR_TYPE_W,
+  IR_TYPE_L,
+  /* Sub-word types, only used as the memory type of loads and stores. */
+  IR_TYPE_SB, IR_TYPE_UB, IR_TYPE_SH, IR_TYPE_UH,
+} ir_type;
+
+typedef enum {
+  IR_VALUE_NONE,
+  IR_VALUE_TEMP,
+  IR_VALUE_CONST,
+  IR_VALUE_GLOBAL,
+} ir_value_kind;
+
+union ir_value_as {
+  size_t temp;
+  int64_t integer;
+  struct ident global;
+};
+
+struct ir_value {
+  ir_value_kind kind;
+  union ir_value_as as;
+};
+
+typedef enum {
+  IR_COPY,
+
+  IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_REM, IR_UDIV, IR_UREM, IR_NEG,
+  IR_AND, IR_OR, IR_XOR, IR_SHL, IR_SHR, IR_SAR,
+  IR_EXTSB, IR_EXTUB, IR_EXTSH, IR_EXTUH, IR_EXTSW, IR_EXTUW,
+  IR_CEQ, IR_CNE, IR_CSGT, IR_CSLT, IR_CSGE, IR_CSLE, IR_CUGT, IR_CULT, IR_CUGE, IR_CULE,
+
+  IR_ALLOC,
+  IR_LOAD,
+  IR_STORE,
+  IR_CALL,
+} ir_op;
+
+struct ir_inst {
+  ir_op op;
+  /* The class of `dest`, IR_TYPE_W or IR_TYPE_L. */
+  ir_type type;
+  /* The class of the operands of comparisons, or the memory type of loads
+   * and stores. */
+  ir_type arg_type;
+  /* The temporary assigned by this instruction, if `type` is not
+   * IR_TYPE_NONE. */
+  size_t dest;
+  /* IR_ALLOC allocates args[0] bytes.
+   * IR_STORE stores args[0] to the address in args[1].
+   * IR_CALL calls args[0] with `call_args`, of classes `call_types`. */
+  struct ir_value args[2];
+
+  size_t call_args_len;
+  struct ir_value *call_args;
+  ir_type *call_types;
+  /* Calls to variadic procedures pass the arguments after the first
+   * `call_fixed_len` as variable arguments. */
+  bool call_variadic;
+  size_t call_fixed_len;
+};
+
+typedef enum {
+  IR_JUMP_NONE,
+  IR_JUMP_JMP,
+  IR_JUMP_JNZ,
+  IR_JUMP_RET,
+} ir_jump_kind;
+
+struct ir_block;
+
+struct ir_jump {
+  ir_jump_kind kind;
+  struct ir_value arg;
+  /* IR_JUMP_JNZ jumps to targets[0] when `arg` is non-zero. */
+  struct ir_block *targets[2];
+};
+
+struct ir_block {
+  size_t id;
+
+  size_t insts_len, insts_cap;
+  struct ir_inst *insts;
+
+  struct ir_jump jump;
+};
+
+struct ir_proc {
+  struct ident ident;
+  ast_proc_flags flags;
+
+  /* blocks[0] is the entry block. */
+  size_t blocks_len, blocks_cap;
+  struct ir_block **blocks;
+
+  /* The parameters arrive in these temporaries, of classes `param_types`. */
+  size_t params_len;
+  size_t *params;
+  ir_type *param_types;
+  ir_type ret_type;
+
+  size_t temps_len;
+  size_t next_block_id;
+};
+
+typedef enum {
+  IR_DATA_STRING,
+  IR_DATA_INTEGER,
+} ir_data_kind;
+
+struct ir_data {
+  struct ident ident;
+  ir_data_kind kind;
+  union {
+    struct string string;
+    int64_t integer;
+  } as;
+};
+
+typedef enum {
+  IR_ITEM_PROC,
+  IR_ITEM_DATA,
+} ir_item_kind;
+
+struct ir_item {
+  ir_item_kind kind;
+  union {
+    struct ir_proc *proc;
+    struct ir_data data;
+  } as;
+};
+
+struct ir_module {
+  size_t items_len, items_cap;
+  struct ir_item *items;
+};
+
+struct ir_module *ir_module_new();
+void ir_module_free(struct ir_module *module);
+
+struct ir_proc *ir_module_add_proc(struct ir_module *module, struct ident *ident, ast_proc_flags flags);
+void ir_module_add_data(struct ir_module *module, struct ir_data *data);
+struct ir_proc *ir_module_find_proc(struct ir_module *module, struct ident *ident);
+/* How many instructions the procedures of `module` have in all. */
+size_t ir_module_insts(struct ir_module *module);
+
+struct ir_block *ir_block_new(struct ir_proc *proc);
+void ir_proc_add_block(struct ir_proc *proc, struct ir_block *block);
+void ir_block_free(struct ir_block *block);
+
+size_t ir_proc_new_temp(struct ir_proc *proc);
+
+struct ir_inst *ir_block_push(struct ir_block *block, struct ir_inst *inst);
+void ir_inst_free(struct ir_inst *inst);
+
+static inline struct ir_value ir_value_none() {
+  return (struct ir_value) { .kind = IR_VALUE_NONE };
+}
+
+static inline struct ir_value ir_value_temp(size_t temp) {
+  return (struct ir_value) { .kind = IR_VALUE_TEMP, .as.temp = temp };
+}
+
+static inline struct ir_value ir_value_const(int64_t integer) {
+  return (struct ir_value) { .kind = IR_VALUE_CONST, .as.integer = integer };
+}
+
+static inline struct ir_value ir_value_global(struct ident ident) {
+  return (struct ir_value) { .kind = IR_VALUE_GLOBAL, .as.global = ident };
+}
+
+bool ir_value_equal(struct ir_value *a, struct ir_value *b);
+int ir_value_compare(struct ir_value *a, struct ir_value *b);
+
+bool ir_op_is_pure(ir_op op);
+bool ir_op_is_unary(ir_op op);
+bool ir_op_is_commutative(ir_op op);
+bool ir_op_is_comparison(ir_op op);
+const char *ir_op_tostring(ir_op op);
+
+/* Calls `fn` on every operand of the instructions and jumps of `proc`. */
+void ir_proc_map_values(struct ir_proc *proc, void (*fn)(struct ir_value *value, void *udata), void *udata);
+
+/* Replaces every use of temporary `i` with `map[i]`, unless it's kind is
+ * IR_VALUE_NONE. */
+void ir_proc_replace_temps(struct ir_proc *proc, struct ir_value *map);
+
+/* Returns the number of successors of `block`, and stores them in `succs`. */
+size_t ir_block_succs(struct ir_block *block, struct ir_block *succs[2]);
+
+bool ir_proc_verify(struct ir_proc *proc, const char *after);
+
+#endif /* IR_H */
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+
+#include "jit.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "error.h"
+#include "ir.h"
+#include "vm.h"
+
+#if defined(__x86_64__)
+
+/* Generated code runs on its own thread, with a stack big enough for deep
+ * recursion. */
+#define JIT_STACK_SIZE ((size_t)256 << 20)
+
+enum { RAX = 0, RCX = 1, RDX = 2, RSP = 4, RBP = 5, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R11 = 11 };
+
+/* The System V registers for the first integer arguments. */
+static const int jit_arg_regs[] = { RDI, RSI, RDX, RCX, R8, R9 };
+
+/* A 32-bit displacement, or a 64-bit address for `addrs`, at `at` in the
+ * code which is patched once `target` has been placed. */
+struct jit_fixup {
+  size_t at;
+  size_t target;
+};
+
+struct jit_fixups {
+  size_t len, cap;
+  struct jit_fixup *items;
+};
+
+/* Every temporary lives in a stack slot, [rbp - 8 * (t + 1)], and operations
+ * go through rax and rcx. Simple, but the code still runs without any
+ * dispatch overhead. */
+struct jit {
+  struct ir_module *module;
+  void **data;
+
+  size_t len, cap;
+  uint8_t *code;
+
+  size_t procs_len;
+  struct ir_proc **procs;
+  size_t *proc_offsets;
+  /* Calls to procedures, and the addresses of procedures used as values. */
+  struct jit_fixups calls, addrs;
+
+  /* Of the procedure being generated, indexed by block id. */
+  size_t *block_offsets;
+  struct jit_fixups jumps;
+  int32_t frame_size;
+};
+
+#define JIT_EMIT(jit, bytes) jit_emit((jit), (bytes), sizeof(bytes) - 1)
+
+static void jit_emit(struct jit *jit, const char *bytes, size_t len) {
+  if (jit->len + len > jit->cap) {
+    while (jit->len + len > jit->cap)
+      jit->cap = jit->cap == 0 ? 4096 : jit->cap * 2;
+
+    jit->code = realloc(jit->code, jit->cap);
+  }
+
+  memcpy(&jit->code[jit->len], bytes, len);
+  jit->len += len;
+}
+
+static void jit_byte(struct jit *jit, uint8_t byte) {
+  jit_emit(jit, (const char *)&byte, 1);
+}
+
+static void jit_u32(struct jit *jit, uint32_t value) {
+  jit_emit(jit, (const char *)&value, 4);
+}
+
+static void jit_u64(struct jit *jit, uint64_t value) {
+  jit_emit(jit, (const char *)&value, 8);
+}
+
+static void jit_fixup(struct jit_fixups *fixups, size_t at, size_t target) {
+  if (fixups->len >= fixups->cap) {
+    fixups->cap = fixups->cap == 0 ? 16 : fixups->cap * 2;
+    fixups->items = realloc(fixups->items, sizeof(struct jit_fixup) * fixups->cap);
+  }
+
+  fixups->items[fixups->len++] = (struct jit_fixup) { .at = at, .target = target };
+}
+
+static void jit_patch_rel32(struct jit *jit, size_t at, size_t target) {
+  int32_t rel = (int32_t)(target - (at + 4));
+
+  memcpy(&jit->code[at], &rel, 4);
+}
+
+static void jit_rex(struct jit *jit, bool wide, int reg, int rm) {
+  uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+
+  if (rex != 0x40)
+    jit_byte(jit, rex);
+}
+
+static int32_t jit_slot(size_t temp) {
+  return -8 * (int32_t)(temp + 1);
+}
+
+/* `op reg, [rbp + disp]`, or the other way around depending on `op`. */
+static void jit_rbp(struct jit *jit, uint8_t op, int reg, int32_t disp) {
+  jit_rex(jit, true, reg, RBP);
+  jit_byte(jit, op);
+  jit_byte(jit, 0x80 | (reg & 7) << 3 | RBP);
+  jit_u32(jit, disp);
+}
+
+static void jit_mov_imm(struct jit *jit, int reg, int64_t value) {
+  jit_rex(jit, true, 0, reg);
+
+  if (value == (int32_t)value) {
+    jit_byte(jit, 0xC7);
+    jit_byte(jit, 0xC0 | (reg & 7));
+    jit_u32(jit, value);
+  } else {
+    jit_byte(jit, 0xB8 + (reg & 7));
+    jit_u64(jit, value);
+  }
+}
+
+/* Finds the procedure or data `ident` refers to, anything else is foreign. */
+static bool jit_global(struct jit *jit, struct ident *ident, size_t *proc, void **address) {
+  struct ir_item *item;
+  size_t j = 0;
+
+  *proc = SIZE_MAX;
+
+  for (size_t i = 0; i < jit->module->items_len; i++) {
+    item = &jit->module->items[i];
+
+    if (item->kind == IR_ITEM_PROC) {
+      if (item->as.proc->ident.len == ident->len
+        && strncmp(item->as.proc->ident.chars, ident->chars, ident->len) == 0)
+      {
+        *proc = j;
+        return true;
+      }
+
+      j++;
+    } else if (item->as.data.ident.len == ident->len
+      && strncmp(item->as.data.ident.chars, ident->chars, ident->len) == 0)
+    {
+      *address = jit->data[i];
+      return true;
+    }
+  }
+
+  *address = vm_foreign(ident);
+
+  return *address != NULL;
+}
+
+static bool jit_load(struct jit *jit, int reg, struct ir_value *value) {
+  size_t proc;
+  void *address;
+
+  switch (value->kind) {
+    case IR_VALUE_NONE: jit_mov_imm(jit, reg, 0); break;
+    case IR_VALUE_TEMP: jit_rbp(jit, 0x8B, reg, jit_slot(value->as.temp)); break;
+    case IR_VALUE_CONST: jit_mov_imm(jit, reg, value->as.integer); break;
+
+    case IR_VALUE_GLOBAL: {
+      if (!jit_global(jit, &value->as.global, &proc, &address))
+        return false;
+
+      if (proc == SIZE_MAX) {
+        jit_mov_imm(jit, reg, (int64_t)address);
+      } else {
+        // The address of the procedure is only known once the code is mapped.
+        jit_rex(jit, true, 0, reg);
+        jit_byte(jit, 0xB8 + (reg & 7));
+        jit_fixup(&jit->addrs, jit->len, proc);
+        jit_u64(jit, 0);
+      }
+    } break;
+  }
+
+  return true;
+}
+
+static void jit_store(struct jit *jit, int reg, size_t temp) {
+  jit_rbp(jit, 0x89, reg, jit_slot(temp));
+}
+
+static bool jit_call(struct jit *jit, struct ir_inst *inst) {
+  size_t n = inst->call_args_len, on_stack = n > 6 ? n - 6 : 0, proc = SIZE_MAX;
+  size_t pushed = on_stack + (on_stack & 1);
+  void *address = NULL;
+
+  // The stack stays 16-byte aligned at the call.
+  if (on_stack & 1)
+    JIT_EMIT(jit, "\x48\x83\xEC\x08");
+
+  for (size_t i = n; i > 6; i--) {
+    if (!jit_load(jit, RAX, &inst->call_args[i - 1]))
+      return false;
+
+    JIT_EMIT(jit, "\x50");
+  }
+
+  for (size_t i = 0; i < n && i < 6; i++) {
+    if (!jit_load(jit, jit_arg_regs[i], &inst->call_args[i]))
+      return false;
+  }
+
+  if (inst->args[0].kind == IR_VALUE_GLOBAL) {
+    if (!jit_global(jit, &inst->args[0].as.global, &proc, &address))
+      return false;
+
+    if (proc == SIZE_MAX)
+      jit_mov_imm(jit, R11, (int64_t)address);
+  } else if (!jit_load(jit, R11, &inst->args[0])) {
+    return false;
+  }
+
+  // al holds the number of vector registers used by a variadic call.
+  JIT_EMIT(jit, "\x31\xC0");
+
+  if (proc != SIZE_MAX) {
+    jit_byte(jit, 0xE8);
+    jit_fixup(&jit->calls, jit->len, proc);
+    jit_u32(jit, 0);
+  } else {
+    JIT_EMIT(jit, "\x41\xFF\xD3");
+  }
+
+  if (pushed > 0) {
+    JIT_EMIT(jit, "\x48\x81\xC4");
+    jit_u32(jit, 8 * pushed);
+  }
+
+  jit_store(jit, RAX, inst->dest);
+
+  return true;
+}
+
+/* The condition codes of setcc, indexed by comparison. */
+static const uint8_t jit_setcc[] = {
+  [IR_CEQ] = 0x94, [IR_CNE] = 0x95,
+  [IR_CSGT] = 0x9F, [IR_CSLT] = 0x9C, [IR_CSGE] = 0x9D, [IR_CSLE] = 0x9E,
+  [IR_CUGT] = 0x97, [IR_CULT] = 0x92, [IR_CUGE] = 0x93, [IR_CULE] = 0x96,
+};
+
+/* `op rax, rcx` for the two operand ALU instructions. */
+static const uint8_t jit_alu[] = {
+  [IR_ADD] = 0x01, [IR_SUB] = 0x29, [IR_AND] = 0x21, [IR_OR] = 0x09, [IR_XOR] = 0x31,
+};
+
+static bool jit_inst(struct jit *jit, struct ir_inst *inst) {
+  bool wide = inst->type == IR_TYPE_L;
+
+  switch (inst->op) {
+    case IR_ALLOC: {
+      jit->frame_size += (inst->args[0].as.integer + 15) & ~15;
+      jit_rbp(jit, 0x8D, RAX, -jit->frame_size);
+      jit_store(jit, RAX, inst->dest);
+
+      return true;
+    }
+
+    case IR_CALL:
+      return jit_call(jit, inst);
+
+    case IR_STORE: {
+      if (!jit_load(jit, RAX, &inst->args[0]) || !jit_load(jit, RCX, &inst->args[1]))
+        return false;
+
+      switch (inst->arg_type) {
+        case IR_TYPE_SB: case IR_TYPE_UB: JIT_EMIT(jit, "\x88\x01"); break;
+        case IR_TYPE_SH: case IR_TYPE_UH: JIT_EMIT(jit, "\x66\x89\x01"); break;
+        case IR_TYPE_W: JIT_EMIT(jit, "\x89\x01"); break;
+        default: JIT_EMIT(jit, "\x48\x89\x01"); break;
+      }
+
+      return true;
+    }
+
+    default: break;
+  }
+
+  if (!jit_load(jit, RAX, &inst->args[0]))
+    return false;
+
+  if (inst->args[1].kind != IR_VALUE_NONE && !jit_load(jit, RCX, &inst->args[1]))
+    return false;
+
+  if (ir_op_is_comparison(inst->op)) {
+    jit_rex(jit, inst->arg_type == IR_TYPE_L, RCX, RAX);
+    JIT_EMIT(jit, "\x39\xC8");
+    jit_byte(jit, 0x0F);
+    jit_byte(jit, jit_setcc[inst->op]);
+    JIT_EMIT(jit, "\xC0\x0F\xB6\xC0");
+    jit_store(jit, RAX, inst->dest);
+
+    return true;
+  }
+
+  switch (inst->op) {
+    case IR_COPY: break;
+
+    case IR_ADD: case IR_SUB: case IR_AND: case IR_OR: case IR_XOR: {
+      jit_rex(jit, wide, RCX, RAX);
+      jit_byte(jit, jit_alu[inst->op]);
+      jit_byte(jit, 0xC8);
+    } break;
+
+    case IR_MUL: jit_rex(jit, wide, RAX, RCX); JIT_EMIT(jit, "\x0F\xAF\xC1"); break;
+    case IR_NEG: jit_rex(jit, wide, 0, RAX); JIT_EMIT(jit, "\xF7\xD8"); break;
+
+    case IR_DIV: case IR_REM: {
+      jit_rex(jit, wide, 0, 0);
+      JIT_EMIT(jit, "\x99");
+      jit_rex(jit, wide, 0, RCX);
+      JIT_EMIT(jit, "\xF7\xF9");
+    } break;
+
+    case IR_UDIV: case IR_UREM: {
+      JIT_EMIT(jit, "\x31\xD2");
+      jit_rex(jit, wide, 0, RCX);
+      JIT_EMIT(jit, "\xF7\xF1");
+    } break;
+
+    case IR_SHL: jit_rex(jit, wide, 0, RAX); JIT_EMIT(jit, "\xD3\xE0"); break;
+    case IR_SHR: jit_rex(jit, wide, 0, RAX); JIT_EMIT(jit, "\xD3\xE8"); break;
+    case IR_SAR: jit_rex(jit, wide, 0, RAX); JIT_EMIT(jit, "\xD3\xF8"); break;
+
+    case IR_EXTSB: JIT_EMIT(jit, "\x48\x0F\xBE\xC0"); break;
+    case IR_EXTUB: JIT_EMIT(jit, "\x0F\xB6\xC0"); break;
+    case IR_EXTSH: JIT_EMIT(jit, "\x48\x0F\xBF\xC0"); break;
+    case IR_EXTUH: JIT_EMIT(jit, "\x0F\xB7\xC0"); break;
+    case IR_EXTSW: JIT_EMIT(jit, "\x48\x63\xC0"); break;
+    case IR_EXTUW: JIT_EMIT(jit, "\x89\xC0"); break;
+
+    case IR_LOAD: {
+      // The address was loaded into rax, load through rcx.
+      JIT_EMIT(jit, "\x48\x89\xC1");
+
+      switch (inst->arg_type) {
+        case IR_TYPE_SB: JIT_EMIT(jit, "\x48\x0F\xBE\x01"); break;
+        case IR_TYPE_UB: JIT_EMIT(jit, "\x0F\xB6\x01"); break;
+        case IR_TYPE_SH: JIT_EMIT(jit, "\x48\x0F\xBF\x01"); break;
+        case IR_TYPE_UH: JIT_EMIT(jit, "\x0F\xB7\x01"); break;
+        case IR_TYPE_W: JIT_EMIT(jit, "\x48\x63\x01"); break;
+        default: JIT_EMIT(jit, "\x48\x8B\x01"); break;
+      }
+    } break;
+
+    default: {
+      fprint_error(stderr, "the JIT cannot generate %s", ir_op_tostring(inst->op));
+
+      return false;
+    }
+  }
+
+  jit_store(jit, inst->op == IR_REM || inst->op == IR_UREM ? RDX : RAX, inst->dest);
+
+  return true;
+}
+
+static void jit_jump(struct jit *jit, struct ir_block *target, struct ir_block *next) {
+  if (target == next)
+    return;
+
+  jit_byte(jit, 0xE9);
+  jit_fixup(&jit->jumps, jit->len, target->id);
+  jit_u32(jit, 0);
+}
+
+static bool jit_proc(struct jit *jit, struct ir_proc *proc) {
+  struct ir_block *block, *next;
+  struct ir_jump *jump;
+  int32_t frame_size = 8 * proc->temps_len;
+  size_t frame_size_at;
+
+  jit->block_offsets = realloc(jit->block_offsets, sizeof(size_t) * (proc->next_block_id + 1));
+  jit->jumps.len = 0;
+  jit->frame_size = (frame_size + 15) & ~15;
+
+  // push rbp; mov rbp, rsp; sub rsp, frame size, which is known at the end.
+  JIT_EMIT(jit, "\x55\x48\x89\xE5\x48\x81\xEC");
+  frame_size_at = jit->len;
+  jit_u32(jit, 0);
+
+  for (size_t i = 0; i < proc->params_len; i++) {
+    if (i < 6) {
+      jit_store(jit, jit_arg_regs[i], proc->params[i]);
+    } else {
+      jit_rbp(jit, 0x8B, RAX, 16 + 8 * (i - 6));
+      jit_store(jit, RAX, proc->params[i]);
+    }
+  }
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+    next = i + 1 < proc->blocks_len ? proc->blocks[i + 1] : NULL;
+    jump = &block->jump;
+
+    jit->block_offsets[block->id] = jit->len;
+
+    for (size_t j = 0; j < block->insts_len; j++) {
+      if (!jit_inst(jit, &block->insts[j]))
+        return false;
+    }
+
+    switch (jump->kind) {
+      case IR_JUMP_NONE:
+      case IR_JUMP_RET: {
+        if (!jit_load(jit, RAX, &jump->arg))
+          return false;
+
+        // leave; ret
+        JIT_EMIT(jit, "\xC9\xC3");
+      } break;
+
+      case IR_JUMP_JMP: {
+        jit_jump(jit, jump->targets[0], next);
+      } break;
+
+      case IR_JUMP_JNZ: {
+        // jnz tests the lower 32 bits.
+        if (!jit_load(jit, RAX, &jump->arg))
+          return false;
+
+        JIT_EMIT(jit, "\x85\xC0\x0F\x85");
+        jit_fixup(&jit->jumps, jit->len, jump->targets[0]->id);
+        jit_u32(jit, 0);
+        jit_jump(jit, jump->targets[1], next);
+      } break;
+    }
+  }
+
+  for (size_t i = 0; i < jit->jumps.len; i++)
+    jit_patch_rel32(jit, jit->jumps.items[i].at, jit->block_offsets[jit->jumps.items[i].target]);
+
+  frame_size = (jit->frame_size + 15) & ~15;
+  memcpy(&jit->code[frame_size_at], &frame_size, 4);
+
+  return true;
+}
+
+struct jit_entry {
+  int64_t (*fn)(void);
+  int64_t result;
+};
+
+static void *jit_call_entry(void *udata) {
+  struct jit_entry *entry = udata;
+
+  entry->result = entry->fn();
+
+  return NULL;
+}
+
+bool jit_run_module(struct ir_module *module, int64_t *result) {
+  struct ident main_ident = { .len = 4, .chars = "main" };
+  struct jit jit = {
+    .module = module,
+    .data = vm_load_data(module),
+  };
+  size_t entry = SIZE_MAX, j = 0;
+  uint8_t *mem = MAP_FAILED;
+  void *address;
+  bool ok = true;
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind == IR_ITEM_PROC)
+      jit.procs_len++;
+  }
+
+  jit.procs = malloc(sizeof(struct ir_proc *) * (jit.procs_len + 1));
+  jit.proc_offsets = malloc(sizeof(size_t) * (jit.procs_len + 1));
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind == IR_ITEM_PROC)
+      jit.procs[j++] = module->items[i].as.proc;
+  }
+
+  for (size_t i = 0; i < jit.procs_len && ok; i++) {
+    // Procedures start on a 16-byte boundary, padded with int3.
+    while (jit.len % 16 != 0)
+      jit_byte(&jit, 0xCC);
+
+    jit.proc_offsets[i] = jit.len;
+    ok = jit_proc(&jit, jit.procs[i]);
+  }
+
+  if (ok && !jit_global(&jit, &main_ident, &entry, &address))
+    ok = false;
+
+  if (ok && entry == SIZE_MAX) {
+    fprint_error(stderr, "there is no main procedure to run");
+    ok = false;
+  }
+
+  if (ok) {
+    for (size_t i = 0; i < jit.calls.len; i++)
+      jit_patch_rel32(&jit, jit.calls.items[i].at, jit.proc_offsets[jit.calls.items[i].target]);
+
+    mem = mmap(NULL, jit.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+      fprint_error(stderr, "failed to map memory for the generated code");
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    memcpy(mem, jit.code, jit.len);
+
+    for (size_t i = 0; i < jit.addrs.len; i++) {
+      uint64_t target = (uint64_t)(mem + jit.proc_offsets[jit.addrs.items[i].target]);
+
+      memcpy(&mem[jit.addrs.items[i].at], &target, 8);
+    }
+
+    if (mprotect(mem, jit.len, PROT_READ | PROT_EXEC) != 0) {
+      fprint_error(stderr, "failed to make the generated code executable");
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    struct jit_entry call = { .fn = (int64_t (*)(void))(mem + jit.proc_offsets[entry]) };
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, JIT_STACK_SIZE);
+
+    if (pthread_create(&thread, &attr, jit_call_entry, &call) != 0) {
+      fprint_error(stderr, "failed to start a thread to run the generated code");
+      ok = false;
+    } else {
+      pthread_join(thread, NULL);
+      *result = call.result;
+    }
+
+    pthread_attr_destroy(&attr);
+  }
+
+  if (mem != MAP_FAILED)
+    munmap(mem, jit.len);
+
+  free(jit.code);
+  free(jit.procs);
+  free(jit.proc_offsets);
+  free(jit.block_offsets);
+  free(jit.calls.items);
+  free(jit.addrs.items);
+  free(jit.jumps.items);
+  vm_free_data(module, jit.data);
+
+  return ok;
+}
+
+#else
+
+bool jit_run_module(struct ir_module *module, int64_t *result) {
+  fprint_error(stderr, "the JIT only generates x86-64 code");
+  fprint_help(stderr, "use 'jotunheim run' to interpret the program instead");
+
+  return false;
+}
+
+#endif
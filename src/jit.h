@@ -0,0 +1,16 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+/* Generates x86-64 machine code for the procedures of `module` into an
+ * executable mapping, and calls its main procedure directly. Foreign
+ * procedures and data are resolved like in run mode.
+ * Returns false if the module can't be run, otherwise main's return value is
+ * stored in `result`. */
+bool jit_run_module(struct ir_module *module, int64_t *result);
+
+#endif /* JIT_H */
@@ -1,6 +1,7 @@
 #include "sys/wait.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,13 +12,28 @@
 #include "parser.h"
 #include "ast.h"
 #include "arena.h"
+#include "source.h"
 #include "emit.h"
+#include "ir.h"
+#include "pass.h"
+#include "qbe.h"
+#include "vm.h"
+#include "cache.h"
+#include "jit.h"
+#include "server.h"
+#include "watch.h"
+#include "trace.h"
+#include "mem.h"
 
 #ifndef JOTUNHEIM_VERSION
   #define JOTUNHEIM_VERSION "unversioned"
 #endif
 
-int exec_command(char *argv[]) {
+static const size_t inline_thresholds[] = { 0, 8, 32 };
+
+int exec_command(enum trace_phase phase, char *argv[]) {
+  struct trace_mark mark = trace_mark();
+  struct rusage usage;
   int status = 0;
   pid_t fk = fork();
 
@@ -27,89 +43,409 @@ int exec_command(char *argv[]) {
   } else if (fk < 0) {
     return 1;
   } else if (fk > 0) {
-    waitpid(fk, &status, 0);
+    wait4(fk, &status, 0, &usage);
+    trace_child(phase, argv, fk, mark, &usage);
   }
 
   return WEXITSTATUS(status);
 }
 
-int main(int argc, char *argv[]) {
+/* Names the intermediate file of this build with extension `ext`. Server
+ * workers build in the same directories at once, so the names are unique
+ * to the process. */
+static void build_path(char out[64], const char *ext) {
+  snprintf(out, 64, "jotunheim-%ld.%s", (long)getpid(), ext);
+}
+
+/* Builds each procedure, and all of the data, into its own object through
+ * the object cache, so only what changed goes through qbe and the assembler
+ * again, then links the objects into `out_filename`. */
+static int build_incremental(struct ir_module *module, struct cache_key *tools, const char *out_filename) {
+  struct string_buffer *buf = string_buffer_new();
+  size_t objects_len = 0, hits = 0, misses = 0, len;
+  char **objects = calloc(module->items_len + 1, sizeof(char *)), **link_argv;
+  struct cache_key key;
+  struct trace_mark mark;
+  const char *chars;
+  char ssa_filename[64], s_filename[64], o_filename[64];
+  FILE *ssa_fptr;
+  int status = 0;
+
+  build_path(ssa_filename, "ssa");
+  build_path(s_filename, "s");
+  build_path(o_filename, "o");
+
+  for (size_t i = 0; i <= module->items_len && status == 0; i++) {
+    mark = trace_mark();
+    string_buffer_clear(buf);
+
+    if (i == module->items_len) {
+      // The data all goes into the last object, exported so procedures in
+      // the other objects can reach it.
+      for (size_t j = 0; j < module->items_len; j++) {
+        if (module->items[j].kind == IR_ITEM_DATA) {
+          sb_printf(buf, "export ");
+          qbe_emit_data(buf, &module->items[j].as.data);
+        }
+      }
+    } else if (module->items[i].kind == IR_ITEM_PROC) {
+      // Calls spell out the classes of their arguments and result, so the
+      // text of a procedure covers the signatures of what it calls.
+      qbe_emit_proc(buf, module->items[i].as.proc);
+    }
+
+    chars = string_buffer_chars(buf, &len);
+
+    if (len == 0)
+      continue;
+
+    if (i < module->items_len) {
+      trace_span(TRACE_SSA, module->items[i].as.proc->ident.len,
+        module->items[i].as.proc->ident.chars, mark, len);
+    } else {
+      trace_span(TRACE_SSA, 0, NULL, mark, len);
+    }
+
+    trace_items(TRACE_SSA, len);
+
+    key = *tools;
+    cache_key_add_string(&key, "object");
+    cache_key_add(&key, chars, len);
+    objects[objects_len] = cache_path(&key, ".o");
+
+    if (objects[objects_len] == NULL) {
+      fprint_error(stderr, "incremental builds need a cache directory");
+      fprint_help(stderr, "set XDG_CACHE_HOME or HOME");
+      status = 1;
+      break;
+    }
+
+    if (access(objects[objects_len++], R_OK) == 0) {
+      hits++;
+      continue;
+    }
+
+    misses++;
+
+    ssa_fptr = fopen(ssa_filename, "w");
+
+    if (ssa_fptr == NULL) {
+      fprintf(stderr, "Failed to open file %s. %s\n", ssa_filename, strerror(errno));
+      status = 1;
+      break;
+    }
+
+    string_buffer_dump_to_file(buf, ssa_fptr);
+    fclose(ssa_fptr);
+
+    status = exec_command(TRACE_QBE, (char *[]) { "qbe", "-o", s_filename, ssa_filename, NULL });
+
+    if (status == 0)
+      status = exec_command(TRACE_CC, (char *[]) { "cc", "-c", "-o", o_filename, s_filename, NULL });
+
+    if (status == 0 && !cache_store(objects[objects_len - 1], o_filename)) {
+      fprint_error(stderr, "failed to store an object in the cache");
+      status = 1;
+    }
+  }
+
+  unlink(ssa_filename);
+  unlink(s_filename);
+  unlink(o_filename);
+  printf("Object cache: %zu hits, %zu misses\n", hits, misses);
+
+  if (status == 0) {
+    link_argv = malloc(sizeof(char *) * (objects_len + 5));
+    link_argv[0] = "cc";
+    link_argv[1] = "-Wno-unused-command-line-argument";
+    link_argv[2] = "-o";
+    link_argv[3] = (char *)out_filename;
+    memcpy(&link_argv[4], objects, sizeof(char *) * objects_len);
+    link_argv[objects_len + 4] = NULL;
+
+    status = exec_command(TRACE_CC, link_argv);
+    free(link_argv);
+  }
+
+  for (size_t i = 0; i < objects_len; i++)
+    free(objects[i]);
+
+  free(objects);
+  string_buffer_free(buf);
+
+  return status;
+}
+
+/* Runs `module` in a child process and returns its exit status. Server
+ * workers and --watch outlive the program, so an exit, a crash or anything
+ * else it does to its process must not reach them. */
+static int run_isolated(struct ir_module *module, bool jit) {
+  int64_t result;
   int status;
-  FILE *fptr;
-  char *src, *filename;
-  size_t filesize, filename_len;
+  pid_t pid;
+
+  fflush(NULL);
+  pid = fork();
 
-  printf("Jotunheim version: %s\n", JOTUNHEIM_VERSION);
+  if (pid == 0) {
+    if (jit)
+      status = jit_run_module(module, &result) ? (int)result : 1;
+    else
+      status = vm_run_module(module, &result) ? (int)result : 1;
 
-  if (argc < 2) {
-    fprintf(stderr, "Not enough arguments were supplied. Expected 1 got %d.\n", argc - 1);
+    fflush(NULL);
+    _exit(status);
+  } else if (pid < 0) {
+    fprintf(stderr, "Failed to start the program. %s\n", strerror(errno));
     return 1;
   }
 
-  filename = argv[1];
-  fptr = fopen(filename, "r");
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR)
+      return 1;
+  }
 
-  if (fptr == NULL) {
-    fprintf(stderr, "Failed to open file %s. %s\n", filename, strerror(errno));
-    return 1;
+  // Like a shell reports a program killed by a signal.
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+
+  return WEXITSTATUS(status);
+}
+
+static int compile_program(int argc, char *argv[], struct source_cache *cache) {
+  int status;
+  char *filename = NULL;
+  size_t filename_len, import_dirs_len = 0;
+  const char **import_dirs = malloc(sizeof(char *) * argc);
+  struct sources sources;
+  bool run = false, jit = false, use_cache = true, incremental = false;
+  struct cache_key tools_key = { 0 }, cache_key;
+  char opts[256];
+  int64_t result;
+  struct emit_options options = {
+    .keep_unused = false,
+    .inline_threshold = SIZE_MAX,
+    .tail_calls = false,
+    .report = false,
+  };
+  struct pass_options pass_options = {
+    .opt_level = 1,
+    .pipeline = NULL,
+    .verify = false,
+    .times = false,
+    .report = false,
+  };
+
+  // `jotunheim run file.jh` interprets the program instead of building it.
+  if (argc > 1 && strcmp(argv[1], "run") == 0)
+    run = true;
+
+  for (int i = run ? 2 : 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jit") == 0) {
+      run = jit = true;
+    } else if (strcmp(argv[i], "--incremental") == 0) {
+      incremental = true;
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      use_cache = false;
+    } else if (strcmp(argv[i], "--keep-unused") == 0) {
+      options.keep_unused = true;
+    } else if (strcmp(argv[i], "--opt-report") == 0) {
+      options.report = true;
+      pass_options.report = true;
+    } else if (strcmp(argv[i], "--verify-ir") == 0) {
+      pass_options.verify = true;
+    } else if (strcmp(argv[i], "--pass-times") == 0) {
+      pass_options.times = true;
+    } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+      options.inline_threshold = strtoul(argv[i] + 19, NULL, 10);
+    } else if (strncmp(argv[i], "--import-path=", 14) == 0) {
+      import_dirs[import_dirs_len++] = argv[i] + 14;
+    } else if (strncmp(argv[i], "--passes=", 9) == 0) {
+      pass_options.pipeline = argv[i] + 9;
+    } else if (strcmp(argv[i], "--time-report") == 0 || strncmp(argv[i], "--time-report=", 14) == 0
+      || strcmp(argv[i], "--perf-counters") == 0 || strcmp(argv[i], "--mem-report") == 0
+      || strncmp(argv[i], "--trace=", 8) == 0)
+    {
+      // Handled by compile.
+    } else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2' && argv[i][3] == 0) {
+      pass_options.opt_level = argv[i][2] - '0';
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option %s.\n", argv[i]);
+      free(import_dirs);
+      return 1;
+    } else if (filename == NULL) {
+      filename = argv[i];
+    } else {
+      fprintf(stderr, "Too many input files were supplied. Expected 1.\n");
+      free(import_dirs);
+      return 1;
+    }
   }
 
-  fseek(fptr, 0L, SEEK_END);
-  filesize = ftell(fptr);
-  fseek(fptr, 0L, SEEK_SET);
+  if (!run)
+    printf("Jotunheim version: %s\n", JOTUNHEIM_VERSION);
 
-  src = malloc(filesize + 1);
-  fread(src, sizeof(char), filesize, fptr);
-  src[filesize] = 0;
+  // Without an explicit threshold, only -O2 inlines anything but the
+  // smallest procedures.
+  if (options.inline_threshold == SIZE_MAX)
+    options.inline_threshold = inline_thresholds[pass_options.opt_level];
 
-  fclose(fptr);
+  options.tail_calls = pass_options.opt_level > 0;
 
-  struct lexer lex = lexer_new(src);
-  struct arena *arena = arena_new();
-  struct parser parser = parser_new(arena, &lex);
-  struct ast ast;
+  if (filename == NULL) {
+    fprintf(stderr, "Not enough arguments were supplied. Expected an input file.\n");
+    free(import_dirs);
+    return 1;
+  }
 
-  if (!parser_parse_ast(&parser, &ast)) {
-    arena_free(arena);
-    free(ast.consts);
-    free(src);
+  // Files that don't depend on each other are parsed in parallel.
+  if (!sources_load(&sources, filename, import_dirs_len, import_dirs, sysconf(_SC_NPROCESSORS_ONLN), cache)) {
+    sources_free(&sources);
+    free(import_dirs);
 
     return 1;
   }
 
-  struct string_buffer *buf = string_buffer_new();
+  free(import_dirs);
 
-  if (!emit_ast(buf, src, &ast)) {
-    string_buffer_free(buf);
-    arena_free(arena);
-    free(ast.consts);
-    free(src);
+  // Nothing more is allocated in the parse arenas once every file is parsed.
+  for (size_t i = 0; i < sources.files_len && mem_active(); i++)
+    mem_arena(sources.files[i]->path, sources.files[i]->parse->arena);
+
+  char *out_filename, *last_slash, *last_dot;
+
+  last_slash = strrchr(filename, '/');
+  last_dot = strrchr(filename, '.');
+
+  filename_len = last_dot > last_slash ? last_dot - filename : strlen(filename);
+
+  out_filename = malloc(filename_len + 1);
+  memcpy(out_filename, filename, filename_len);
+  out_filename[filename_len] = 0;
+
+  // Reports and verification have to run the pipeline, so they skip the
+  // cache.
+  use_cache = use_cache && !run && !options.report && !pass_options.verify && !pass_options.times
+    && !trace_active();
+
+  if (!run && (use_cache || incremental)) {
+    cache_key_add_string(&tools_key, JOTUNHEIM_VERSION);
+    cache_key_add_self(&tools_key);
+    cache_key_add_tool(&tools_key, "qbe");
+    cache_key_add_tool(&tools_key, "cc");
+  }
+
+  if (use_cache) {
+    snprintf(opts, sizeof(opts), "-O%d %d %zu %s", pass_options.opt_level,
+      options.keep_unused, options.inline_threshold,
+      pass_options.pipeline != NULL ? pass_options.pipeline : "");
+
+    cache_key = tools_key;
+    cache_key_add_string(&cache_key, opts);
+
+    for (size_t i = 0; i < sources.files_len; i++)
+      cache_key_add(&cache_key, sources.files[i]->parse->src, sources.files[i]->parse->src_len + 1);
+
+    if (cache_fetch(&cache_key, out_filename)) {
+      free(out_filename);
+      sources_free(&sources);
+
+      return 0;
+    }
+  }
+
+  struct ir_module *module = ir_module_new();
+  struct trace_mark mark = trace_mark();
+  size_t heap = trace_heap();
+  bool ok = emit_ast(module, &sources.ast, &options);
+
+  trace_span(TRACE_EMIT, 0, NULL, mark, trace_heap_since(heap));
+
+  if (ok && trace_active())
+    trace_items(TRACE_EMIT, ir_module_insts(module));
+
+  if (ok) {
+    mark = trace_mark();
+    heap = trace_heap();
+    ok = pass_run_pipeline(module, &pass_options);
+    trace_span(TRACE_PASSES, 0, NULL, mark, trace_heap_since(heap));
+  }
+
+  if (!ok) {
+    ir_module_free(module);
+    free(out_filename);
+    sources_free(&sources);
 
     return 1;
   }
 
-  // printf("Ast used %zu bytes\n", arena_used(arena));
+  if (run) {
+    mark = trace_mark();
+
+    if (cache != NULL)
+      status = run_isolated(module, jit);
+    else if (jit)
+      status = jit_run_module(module, &result) ? (int)result : 1;
+    else
+      status = vm_run_module(module, &result) ? (int)result : 1;
+
+    trace_span(TRACE_RUN, 0, NULL, mark, 0);
+
+    ir_module_free(module);
+    free(out_filename);
+    sources_free(&sources);
+
+    return status;
+  }
+
+  if (incremental) {
+    status = build_incremental(module, &tools_key, out_filename);
+
+    if (status == 0 && use_cache)
+      cache_store_executable(&cache_key, out_filename);
+
+    ir_module_free(module);
+    free(out_filename);
+    sources_free(&sources);
+
+    return status == 0 ? 0 : 1;
+  }
+
+  mark = trace_mark();
+
+  struct string_buffer *buf = string_buffer_new();
+  qbe_emit_module(buf, module);
+  ir_module_free(module);
 
   FILE *ssa_fptr;
-  // char ssa_filename[] = "/tmp/jotunheim-XXXXXX.ssa";
-  char ssa_filename[] = "jotunheim.ssa";
-  // ssa_fptr = fdopen(mkstemps(ssa_filename, 4), "w");
+  char ssa_filename[64], s_filename[64];
+
+  build_path(ssa_filename, "ssa");
+  build_path(s_filename, "s");
   ssa_fptr = fopen(ssa_filename, "w");
 
+  if (ssa_fptr == NULL) {
+    fprintf(stderr, "Failed to open file %s. %s\n", ssa_filename, strerror(errno));
+    string_buffer_free(buf);
+    sources_free(&sources);
+    free(out_filename);
+
+    return 1;
+  }
+
   string_buffer_dump_to_file(buf, ssa_fptr);
 
   fclose(ssa_fptr);
 
-  string_buffer_free(buf);
-  arena_free(arena);
-  free(ast.consts);
-  free(src);
+  size_t ssa_len;
+  string_buffer_chars(buf, &ssa_len);
+  trace_span(TRACE_SSA, 0, NULL, mark, ssa_len);
+  trace_items(TRACE_SSA, ssa_len);
 
-  // char s_filename[] = "/tmp/jotunheim-XXXXXX.s";
-  char s_filename[] = "jotunheim.s";
-  close(mkstemps(s_filename, 2));
+  string_buffer_free(buf);
+  sources_free(&sources);
 
-  status = exec_command((char *[]) {
+  status = exec_command(TRACE_QBE, (char *[]) {
     "qbe",
     "-o",
     s_filename,
@@ -117,25 +453,15 @@ int main(int argc, char *argv[]) {
     NULL,
   });
 
-  // unlink(ssa_filename);
+  unlink(ssa_filename);
 
   if (status != 0) {
     unlink(s_filename);
+    free(out_filename);
     return 1;
   }
 
-  char *out_filename, *last_slash, *last_dot;
-
-  last_slash = strrchr(filename, '/');
-  last_dot = strrchr(filename, '.');
-
-  filename_len = last_dot > last_slash ? last_dot - filename : strlen(filename);
-
-  out_filename = malloc(filename_len + 1);
-  strcpy(out_filename, filename);
-  out_filename[filename_len] = 0;
-
-  status = exec_command((char *[]) {
+  status = exec_command(TRACE_CC, (char *[]) {
     "cc",
     "-Wno-unused-command-line-argument",
     "-o",
@@ -144,7 +470,11 @@ int main(int argc, char *argv[]) {
     NULL,
   });
 
-  // unlink(s_filename);
+  unlink(s_filename);
+
+  if (status == 0 && use_cache)
+    cache_store_executable(&cache_key, out_filename);
+
   free(out_filename);
 
   if (status != 0)
@@ -152,3 +482,87 @@ int main(int argc, char *argv[]) {
 
   return 0;
 }
+
+/* Compiles like compile_program, timing the compile if asked to. */
+static int compile(int argc, char *argv[], struct source_cache *cache) {
+  const char *report_path = NULL, *trace_path = NULL;
+  bool report = false, counters = false, mem = false;
+  int status;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--time-report") == 0)
+      report = true;
+    else if (strncmp(argv[i], "--time-report=", 14) == 0)
+      report_path = argv[i] + 14;
+    else if (strcmp(argv[i], "--perf-counters") == 0)
+      counters = true;
+    else if (strcmp(argv[i], "--mem-report") == 0)
+      mem = true;
+    else if (strncmp(argv[i], "--trace=", 8) == 0)
+      trace_path = argv[i] + 8;
+  }
+
+  if (!report && !counters && !mem && report_path == NULL && trace_path == NULL)
+    return compile_program(argc, argv, cache);
+
+  trace_start(counters);
+
+  if (mem)
+    mem_start();
+
+  status = compile_program(argc, argv, cache);
+
+  if (!trace_finish(report, report_path, trace_path) && status == 0)
+    status = 1;
+
+  if (mem) {
+    fprintf(stderr, "\n");
+    mem_finish();
+  }
+
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  size_t workers = sysconf(_SC_NPROCESSORS_ONLN);
+  char *socket_path;
+  int status;
+
+  // `jotunheim --server` stays resident and compiles for `jotunheim --connect
+  // ...`, which takes the same arguments as a normal compile.
+  if (argc > 1 && (strcmp(argv[1], "--server") == 0 || strcmp(argv[1], "--connect") == 0)) {
+    socket_path = server_socket_path();
+
+    if (socket_path == NULL)
+      return 1;
+
+    if (strcmp(argv[1], "--connect") == 0) {
+      argv[1] = argv[0];
+      status = server_request(socket_path, argc - 1, argv + 1);
+    } else {
+      for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--workers=", 10) == 0 && atoi(argv[i] + 10) > 0) {
+          workers = atoi(argv[i] + 10);
+        } else {
+          fprintf(stderr, "Unknown option %s.\n", argv[i]);
+          free(socket_path);
+          return 1;
+        }
+      }
+
+      status = server_run(socket_path, workers, compile) ? 0 : 1;
+    }
+
+    free(socket_path);
+
+    return status;
+  }
+
+  // `jotunheim --watch ...` compiles again whenever an input changes.
+  if (argc > 1 && strcmp(argv[1], "--watch") == 0) {
+    argv[1] = argv[0];
+    return watch_run(argc - 1, argv + 1, compile);
+  }
+
+  return compile(argc, argv, NULL);
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -13,11 +14,13 @@ static const char *token_type_strings[] = {
   "",
   "identifier",
   "integer", "string",
-  "'::'", "':='",
+  "directive",
+  "'::'", "':='", "':'",
   "'='",
   "';'",
   "','",
   "'('", "')'", "'{'", "'}'",
+  "'->'", "'..'",
   "'=='", "'!='",
   "'>'", "'<'", "'>='", "'<='",
   "'|'", "'^'", "'&'",
@@ -54,7 +57,7 @@ struct lexer lexer_new(const char *src) {
   return l;
 }
 
-static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
+static bool lexer_lex(struct lexer *lex, struct token *tk) {
   /* Skip whitepscae. */
   while (isspace(*lex->loc)) {
     lex->loc++;
@@ -109,6 +112,19 @@ static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
     return true;
   }
 
+  /* Is token a directive? e.g. #export */
+  if (*lex->loc == '#' && (isalpha(lex->loc[1]) || lex->loc[1] == '_')) {
+    lex->loc++;
+
+    while (isalnum(*lex->loc) || *lex->loc == '_') {
+      lex->loc++;
+    }
+
+    tk->len = lex->loc - tk->loc;
+    tk->type = TT_DIRECTIVE;
+    return true;
+  }
+
   tk->len = 1;
 
   /* Token is something else. */
@@ -129,11 +145,9 @@ static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
       } else if (*lex->loc == '=') {
         tk->type = TT_COLON_EQUALS;
       } else {
-        fprint_error(stderr, "use of invalid token");
-        fprint_error_ctx(stderr, lex->src, 1, 0, 2, tk->loc, "here");
-        fprint_help(stderr, "perhaps you meant to use '::' or ':='");
-
-        return false;
+        tk->type = TT_SINGLE_COLON;
+        tk->len = 1;
+        break;
       }
 
       tk->len = 2;
@@ -168,6 +182,10 @@ static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
         lex->loc++;
         tk->type = TT_LTE;
         tk->len = 2;
+      } else if (*lex->loc == '<') {
+        lex->loc++;
+        tk->type = TT_SHL;
+        tk->len = 2;
       } else {
         tk->type = TT_LT;
       }
@@ -178,11 +196,28 @@ static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
         lex->loc++;
         tk->type = TT_GTE;
         tk->len = 2;
+      } else if (*lex->loc == '>') {
+        lex->loc++;
+        tk->type = TT_SHR;
+        tk->len = 2;
       } else {
         tk->type = TT_GT;
       }
     } break;
 
+    case '.': {
+      if (*(lex->loc++) != '.') {
+        fprint_error(stderr, "use of invalid token");
+        fprint_error_ctx(stderr, lex->src, 1, 0, 2, tk->loc, "here");
+        fprint_help(stderr, "perhaps you meant to use '..'");
+
+        return false;
+      }
+
+      tk->type = TT_ELLIPSIS;
+      tk->len = 2;
+    } break;
+
     case ';': { tk->type = TT_SEMI_COLON; } break;
     case ',': { tk->type = TT_COLON; } break;
     case '(': { tk->type = TT_L_BRACKET; } break;
@@ -191,8 +226,22 @@ static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
     case '}': { tk->type = TT_R_CURLY; } break;
 
     case '+': { tk->type = TT_ADD; } break;
-    case '-': { tk->type = TT_SUB; } break;
+    case '-': {
+      if (*lex->loc == '>') {
+        lex->loc++;
+        tk->type = TT_ARROW;
+        tk->len = 2;
+      } else {
+        tk->type = TT_SUB;
+      }
+    } break;
     case '*': { tk->type = TT_MUL; } break;
+    case '/': { tk->type = TT_DIV; } break;
+    case '%': { tk->type = TT_MOD; } break;
+
+    case '|': { tk->type = TT_BOR; } break;
+    case '^': { tk->type = TT_BXOR; } break;
+    case '&': { tk->type = TT_BAND; } break;
 
     default: {
       fprint_error(stderr, "use of invalid token");
@@ -206,6 +255,43 @@ static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
   return true;
 }
 
+static bool lexer_next_no_peek(struct lexer *lex, struct token *tk) {
+  if (lex->tokens == NULL)
+    return lexer_lex(lex, tk);
+
+  *tk = lex->tokens[lex->tokens_next];
+
+  if (lex->tokens_next == lex->tokens_len - 1)
+    return false;
+
+  lex->tokens_next++;
+
+  return true;
+}
+
+void lexer_lex_all(struct lexer *lex) {
+  size_t tokens_cap = 256;
+
+  lex->tokens = malloc(sizeof(struct token) * tokens_cap);
+  lex->tokens_len = 0;
+  lex->tokens_next = 0;
+
+  while (true) {
+    if (lex->tokens_len >= tokens_cap) {
+      tokens_cap *= 2;
+      lex->tokens = realloc(lex->tokens, sizeof(struct token) * tokens_cap);
+    }
+
+    if (!lexer_lex(lex, &lex->tokens[lex->tokens_len++]))
+      break;
+  }
+}
+
+void lexer_free(struct lexer *lex) {
+  free(lex->tokens);
+  lex->tokens = NULL;
+}
+
 static bool lexer_next_no_history(struct lexer *lex, struct token *tk) {
   /* Token was previously peeked. */
   if (lex->num_peeked > 0) {
@@ -17,8 +17,10 @@ typedef enum {
   TT_IDENT,
   TT_INTEGER,
   TT_STRING,
+  TT_DIRECTIVE,
   TT_DOUBLE_COLON,
   TT_COLON_EQUALS,
+  TT_SINGLE_COLON,
   TT_EQUALS,
   TT_SEMI_COLON,
   TT_COLON,
@@ -26,6 +28,8 @@ typedef enum {
   TT_R_BRACKET,
   TT_L_CURLY,
   TT_R_CURLY,
+  TT_ARROW,
+  TT_ELLIPSIS,
 
   /* Operators */
   TT_EQ, TT_NEQ,
@@ -64,9 +68,18 @@ struct lexer {
   size_t num_peeked;
   struct token peeked[2];
   struct token history[2];
+
+  /* Set by lexer_lex_all, the tokens to hand out instead of lexing. The
+   * last one is where lexing stopped, at the end or at an error. */
+  struct token *tokens;
+  size_t tokens_len, tokens_next;
 };
 
 struct lexer lexer_new(const char *src);
+/* Lexes all of `src` up front, so lexing can be timed apart from parsing.
+ * The lexer behaves the same afterwards, errors included. */
+void lexer_lex_all(struct lexer *lex);
+void lexer_free(struct lexer *lex);
 
 bool lexer_next(struct lexer *lex, struct token *tk);
 bool lexer_peek(struct lexer *lex, struct token *tk);
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+
+#include "mem.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define MEM_REPORT_ARENAS 10
+
+/* Sizes are what malloc_usable_size says, so frees can be counted without
+ * remembering every allocation. */
+struct mem_site_stats {
+  uint64_t allocs, reallocs, frees, bytes;
+  int64_t live, peak;
+};
+
+struct mem_node_stats {
+  uint64_t count, bytes;
+};
+
+struct mem_arena_stats {
+  char *name;
+  size_t regions, used, capacity;
+  /* What is left at the end of every region but the last one in use,
+   * allocations which didn't fit went to the next region. */
+  size_t tail;
+};
+
+static const char *mem_site_names[] = {
+  [MEM_VECTOR] = "vector",
+  [MEM_HASHMAP] = "hashmap",
+  [MEM_STRING_BUFFER] = "string_buffer",
+  [MEM_EMIT] = "emit",
+};
+
+static const char *mem_node_names[] = {
+  [MEM_NODE_EXPR] = "ast_expr",
+  [MEM_NODE_STMT] = "ast_stmt",
+  [MEM_NODE_IF] = "ast_if",
+  [MEM_NODE_IF_BRANCH] = "ast_if_branch",
+  [MEM_NODE_FN_CALL] = "ast_fn_call",
+  [MEM_NODE_ASSIGN] = "ast_assign",
+  [MEM_NODE_PARAM] = "ast_param",
+  [MEM_NODE_LIST] = "pointer lists",
+};
+
+static struct {
+  bool active;
+  struct mem_site_stats sites[MEM_SITES_LEN];
+  struct mem_node_stats nodes[MEM_NODES_LEN];
+  pthread_mutex_t lock;
+  size_t arenas_len, arenas_cap;
+  struct mem_arena_stats *arenas;
+} mem = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct mem_sample mem_thread;
+
+static void mem_clear() {
+  for (size_t i = 0; i < mem.arenas_len; i++)
+    free(mem.arenas[i].name);
+
+  free(mem.arenas);
+  mem.arenas = NULL;
+  mem.arenas_len = mem.arenas_cap = 0;
+  memset(mem.sites, 0, sizeof(mem.sites));
+  memset(mem.nodes, 0, sizeof(mem.nodes));
+}
+
+void mem_start() {
+  mem_clear();
+  mem.active = true;
+}
+
+bool mem_active() {
+  return mem.active;
+}
+
+void mem_read(struct mem_sample *sample) {
+  *sample = mem_thread;
+}
+
+/* Adds `delta` live bytes to `site`, keeping track of the most there were. */
+static void mem_count_live(struct mem_site_stats *stats, int64_t delta) {
+  int64_t live = __atomic_add_fetch(&stats->live, delta, __ATOMIC_RELAXED);
+  int64_t peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+
+  while (live > peak && !__atomic_compare_exchange_n(&stats->peak, &peak, live, true,
+    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+void *mem_malloc(enum mem_site site, size_t size) {
+  struct mem_site_stats *stats = &mem.sites[site];
+  void *ptr = malloc(size);
+
+  if (!mem.active || ptr == NULL)
+    return ptr;
+
+  size = malloc_usable_size(ptr);
+  mem_thread.allocs++;
+  mem_thread.bytes += size;
+  __atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+  mem_count_live(stats, size);
+
+  return ptr;
+}
+
+void *mem_realloc(enum mem_site site, void *ptr, size_t size) {
+  struct mem_site_stats *stats = &mem.sites[site];
+  size_t old;
+
+  if (!mem.active)
+    return realloc(ptr, size);
+
+  old = ptr != NULL ? malloc_usable_size(ptr) : 0;
+  ptr = realloc(ptr, size);
+
+  if (ptr == NULL)
+    return NULL;
+
+  size = malloc_usable_size(ptr);
+  mem_thread.allocs++;
+  mem_thread.bytes += size;
+  __atomic_add_fetch(&stats->reallocs, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+  mem_count_live(stats, (int64_t)size - (int64_t)old);
+
+  return ptr;
+}
+
+void mem_free(enum mem_site site, void *ptr) {
+  struct mem_site_stats *stats = &mem.sites[site];
+
+  if (mem.active && ptr != NULL) {
+    __atomic_add_fetch(&stats->frees, 1, __ATOMIC_RELAXED);
+    mem_count_live(stats, -(int64_t)malloc_usable_size(ptr));
+  }
+
+  free(ptr);
+}
+
+void mem_disown(enum mem_site site, void *ptr) {
+  if (mem.active && ptr != NULL)
+    mem_count_live(&mem.sites[site], -(int64_t)malloc_usable_size(ptr));
+}
+
+void *mem_hashmap_malloc(size_t size) {
+  return mem_malloc(MEM_HASHMAP, size);
+}
+
+void *mem_hashmap_realloc(void *ptr, size_t size) {
+  return mem_realloc(MEM_HASHMAP, ptr, size);
+}
+
+void mem_hashmap_free(void *ptr) {
+  mem_free(MEM_HASHMAP, ptr);
+}
+
+void *mem_arena_alloc(struct arena *arena, enum mem_node kind, size_t size) {
+  if (mem.active) {
+    mem_thread.allocs++;
+    mem_thread.bytes += size;
+    __atomic_add_fetch(&mem.nodes[kind].count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mem.nodes[kind].bytes, size, __ATOMIC_RELAXED);
+  }
+
+  return arena_alloc(arena, size);
+}
+
+void mem_arena(const char *name, struct arena *arena) {
+  struct mem_arena_stats stats = { 0 };
+  size_t *used, *capacity, last = 0;
+
+  if (!mem.active)
+    return;
+
+  stats.regions = arena_regions(arena, NULL, NULL, 0);
+  used = malloc(sizeof(size_t) * (stats.regions + 1));
+  capacity = malloc(sizeof(size_t) * (stats.regions + 1));
+  arena_regions(arena, used, capacity, stats.regions);
+
+  for (size_t i = 0; i < stats.regions; i++) {
+    stats.used += used[i];
+    stats.capacity += capacity[i];
+
+    if (used[i] > 0)
+      last = i;
+  }
+
+  for (size_t i = 0; i < last; i++)
+    stats.tail += capacity[i] - used[i];
+
+  free(capacity);
+  free(used);
+
+  stats.name = strdup(name);
+
+  pthread_mutex_lock(&mem.lock);
+
+  if (mem.arenas_len >= mem.arenas_cap) {
+    mem.arenas_cap = mem.arenas_cap == 0 ? 16 : mem.arenas_cap * 2;
+    mem.arenas = realloc(mem.arenas, sizeof(struct mem_arena_stats) * mem.arenas_cap);
+  }
+
+  mem.arenas[mem.arenas_len++] = stats;
+
+  pthread_mutex_unlock(&mem.lock);
+}
+
+void mem_finish() {
+  struct mem_site_stats *site;
+  struct mem_arena_stats *arena, total = { 0 };
+  struct rusage usage;
+
+  mem.active = false;
+  getrusage(RUSAGE_SELF, &usage);
+
+  fprintf(stderr, "Peak RSS: %ld KiB\n\n", usage.ru_maxrss);
+
+  fprintf(stderr, "%-16s %10s %10s %10s %12s %12s\n", "malloc", "allocs", "reallocs",
+    "frees", "bytes", "peak bytes");
+
+  for (size_t i = 0; i < MEM_SITES_LEN; i++) {
+    site = &mem.sites[i];
+    fprintf(stderr, "%-16s %10lu %10lu %10lu %12lu %12ld\n", mem_site_names[i],
+      site->allocs, site->reallocs, site->frees, site->bytes, site->peak);
+  }
+
+  fprintf(stderr, "\n%-16s %10s %12s\n", "node", "count", "bytes");
+
+  for (size_t i = 0; i < MEM_NODES_LEN; i++) {
+    fprintf(stderr, "%-16s %10lu %12lu\n", mem_node_names[i],
+      mem.nodes[i].count, mem.nodes[i].bytes);
+  }
+
+  if (mem.arenas_len > 0) {
+    fprintf(stderr, "\n%-32s %8s %12s %12s %12s\n", "arena", "regions", "used",
+      "capacity", "tail waste");
+  }
+
+  for (size_t i = 0; i < mem.arenas_len; i++) {
+    arena = &mem.arenas[i];
+    total.regions += arena->regions;
+    total.used += arena->used;
+    total.capacity += arena->capacity;
+    total.tail += arena->tail;
+
+    if (i < MEM_REPORT_ARENAS) {
+      fprintf(stderr, "%-32s %8zu %12zu %12zu %12zu\n", arena->name, arena->regions,
+        arena->used, arena->capacity, arena->tail);
+    }
+  }
+
+  if (mem.arenas_len > MEM_REPORT_ARENAS)
+    fprintf(stderr, "... and %zu more\n", mem.arenas_len - MEM_REPORT_ARENAS);
+
+  if (mem.arenas_len > 1) {
+    fprintf(stderr, "%-32s %8zu %12zu %12zu %12zu\n", "total", total.regions,
+      total.used, total.capacity, total.tail);
+  }
+
+  mem_clear();
+}
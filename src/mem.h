@@ -0,0 +1,66 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/* Allocation accounting for --mem-report. Counted allocations still come
+ * from malloc and the arenas, but while a report is being collected they
+ * are also added up by what made them. */
+enum mem_site {
+  MEM_VECTOR,
+  MEM_HASHMAP,
+  MEM_STRING_BUFFER,
+  MEM_EMIT,
+  MEM_SITES_LEN,
+};
+
+/* What the parser allocates in its arena. */
+enum mem_node {
+  MEM_NODE_EXPR,
+  MEM_NODE_STMT,
+  MEM_NODE_IF,
+  MEM_NODE_IF_BRANCH,
+  MEM_NODE_FN_CALL,
+  MEM_NODE_ASSIGN,
+  MEM_NODE_PARAM,
+  /* Arrays of pointers to statements or arguments. */
+  MEM_NODE_LIST,
+  MEM_NODES_LEN,
+};
+
+/* The allocations made on one thread. */
+struct mem_sample {
+  uint64_t allocs;
+  uint64_t bytes;
+};
+
+void mem_start();
+/* Prints the report to stderr and stops counting. */
+void mem_finish();
+bool mem_active();
+
+void *mem_malloc(enum mem_site site, size_t size);
+void *mem_realloc(enum mem_site site, void *ptr, size_t size);
+void mem_free(enum mem_site site, void *ptr);
+/* Stops counting `ptr` as part of `site`, for memory handed to code which
+ * frees it with plain free. */
+void mem_disown(enum mem_site site, void *ptr);
+
+/* For hashmap_new_with_allocator, counted as MEM_HASHMAP. */
+void *mem_hashmap_malloc(size_t size);
+void *mem_hashmap_realloc(void *ptr, size_t size);
+void mem_hashmap_free(void *ptr);
+
+/* arena_alloc, counting `size` bytes as nodes of `kind`. */
+void *mem_arena_alloc(struct arena *arena, enum mem_node kind, size_t size);
+/* Notes how full the regions of `arena` are, once nothing more is going to
+ * be allocated in it. */
+void mem_arena(const char *name, struct arena *arena);
+
+void mem_read(struct mem_sample *sample);
+
+#endif /* MEM_H */
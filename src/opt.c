@@ -0,0 +1,716 @@
+#include "opt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+#include "ir.h"
+#include "mem.h"
+
+bool opt_fold_operation(ir_op op, ir_type type, ir_type arg_type, int64_t lhs, int64_t rhs, int64_t *result) {
+  bool word = (ir_op_is_comparison(op) ? arg_type : type) == IR_TYPE_W;
+  int shift_mask = word ? 31 : 63;
+  uint64_t ulhs, urhs;
+
+  // Word operations only see the lower 32 bits of their operands.
+  if (word) {
+    lhs = (int32_t)lhs;
+    rhs = (int32_t)rhs;
+  }
+
+  ulhs = word ? (uint32_t)lhs : (uint64_t)lhs;
+  urhs = word ? (uint32_t)rhs : (uint64_t)rhs;
+
+  switch (op) {
+    case IR_COPY: *result = lhs; break;
+    case IR_CEQ: *result = lhs == rhs; break;
+    case IR_CNE: *result = lhs != rhs; break;
+    case IR_CSGT: *result = lhs > rhs; break;
+    case IR_CSLT: *result = lhs < rhs; break;
+    case IR_CSGE: *result = lhs >= rhs; break;
+    case IR_CSLE: *result = lhs <= rhs; break;
+    case IR_CUGT: *result = ulhs > urhs; break;
+    case IR_CULT: *result = ulhs < urhs; break;
+    case IR_CUGE: *result = ulhs >= urhs; break;
+    case IR_CULE: *result = ulhs <= urhs; break;
+    case IR_OR: *result = lhs | rhs; break;
+    case IR_XOR: *result = lhs ^ rhs; break;
+    case IR_AND: *result = lhs & rhs; break;
+    case IR_SHL: *result = (int64_t)((uint64_t)lhs << (rhs & shift_mask)); break;
+    case IR_SHR: *result = (int64_t)(ulhs >> (rhs & shift_mask)); break;
+    case IR_SAR: *result = lhs >> (rhs & shift_mask); break;
+    case IR_ADD: *result = (int64_t)((uint64_t)lhs + (uint64_t)rhs); break;
+    case IR_SUB: *result = (int64_t)((uint64_t)lhs - (uint64_t)rhs); break;
+    case IR_MUL: *result = (int64_t)((uint64_t)lhs * (uint64_t)rhs); break;
+    case IR_NEG: *result = (int64_t)(-(uint64_t)lhs); break;
+    case IR_EXTSB: *result = (int8_t)lhs; break;
+    case IR_EXTUB: *result = (uint8_t)lhs; break;
+    case IR_EXTSH: *result = (int16_t)lhs; break;
+    case IR_EXTUH: *result = (uint16_t)lhs; break;
+    case IR_EXTSW: *result = (int32_t)lhs; break;
+    case IR_EXTUW: *result = (uint32_t)lhs; break;
+
+    case IR_DIV:
+    case IR_REM: {
+      if (rhs == 0 || (lhs == (word ? INT32_MIN : INT64_MIN) && rhs == -1))
+        return false;
+
+      *result = op == IR_DIV ? lhs / rhs : lhs % rhs;
+    } break;
+
+    case IR_UDIV:
+    case IR_UREM: {
+      if (urhs == 0)
+        return false;
+
+      *result = (int64_t)(op == IR_UDIV ? ulhs / urhs : ulhs % urhs);
+    } break;
+
+    default:
+      return false;
+  }
+
+  if (type == IR_TYPE_W)
+    *result = (int32_t)*result;
+
+  return true;
+}
+
+static void replace_value(struct ir_value *value, struct ir_value *map) {
+  while (value->kind == IR_VALUE_TEMP && map[value->as.temp].kind != IR_VALUE_NONE)
+    *value = map[value->as.temp];
+}
+
+/* Applies the replacements found so far to `inst`, so that it can be
+ * matched against earlier instructions. */
+static void replace_args(struct ir_inst *inst, struct ir_value *map) {
+  replace_value(&inst->args[0], map);
+  replace_value(&inst->args[1], map);
+
+  for (size_t i = 0; i < inst->call_args_len; i++)
+    replace_value(&inst->call_args[i], map);
+}
+
+/* Constant folding: evaluates pure instructions whose operands are all
+ * constants, and propagates the result and copied global addresses to the
+ * uses. */
+size_t opt_fold(struct ir_module *module, struct ir_proc *proc) {
+  struct ir_block *block;
+  struct ir_inst *inst;
+  struct ir_value *map = calloc(proc->temps_len + 1, sizeof(struct ir_value));
+  size_t folded = 0, len;
+  int64_t result;
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+    len = 0;
+
+    for (size_t j = 0; j < block->insts_len; j++) {
+      inst = &block->insts[j];
+      replace_args(inst, map);
+
+      if (ir_op_is_pure(inst->op) && inst->args[0].kind == IR_VALUE_CONST
+        && (ir_op_is_unary(inst->op) || inst->args[1].kind == IR_VALUE_CONST)
+        && opt_fold_operation(inst->op, inst->type, inst->arg_type,
+          inst->args[0].as.integer, inst->args[1].as.integer, &result))
+      {
+        map[inst->dest] = ir_value_const(result);
+        folded++;
+
+        continue;
+      }
+
+      // Copies of a global address are propagated so that calls through
+      // them become direct calls.
+      if (inst->op == IR_COPY && inst->args[0].kind == IR_VALUE_GLOBAL) {
+        map[inst->dest] = inst->args[0];
+        folded++;
+
+        continue;
+      }
+
+      block->insts[len++] = *inst;
+    }
+
+    block->insts_len = len;
+    replace_value(&block->jump.arg, map);
+  }
+
+  ir_proc_replace_temps(proc, map);
+  free(map);
+
+  return folded;
+}
+
+/* A pure computation, or a load, within the current basic block. */
+struct value {
+  ir_op op;
+  ir_type type, arg_type;
+  struct ir_value args[2];
+
+  /* Loads are only valid in the memory epoch they were made in. */
+  size_t epoch;
+  struct ir_value result;
+};
+
+static uint64_t ir_value_hash(const struct ir_value *v, uint64_t seed0, uint64_t seed1) {
+  uint64_t words[2] = { v->kind, 0 };
+
+  switch (v->kind) {
+    case IR_VALUE_NONE: break;
+    case IR_VALUE_TEMP: words[1] = v->as.temp; break;
+    case IR_VALUE_CONST: words[1] = (uint64_t)v->as.integer; break;
+    case IR_VALUE_GLOBAL:
+      return hashmap_sip(v->as.global.chars, v->as.global.len, seed0 + v->kind, seed1);
+  }
+
+  return hashmap_sip(words, sizeof(words), seed0, seed1);
+}
+
+static uint64_t value_hash(const struct value *v, uint64_t seed0, uint64_t seed1) {
+  uint64_t lhs = ir_value_hash(&v->args[0], seed0, seed1);
+  uint64_t rhs = ir_value_hash(&v->args[1], seed0, seed1);
+
+  return (lhs * 31 + (v->op << 8 | v->type << 4 | v->arg_type)) ^ ((rhs << 17) | (rhs >> 47));
+}
+
+static int value_compare(const struct value *a, const struct value *b, void *udata) {
+  int diff = a->op - b->op;
+
+  if (diff == 0)
+    diff = a->type - b->type;
+
+  if (diff == 0)
+    diff = a->arg_type - b->arg_type;
+
+  if (diff != 0)
+    return diff;
+
+  diff = ir_value_compare((struct ir_value *)&a->args[0], (struct ir_value *)&b->args[0]);
+
+  if (diff != 0)
+    return diff;
+
+  return ir_value_compare((struct ir_value *)&a->args[1], (struct ir_value *)&b->args[1]);
+}
+
+/* Local value numbering: within each basic block, a pure instruction which
+ * recomputes an existing value is removed and its uses replaced. Temporaries
+ * are only assigned once, so they double as value numbers. Loads are
+ * numbered too, and a store makes the stored value the slot's current value.
+ * Calls may write to memory, so they start a new memory epoch. */
+size_t opt_value_numbering(struct ir_module *module, struct ir_proc *proc) {
+  struct ir_block *block;
+  struct ir_inst *inst;
+  struct ir_value *map = calloc(proc->temps_len + 1, sizeof(struct ir_value));
+  bool *is_slot = calloc(proc->temps_len + 1, sizeof(bool));
+  struct value v;
+  const struct value *found;
+  size_t eliminated = 0, epoch = 0, len;
+  struct hashmap *values = hashmap_new_with_allocator(mem_hashmap_malloc, mem_hashmap_realloc,
+    mem_hashmap_free, sizeof(struct value), 16, 0, 0,
+    (uint64_t(*)(const void *, uint64_t, uint64_t))value_hash,
+    (int(*)(const void *, const void *, void *))value_compare,
+    NULL, NULL);
+
+  // Stack slots never alias each other.
+  for (size_t j = 0; j < proc->blocks[0]->insts_len; j++) {
+    inst = &proc->blocks[0]->insts[j];
+
+    if (inst->op == IR_ALLOC)
+      is_slot[inst->dest] = true;
+  }
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+    len = 0;
+
+    hashmap_clear(values, false);
+
+    for (size_t j = 0; j < block->insts_len; j++) {
+      inst = &block->insts[j];
+      replace_args(inst, map);
+
+      if (ir_op_is_pure(inst->op) || inst->op == IR_LOAD) {
+        v = (struct value) {
+          .op = inst->op,
+          .type = inst->type,
+          .arg_type = inst->arg_type,
+          .args = { inst->args[0], inst->args[1] },
+          .epoch = epoch,
+          .result = ir_value_temp(inst->dest),
+        };
+
+        if (ir_op_is_commutative(inst->op) && ir_value_compare(&v.args[0], &v.args[1]) > 0) {
+          v.args[0] = inst->args[1];
+          v.args[1] = inst->args[0];
+        }
+
+        found = hashmap_get(values, &v);
+
+        if (found != NULL && (found->op != IR_LOAD || found->epoch == epoch)) {
+          map[inst->dest] = found->result;
+          eliminated++;
+
+          continue;
+        }
+
+        hashmap_set(values, &v);
+      } else if (inst->op == IR_STORE) {
+        if (inst->args[1].kind == IR_VALUE_TEMP && is_slot[inst->args[1].as.temp]) {
+          // The slot's loads have the class of the value stored to it.
+          v = (struct value) {
+            .op = IR_LOAD,
+            .type = inst->arg_type == IR_TYPE_L ? IR_TYPE_L : IR_TYPE_W,
+            .arg_type = inst->arg_type,
+            .args = { inst->args[1], ir_value_none() },
+            .epoch = epoch,
+            .result = inst->args[0],
+          };
+
+          hashmap_set(values, &v);
+        } else {
+          epoch++;
+        }
+      } else if (inst->op == IR_CALL) {
+        epoch++;
+      }
+
+      block->insts[len++] = *inst;
+    }
+
+    block->insts_len = len;
+    replace_value(&block->jump.arg, map);
+  }
+
+  ir_proc_replace_temps(proc, map);
+
+  hashmap_free(values);
+  free(is_slot);
+  free(map);
+
+  return eliminated;
+}
+
+static struct ir_value push_typed(struct ir_proc *proc, struct ir_block *block, ir_type type,
+  ir_op op, struct ir_value lhs, struct ir_value rhs)
+{
+  struct ir_inst inst = {
+    .op = op,
+    .type = type,
+    .dest = ir_proc_new_temp(proc),
+    .args = { lhs, rhs },
+  };
+
+  ir_block_push(block, &inst);
+
+  return ir_value_temp(inst.dest);
+}
+
+static struct ir_value push_op(struct ir_proc *proc, struct ir_block *block,
+  ir_op op, struct ir_value lhs, struct ir_value rhs)
+{
+  return push_typed(proc, block, IR_TYPE_L, op, lhs, rhs);
+}
+
+/* Computes the magic number and shift for signed division by `d`, where
+ * |d| >= 2 and is not a power of two.
+ * Hacker's Delight, figure 10-1, widened to 64 bits. */
+static void signed_division_magic(int64_t d, int64_t *magic, int *shift) {
+  const uint64_t two63 = (uint64_t)1 << 63;
+  uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+  uint64_t t = two63 + ((uint64_t)d >> 63);
+  uint64_t anc = t - 1 - t % ad;
+  uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+  uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+  uint64_t delta;
+  int p = 63;
+
+  do {
+    p++;
+
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  *magic = (int64_t)(q2 + 1);
+  if (d < 0)
+    *magic = -*magic;
+
+  *shift = p - 64;
+}
+
+/* QBE has no multiply high instruction, so the upper 64 bits of the signed
+ * 128-bit product are built from 32-bit halves.
+ * Hacker's Delight, figure 8-2, widened to 64 bits. */
+static struct ir_value push_multiply_high(struct ir_proc *proc, struct ir_block *block,
+  struct ir_value u, int64_t v)
+{
+  struct ir_value u0, u1, v0, v1, w0, w1, w2, t;
+
+  v0 = ir_value_const(v & 0xffffffff);
+  v1 = ir_value_const(v >> 32);
+
+  u0 = push_op(proc, block, IR_AND, u, ir_value_const(0xffffffff));
+  u1 = push_op(proc, block, IR_SAR, u, ir_value_const(32));
+
+  w0 = push_op(proc, block, IR_MUL, u0, v0);
+  t = push_op(proc, block, IR_MUL, u1, v0);
+  t = push_op(proc, block, IR_ADD, t, push_op(proc, block, IR_SHR, w0, ir_value_const(32)));
+
+  w1 = push_op(proc, block, IR_AND, t, ir_value_const(0xffffffff));
+  w2 = push_op(proc, block, IR_SAR, t, ir_value_const(32));
+  w1 = push_op(proc, block, IR_ADD, push_op(proc, block, IR_MUL, u0, v1), w1);
+
+  t = push_op(proc, block, IR_ADD, push_op(proc, block, IR_MUL, u1, v1), w2);
+
+  return push_op(proc, block, IR_ADD, t, push_op(proc, block, IR_SAR, w1, ir_value_const(32)));
+}
+
+/* Lowers multiplication, division and remainder by a constant to shifts,
+ * masks and multiplications, appending them to `block`. Returns false when
+ * `inst` cannot be reduced, in which case nothing is appended. */
+static bool push_strength_reduced(struct ir_proc *proc, struct ir_block *block,
+  struct ir_inst *inst, struct ir_value *result)
+{
+  struct ir_value x, q, t, lhs = inst->args[0], rhs = inst->args[1];
+  int64_t c, magic;
+  uint64_t ac;
+  int k, shift;
+
+  if (inst->op == IR_MUL) {
+    if (rhs.kind == IR_VALUE_CONST) {
+      x = lhs;
+      c = rhs.as.integer;
+    } else if (lhs.kind == IR_VALUE_CONST) {
+      x = rhs;
+      c = lhs.as.integer;
+    } else {
+      return false;
+    }
+
+    if (c <= 0 || (c & (c - 1)) != 0 || (inst->type == IR_TYPE_W && c > INT32_MAX))
+      return false;
+
+    k = __builtin_ctzll(c);
+    *result = k == 0 ? x : push_typed(proc, block, inst->type, IR_SHL, x, ir_value_const(k));
+
+    return true;
+  }
+
+  if (rhs.kind != IR_VALUE_CONST)
+    return false;
+
+  if (inst->op == IR_UDIV || inst->op == IR_UREM) {
+    x = lhs;
+    c = rhs.as.integer;
+
+    if (c <= 0 || (c & (c - 1)) != 0 || (inst->type == IR_TYPE_W && c > INT32_MAX))
+      return false;
+
+    k = __builtin_ctzll(c);
+
+    if (inst->op == IR_UREM)
+      *result = push_typed(proc, block, inst->type, IR_AND, x, ir_value_const(c - 1));
+    else
+      *result = k == 0 ? x : push_typed(proc, block, inst->type, IR_SHR, x, ir_value_const(k));
+
+    return true;
+  }
+
+  // The sequences for signed division assume 64-bit operands.
+  if ((inst->op != IR_DIV && inst->op != IR_REM) || inst->type != IR_TYPE_L)
+    return false;
+
+  x = lhs;
+  c = rhs.as.integer;
+
+  // Division by zero is left to trap at runtime.
+  if (c == 0 || c == INT64_MIN)
+    return false;
+
+  ac = c < 0 ? -(uint64_t)c : (uint64_t)c;
+
+  if (ac == 1) {
+    if (inst->op == IR_REM)
+      *result = ir_value_const(0);
+    else
+      *result = c > 0 ? x : push_op(proc, block, IR_NEG, x, ir_value_none());
+
+    return true;
+  }
+
+  if ((ac & (ac - 1)) == 0) {
+    // Negative dividends are biased by 2^k - 1 so the shift rounds towards
+    // zero like div and rem do.
+    k = __builtin_ctzll(ac);
+
+    t = push_op(proc, block, IR_SAR, x, ir_value_const(63));
+    t = push_op(proc, block, IR_SHR, t, ir_value_const(64 - k));
+    t = push_op(proc, block, IR_ADD, x, t);
+
+    if (inst->op == IR_REM) {
+      t = push_op(proc, block, IR_AND, t, ir_value_const(-(int64_t)ac));
+      *result = push_op(proc, block, IR_SUB, x, t);
+
+      return true;
+    }
+
+    q = push_op(proc, block, IR_SAR, t, ir_value_const(k));
+    *result = c > 0 ? q : push_op(proc, block, IR_NEG, q, ir_value_none());
+
+    return true;
+  }
+
+  signed_division_magic(c, &magic, &shift);
+
+  q = push_multiply_high(proc, block, x, magic);
+
+  if (c > 0 && magic < 0)
+    q = push_op(proc, block, IR_ADD, q, x);
+  else if (c < 0 && magic > 0)
+    q = push_op(proc, block, IR_SUB, q, x);
+
+  if (shift > 0)
+    q = push_op(proc, block, IR_SAR, q, ir_value_const(shift));
+
+  t = push_op(proc, block, IR_SHR, q, ir_value_const(63));
+  q = push_op(proc, block, IR_ADD, q, t);
+
+  if (inst->op == IR_REM) {
+    t = push_op(proc, block, IR_MUL, q, ir_value_const(c));
+    *result = push_op(proc, block, IR_SUB, x, t);
+
+    return true;
+  }
+
+  *result = q;
+
+  return true;
+}
+
+/* Strength reduction: rewrites multiplication, division and remainder by a
+ * constant into cheaper instruction sequences. */
+size_t opt_strength_reduce(struct ir_module *module, struct ir_proc *proc) {
+  struct ir_block *block;
+  struct ir_inst *insts;
+  struct ir_value result, *map = calloc(proc->temps_len + 1, sizeof(struct ir_value));
+  size_t reduced = 0, insts_len, map_len = proc->temps_len + 1;
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    insts = block->insts;
+    insts_len = block->insts_len;
+
+    block->insts = NULL;
+    block->insts_len = 0;
+    block->insts_cap = 0;
+
+    for (size_t j = 0; j < insts_len; j++) {
+      replace_args(&insts[j], map);
+
+      if (insts[j].type != IR_TYPE_NONE && push_strength_reduced(proc, block, &insts[j], &result)) {
+        // The replacements may use the new temporaries, which the map has
+        // to cover when following chains.
+        if (proc->temps_len + 1 > map_len) {
+          map = realloc(map, sizeof(struct ir_value) * (proc->temps_len + 1));
+          memset(&map[map_len], 0, sizeof(struct ir_value) * (proc->temps_len + 1 - map_len));
+          map_len = proc->temps_len + 1;
+        }
+
+        map[insts[j].dest] = result;
+        reduced++;
+
+        continue;
+      }
+
+      ir_block_push(block, &insts[j]);
+    }
+
+    free(insts);
+    replace_value(&block->jump.arg, map);
+  }
+
+  ir_proc_replace_temps(proc, map);
+  free(map);
+
+  return reduced;
+}
+
+static void count_use(struct ir_value *value, void *udata) {
+  size_t *uses = udata;
+
+  if (value->kind == IR_VALUE_TEMP)
+    uses[value->as.temp]++;
+}
+
+/* Dead code elimination: removes instructions without side effects whose
+ * result is never used. */
+size_t opt_dead_code(struct ir_module *module, struct ir_proc *proc) {
+  struct ir_block *block;
+  struct ir_inst *inst;
+  size_t *uses = calloc(proc->temps_len + 1, sizeof(size_t));
+  size_t removed = 0, len;
+  bool changed = true;
+
+  ir_proc_map_values(proc, count_use, uses);
+
+  while (changed) {
+    changed = false;
+
+    for (size_t i = 0; i < proc->blocks_len; i++) {
+      block = proc->blocks[i];
+      len = 0;
+
+      for (size_t j = 0; j < block->insts_len; j++) {
+        inst = &block->insts[j];
+
+        if ((ir_op_is_pure(inst->op) || inst->op == IR_LOAD || inst->op == IR_ALLOC)
+          && uses[inst->dest] == 0)
+        {
+          if (inst->args[0].kind == IR_VALUE_TEMP)
+            uses[inst->args[0].as.temp]--;
+
+          if (inst->args[1].kind == IR_VALUE_TEMP)
+            uses[inst->args[1].as.temp]--;
+
+          removed++;
+          changed = true;
+
+          continue;
+        }
+
+        block->insts[len++] = *inst;
+      }
+
+      block->insts_len = len;
+    }
+  }
+
+  free(uses);
+
+  return removed;
+}
+
+static struct ir_block *thread_jump(struct ir_proc *proc, struct ir_block *target) {
+  // Skip over blocks that do nothing but jump elsewhere. Empty loops are
+  // bounded by the number of blocks.
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    if (target->insts_len != 0 || target->jump.kind != IR_JUMP_JMP)
+      break;
+
+    target = target->jump.targets[0];
+  }
+
+  return target;
+}
+
+/* Control flow simplification: resolves branches on constants, threads
+ * jumps through empty blocks, merges blocks into their only predecessor
+ * and removes unreachable blocks. */
+size_t opt_simplify_cfg(struct ir_module *module, struct ir_proc *proc) {
+  struct ir_block *block, *succ, *succs[2];
+  size_t *preds, succs_len, len, removed = 0;
+  struct ir_block **stack;
+  size_t stack_len;
+  bool *reachable;
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    if (block->jump.kind == IR_JUMP_JNZ && block->jump.arg.kind == IR_VALUE_CONST) {
+      block->jump.targets[0] = block->jump.targets[block->jump.arg.as.integer == 0];
+      block->jump.kind = IR_JUMP_JMP;
+      block->jump.arg = ir_value_none();
+    }
+
+    succs_len = ir_block_succs(block, succs);
+
+    for (size_t j = 0; j < succs_len; j++)
+      block->jump.targets[j] = thread_jump(proc, succs[j]);
+
+    if (block->jump.kind == IR_JUMP_JNZ && block->jump.targets[0] == block->jump.targets[1]) {
+      block->jump.kind = IR_JUMP_JMP;
+      block->jump.arg = ir_value_none();
+    }
+  }
+
+  // Find the reachable blocks, and count their predecessors.
+  reachable = calloc(proc->next_block_id, sizeof(bool));
+  preds = calloc(proc->next_block_id, sizeof(size_t));
+  stack = malloc(sizeof(struct ir_block *) * proc->blocks_len);
+  stack_len = 0;
+
+  stack[stack_len++] = proc->blocks[0];
+  reachable[proc->blocks[0]->id] = true;
+
+  while (stack_len > 0) {
+    block = stack[--stack_len];
+    succs_len = ir_block_succs(block, succs);
+
+    for (size_t j = 0; j < succs_len; j++) {
+      preds[succs[j]->id]++;
+
+      if (!reachable[succs[j]->id]) {
+        reachable[succs[j]->id] = true;
+        stack[stack_len++] = succs[j];
+      }
+    }
+  }
+
+  // Merge blocks into a predecessor that unconditionally jumps to them.
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    while (reachable[block->id] && block->jump.kind == IR_JUMP_JMP) {
+      succ = block->jump.targets[0];
+
+      if (succ == block || preds[succ->id] != 1)
+        break;
+
+      for (size_t j = 0; j < succ->insts_len; j++)
+        ir_block_push(block, &succ->insts[j]);
+
+      succ->insts_len = 0;
+      block->jump = succ->jump;
+      reachable[succ->id] = false;
+    }
+  }
+
+  len = 0;
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    if (!reachable[block->id]) {
+      ir_block_free(block);
+      removed++;
+
+      continue;
+    }
+
+    proc->blocks[len++] = block;
+  }
+
+  proc->blocks_len = len;
+
+  free(stack);
+  free(preds);
+  free(reachable);
+
+  return removed;
+}
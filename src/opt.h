@@ -0,0 +1,24 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+/* Evaluates `op` on constant operands, with the same wrapping and shift
+ * semantics as the QBE instruction it would be emitted as. Word results are
+ * sign extended.
+ * Returns false if the result is undefined. */
+bool opt_fold_operation(ir_op op, ir_type type, ir_type arg_type, int64_t lhs, int64_t rhs, int64_t *result);
+
+/* Each pass returns the number of instructions or blocks it removed or
+ * rewrote, which is what --opt-report prints. */
+size_t opt_fold(struct ir_module *module, struct ir_proc *proc);
+size_t opt_value_numbering(struct ir_module *module, struct ir_proc *proc);
+size_t opt_strength_reduce(struct ir_module *module, struct ir_proc *proc);
+size_t opt_dead_code(struct ir_module *module, struct ir_proc *proc);
+size_t opt_simplify_cfg(struct ir_module *module, struct ir_proc *proc);
+
+#endif /* OPT_H */
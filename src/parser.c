@@ -1,12 +1,14 @@
 #include "parser.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
 #include "lexer.h"
 #include "vector.h"
 #include "error.h"
 #include "arena.h"
+#include "mem.h"
 
 static inline bool parser_error(struct parser *parser) {
   parser->error = true;
@@ -35,22 +37,44 @@ bool parser_expect(struct parser *parser, token_type tt, struct token *tk) {
 bool parser_parse_ast(struct parser *parser, struct ast *ast) {
   struct token tk;
   struct ast_const c;
+  struct ast_import import;
   struct vector *vec = vector_new(sizeof(struct ast_const), 16, NULL);
+  struct vector *imports = vector_new(sizeof(struct ast_import), 4, NULL);
+
+  ast->consts_len = 0;
+  ast->consts = NULL;
+  ast->imports_len = 0;
+  ast->imports = NULL;
 
   while (true && lexer_peek(parser->lex, &tk)) {
+    if (tk.type == TT_DIRECTIVE) {
+      if (!parser_parse_import(parser, &import))
+        goto fail;
+
+      vector_push(imports, &import);
+      continue;
+    }
+
     if (!parser_parse_const(parser, &c))
-      return false;
+      goto fail;
 
     vector_push(vec, &c);
   }
 
   ast->consts_len = vector_into_inner(vec, (void **)&ast->consts);
+  ast->imports_len = vector_into_inner(imports, (void **)&ast->imports);
 
   if (tk.type != TT_EOF) {
     return false;
   }
 
   return true;
+
+fail:
+  vector_free(vec);
+  vector_free(imports);
+
+  return false;
 }
 
 bool parser_parse_const(struct parser *parser, struct ast_const *c) {
@@ -78,6 +102,7 @@ bool parser_parse_const(struct parser *parser, struct ast_const *c) {
 
   c->ident.len = tk.len;
   c->ident.chars = tk.loc;
+  c->src = parser->lex->src;
 
   if (!parser_expect(parser, TT_DOUBLE_COLON, &tk)) {
     if (parser->error)
@@ -122,9 +147,28 @@ bool parser_parse_const(struct parser *parser, struct ast_const *c) {
     } break;
 
     case TT_INTEGER:
-    case TT_IDENT: {
+    case TT_IDENT:
+    case TT_SUB:
+    case TT_L_BRACKET: {
       c->type = CONST_EXPR;
-      c->as.expr = arena_alloc(parser->arena, sizeof(struct ast_expr));
+      c->as.expr = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
+      if (!parser_parse_expression(parser, c->as.expr))
+        return parser_error(parser);
+    } break;
+
+    case TT_DIRECTIVE: {
+      if (tk.len != 4 || strncmp(tk.loc, "#run", 4) != 0) {
+        fprint_error(stderr, "unknown directive '%.*s'", tk.len, tk.loc);
+        fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "this directive");
+        fprint_help(stderr, "constants accept the #run directive");
+
+        return parser_error(parser);
+      }
+
+      lexer_next(parser->lex, &tk);
+
+      c->type = CONST_RUN;
+      c->as.expr = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
       if (!parser_parse_expression(parser, c->as.expr))
         return parser_error(parser);
     } break;
@@ -162,11 +206,173 @@ bool parser_parse_const(struct parser *parser, struct ast_const *c) {
   return true;
 }
 
+static const struct {
+  const char *name;
+  ast_proc_flags flag;
+} proc_directives[] = {
+  { "#export", PROC_EXPORT },
+  { "#force_inline", PROC_FORCE_INLINE },
+  { "#no_inline", PROC_NO_INLINE },
+};
+static const size_t proc_directives_len = sizeof(proc_directives) / sizeof(*proc_directives);
+
+static bool parser_parse_proc_directive(struct parser *parser, struct ast_proc *proc, struct token *tk) {
+  for (size_t i = 0; i < proc_directives_len; i++) {
+    if (strncmp(proc_directives[i].name, tk->loc, tk->len) == 0
+      && proc_directives[i].name[tk->len] == 0)
+    {
+      proc->flags |= proc_directives[i].flag;
+
+      if ((proc->flags & PROC_FORCE_INLINE) && (proc->flags & PROC_NO_INLINE)) {
+        fprint_error(stderr, "a procedure cannot be both #force_inline and #no_inline");
+        fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk->len, tk->loc, "this directive");
+
+        return parser_error(parser);
+      }
+
+      return true;
+    }
+  }
+
+  fprint_error(stderr, "unknown procedure directive '%.*s'", tk->len, tk->loc);
+  fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk->len, tk->loc, "this directive");
+  fprint_help(stderr, "procedures accept the #export, #force_inline and #no_inline directives");
+
+  return parser_error(parser);
+}
+
+static bool parser_unexpected(struct parser *parser, struct token *tk, const char *expected) {
+  if (parser->error)
+    return false;
+
+  if (tk->type == TT_EOF) {
+    fprint_error(stderr, "input unexpectedly ended");
+    fprint_info_ctx(stderr, parser->lex->src, 1, 1, 1, parser->lex->history[1].loc, "here");
+  } else {
+    fprint_error(stderr, "got an unexpected %s token", token_type_tostring(tk->type));
+    fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk->len, tk->loc, "unexpected token");
+  }
+  fprint_help(stderr, "expected %s", expected);
+
+  return parser_error(parser);
+}
+
+/* Parses `#load "file.jh";` or `#import "name";`. */
+bool parser_parse_import(struct parser *parser, struct ast_import *import) {
+  struct token tk;
+
+  lexer_next(parser->lex, &tk);
+
+  if ((tk.len != 5 || strncmp(tk.loc, "#load", 5) != 0)
+    && (tk.len != 7 || strncmp(tk.loc, "#import", 7) != 0))
+  {
+    fprint_error(stderr, "unknown directive '%.*s'", tk.len, tk.loc);
+    fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "this directive");
+    fprint_help(stderr, "other files are included with #import and #load");
+
+    return parser_error(parser);
+  }
+
+  import->search = tk.len == 7;
+
+  if (!parser_expect(parser, TT_STRING, &tk))
+    return parser_unexpected(parser, &tk, "a file name");
+
+  import->path.len = tk.len - 2;
+  import->path.chars = tk.loc + 1;
+  import->loc = tk.loc;
+  import->len = tk.len;
+
+  if (!parser_expect(parser, TT_SEMI_COLON, &tk))
+    return parser_unexpected(parser, &tk, "';'");
+
+  return true;
+}
+
+/* Parses `(a: T, b: U, ..)`, the `..` marking a variadic declaration. */
+bool parser_parse_params(struct parser *parser, struct ast_proc *proc) {
+  struct token tk;
+  struct ast_param param, *prev, *params_vec;
+  struct vector *params;
+  size_t i;
+
+  if (!parser_expect(parser, TT_L_BRACKET, &tk))
+    return parser_unexpected(parser, &tk, "'('");
+
+  params = vector_new(sizeof(struct ast_param), 4, NULL);
+
+  while (lexer_peek(parser->lex, &tk) && tk.type != TT_R_BRACKET) {
+    if (tk.type == TT_ELLIPSIS) {
+      lexer_next(parser->lex, &tk);
+      proc->flags |= PROC_VARIADIC;
+      break;
+    }
+
+    if (!parser_expect(parser, TT_IDENT, &tk)) {
+      vector_free(params);
+      return parser_unexpected(parser, &tk, "a parameter name or ')'");
+    }
+
+    param.ident.len = tk.len;
+    param.ident.chars = tk.loc;
+
+    i = 0;
+    while (vector_iter(params, &i, (void **)&prev)) {
+      if (prev->ident.len == tk.len && strncmp(prev->ident.chars, tk.loc, tk.len) == 0) {
+        fprint_error(stderr, "parameter '%.*s' is declared twice", tk.len, tk.loc);
+        fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "this parameter");
+
+        vector_free(params);
+        return parser_error(parser);
+      }
+    }
+
+    if (!parser_expect(parser, TT_SINGLE_COLON, &tk)) {
+      vector_free(params);
+      return parser_unexpected(parser, &tk, "':' and the type of the parameter");
+    }
+
+    if (!parser_parse_type(parser, &param.type)) {
+      vector_free(params);
+      return false;
+    }
+
+    vector_push(params, &param);
+
+    if (!lexer_peek(parser->lex, &tk) || tk.type != TT_COLON)
+      break;
+
+    lexer_next(parser->lex, &tk);
+  }
+
+  proc->params_len = vector_into_inner(params, (void **)&params_vec);
+  proc->params = mem_arena_alloc(parser->arena, MEM_NODE_PARAM,
+    sizeof(struct ast_param) * proc->params_len);
+
+  for (i = 0; i < proc->params_len; i++)
+    proc->params[i] = params_vec[i];
+
+  free(params_vec);
+
+  if (!parser_expect(parser, TT_R_BRACKET, &tk))
+    return parser_unexpected(parser, &tk, "')'");
+
+  return true;
+}
+
 bool parser_parse_proc(struct parser *parser, struct ast_const *c) {
   struct token tk;
-  struct ast_proc proc;
+  struct ast_proc proc = {
+    .flags = PROC_EMPTY,
+    .params_len = 0,
+    .params = NULL,
+    .ret_type = TYPE_I64,
+    .stmts_len = 0,
+    .stmts = NULL,
+  };
   struct ast_stmt *stmt, **stmts_vec;
   struct vector *stmts;
+  bool has_ret_type = false;
 
   if (!parser_expect(parser, TT_PROC, &tk)) {
     if (parser->error)
@@ -185,39 +391,23 @@ bool parser_parse_proc(struct parser *parser, struct ast_const *c) {
     return parser_error(parser);
   }
 
-  if (!parser_expect(parser, TT_L_BRACKET, &tk)) {
-    if (parser->error)
-      return false;
-
-    if (tk.type == TT_EOF) {
-      fprint_error(stderr, "input unexpectedly ended");
-      fprint_info_ctx(stderr, parser->lex->src, 1, 1, 1, parser->lex->history[1].loc, "here");
-      fprint_help(stderr, "expected '('");
-    } else {
-      fprint_error(stderr, "got an unexpected %s token", token_type_tostring(tk.type));
-      fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "unexpected token");
-      fprint_help(stderr, "expected '('");
-    }
+  if (!parser_parse_params(parser, &proc))
+    return false;
 
-    return parser_error(parser);
-  }
+  if (lexer_peek(parser->lex, &tk) && tk.type == TT_ARROW) {
+    lexer_next(parser->lex, &tk);
 
-  if (!parser_expect(parser, TT_R_BRACKET, &tk)) {
-    if (parser->error)
+    if (!parser_parse_type(parser, &proc.ret_type))
       return false;
 
-    if (tk.type == TT_EOF) {
-      fprint_error(stderr, "input unexpectedly ended");
-      fprint_info_ctx(stderr, parser->lex->src, 1, 1, 1, parser->lex->history[1].loc, "here");
-      fprint_help(stderr, "expected ')'");
-    } else {
-      fprint_error(stderr, "got an unexpected %s token", token_type_tostring(tk.type));
-      fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "unexpected token");
-      fprint_help(stderr, "expected ')'");
-      fprint_note(stderr, "For the time being, procedures can take no arguments");
-    }
+    has_ret_type = true;
+  }
 
-    return parser_error(parser);
+  while (lexer_peek(parser->lex, &tk) && tk.type == TT_DIRECTIVE) {
+    lexer_next(parser->lex, &tk);
+
+    if (!parser_parse_proc_directive(parser, &proc, &tk))
+      return false;
   }
 
   if (!lexer_next(parser->lex, &tk)) {
@@ -232,14 +422,19 @@ bool parser_parse_proc(struct parser *parser, struct ast_const *c) {
   }
 
   if (tk.type == TT_SEMI_COLON) {
+    // Like an old style C prototype, `proc ();` says nothing about the
+    // arguments, so that the likes of printf can be declared.
+    if (proc.params_len == 0 && !(proc.flags & PROC_VARIADIC) && !has_ret_type)
+      proc.flags |= PROC_UNCHECKED;
+
     c->type = CONST_PROC_DECLARATION;
+    c->as.proc = proc;
 
     return true;
   } else if (tk.type != TT_L_CURLY) {
     fprint_error(stderr, "got an unexpected %s token", token_type_tostring(tk.type));
     fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "unexpected token");
     fprint_help(stderr, "expected '{'");
-    fprint_note(stderr, "For the time being, procedures cannot define their return type, it is assumed to be i64");
 
     return parser_error(parser);
   }
@@ -247,7 +442,7 @@ bool parser_parse_proc(struct parser *parser, struct ast_const *c) {
   stmts = vector_new(sizeof(struct ast_stmt *), 16, NULL);
 
   while (lexer_peek(parser->lex, &tk) && tk.type != TT_R_CURLY) {
-    stmt = arena_alloc(parser->arena, sizeof(struct ast_stmt));
+    stmt = mem_arena_alloc(parser->arena, MEM_NODE_STMT, sizeof(struct ast_stmt));
     if (!parser_parse_stmt(parser, stmt))
       return false;
 
@@ -255,7 +450,8 @@ bool parser_parse_proc(struct parser *parser, struct ast_const *c) {
   }
 
   proc.stmts_len = vector_into_inner(stmts, (void **)&stmts_vec);
-  proc.stmts = arena_alloc(parser->arena, sizeof(struct ast_stmt *) * proc.stmts_len);
+  proc.stmts = mem_arena_alloc(parser->arena, MEM_NODE_LIST,
+    sizeof(struct ast_stmt *) * proc.stmts_len);
 
   for (size_t i = 0; i < proc.stmts_len; i++) {
     proc.stmts[i] = stmts_vec[i];
@@ -333,14 +529,14 @@ bool parser_parse_stmt(struct parser *parser, struct ast_stmt *stmt) {
         return true;
       }
 
-      stmt->as.ret = arena_alloc(parser->arena, sizeof(struct ast_expr));
+      stmt->as.ret = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
       if (!parser_parse_expression(parser, stmt->as.ret))
         return parser_error(parser);
     } break;
 
     case TT_IF: {
       stmt->type = STMT_IF;
-      stmt->as.if_ = arena_alloc(parser->arena, sizeof(struct ast_if));
+      stmt->as.if_ = mem_arena_alloc(parser->arena, MEM_NODE_IF, sizeof(struct ast_if));
       if (!parser_parse_if(parser, stmt->as.if_))
         return false;
 
@@ -356,16 +552,19 @@ bool parser_parse_stmt(struct parser *parser, struct ast_stmt *stmt) {
       }
 
       switch (tk.type) {
-        case TT_COLON_EQUALS: {
+        case TT_COLON_EQUALS:
+        case TT_SINGLE_COLON: {
           stmt->type = STMT_LET;
-          stmt->as.let = arena_alloc(parser->arena, sizeof(struct ast_assign));
+          stmt->as.let = mem_arena_alloc(parser->arena, MEM_NODE_ASSIGN,
+            sizeof(struct ast_assign));
           if (!parser_parse_let(parser, stmt->as.let))
             return parser_error(parser);
         } break;
 
         case TT_EQUALS: {
           stmt->type = STMT_ASSIGN;
-          stmt->as.assign = arena_alloc(parser->arena, sizeof(struct ast_assign));
+          stmt->as.assign = mem_arena_alloc(parser->arena, MEM_NODE_ASSIGN,
+            sizeof(struct ast_assign));
           if (!parser_parse_assign(parser, stmt->as.assign))
             return parser_error(parser);
         } break;
@@ -379,7 +578,7 @@ bool parser_parse_stmt(struct parser *parser, struct ast_stmt *stmt) {
     default: {
 fallthrough:
       stmt->type = STMT_EXPR;
-      stmt->as.expr = arena_alloc(parser->arena, sizeof(struct ast_expr));
+      stmt->as.expr = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
       if (!parser_parse_expression(parser, stmt->as.expr))
         return parser_error(parser);
     } break;
@@ -410,6 +609,35 @@ no_semi_colon:
   return true;
 }
 
+bool parser_parse_type(struct parser *parser, ast_type *type) {
+  struct token tk;
+  struct ident ident;
+
+  if (!parser_expect(parser, TT_IDENT, &tk)) {
+    if (parser->error)
+      return parser_error(parser);
+
+    fprint_error(stderr, "got an unexpected %s token", token_type_tostring(tk.type));
+    fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "unexpected token");
+    fprint_help(stderr, "expected a type");
+
+    return parser_error(parser);
+  }
+
+  ident.len = tk.len;
+  ident.chars = tk.loc;
+
+  if (!ast_type_from_ident(&ident, type)) {
+    fprint_error(stderr, "unknown type '%.*s'", tk.len, tk.loc);
+    fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "this type");
+    fprint_help(stderr, "the types are i8, i16, i32, i64, u8, u16, u32 and u64");
+
+    return parser_error(parser);
+  }
+
+  return true;
+}
+
 bool parser_parse_let(struct parser *parser, struct ast_assign *assign) {
   struct token tk;
 
@@ -424,17 +652,32 @@ bool parser_parse_let(struct parser *parser, struct ast_assign *assign) {
 
   assign->ident.len = tk.len;
   assign->ident.chars = tk.loc;
+  assign->type = TYPE_NONE;
 
-  if (!parser_expect(parser, TT_COLON_EQUALS, &tk)) {
-    if (parser->error)
-      return parser_error(parser);
+  if (!lexer_next(parser->lex, &tk))
+    return parser_error(parser);
+
+  if (tk.type == TT_SINGLE_COLON) {
+    if (!parser_parse_type(parser, &assign->type))
+      return false;
 
+    if (!parser_expect(parser, TT_EQUALS, &tk)) {
+      if (parser->error)
+        return parser_error(parser);
+
+      fprint_error(stderr, "got an unexpected %s token", token_type_tostring(tk.type));
+      fprint_error_ctx(stderr, parser->lex->src, 1, 0, tk.len, tk.loc, "unexpected token");
+      fprint_help(stderr, "expected '='");
+
+      return parser_error(parser);
+    }
+  } else if (tk.type != TT_COLON_EQUALS) {
     // TODO: Add error message
 
     return parser_error(parser);
   }
 
-  assign->expr = arena_alloc(parser->arena, sizeof(struct ast_expr));
+  assign->expr = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
   if (!parser_parse_expression(parser, assign->expr))
     return false;
   
@@ -455,6 +698,7 @@ bool parser_parse_assign(struct parser *parser, struct ast_assign *assign) {
 
   assign->ident.len = tk.len;
   assign->ident.chars = tk.loc;
+  assign->type = TYPE_NONE;
 
   if (!parser_expect(parser, TT_EQUALS, &tk)) {
     if (parser->error)
@@ -465,7 +709,7 @@ bool parser_parse_assign(struct parser *parser, struct ast_assign *assign) {
     return parser_error(parser);
   }
 
-  assign->expr = arena_alloc(parser->arena, sizeof(struct ast_expr));
+  assign->expr = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
   if (!parser_parse_expression(parser, assign->expr))
     return parser_error(parser);
   
@@ -486,7 +730,7 @@ bool parser_parse_branch(struct parser *parser, struct ast_if_branch *branch) {
     return parser_error(parser);
   }
 
-  branch->cond = arena_alloc(parser->arena, sizeof(struct ast_expr));
+  branch->cond = mem_arena_alloc(parser->arena, MEM_NODE_EXPR, sizeof(struct ast_expr));
   if (!parser_parse_expression(parser, branch->cond))
     return parser_error(parser);
 
@@ -510,7 +754,7 @@ bool parser_parse_branch(struct parser *parser, struct ast_if_branch *branch) {
   stmts_vec = vector_new(sizeof(struct ast_stmt *), 16, NULL);
 
   while (lexer_peek(parser->lex, &tk) && tk.type != TT_R_CURLY) {
-    stmt = arena_alloc(parser->arena, sizeof(struct ast_stmt));
+    stmt = mem_arena_alloc(parser->arena, MEM_NODE_STMT, sizeof(struct ast_stmt));
     if (!parser_parse_stmt(parser, stmt))
       return false;
 
@@ -518,7 +762,8 @@ bool parser_parse_branch(struct parser *parser, struct ast_if_branch *branch) {
   }
 
   branch->stmts_len = vector_into_inner(stmts_vec, (void **)&stmts_inner);
-  branch->stmts = arena_alloc(parser->arena, sizeof(struct ast_stmt *) * branch->stmts_len);
+  branch->stmts = mem_arena_alloc(parser->arena, MEM_NODE_LIST,
+    sizeof(struct ast_stmt *) * branch->stmts_len);
 
   for (size_t i = 0; i < branch->stmts_len; i++) {
     branch->stmts[i] = stmts_inner[i];
@@ -617,7 +862,7 @@ bool parser_parse_if(struct parser *parser, struct ast_if *if_) {
     stmts_vec = vector_new(sizeof(struct ast_stmt *), 16, NULL);
 
     while (lexer_peek(parser->lex, &tk) && tk.type != TT_R_CURLY) {
-      stmt = arena_alloc(parser->arena, sizeof(struct ast_stmt));
+      stmt = mem_arena_alloc(parser->arena, MEM_NODE_STMT, sizeof(struct ast_stmt));
       if (!parser_parse_stmt(parser, stmt))
         return false;
 
@@ -625,7 +870,8 @@ bool parser_parse_if(struct parser *parser, struct ast_if *if_) {
     }
 
     if_->else_stmts_len = vector_into_inner(stmts_vec, (void **)&stmts_inner);
-    if_->else_stmts = arena_alloc(parser->arena, sizeof(struct ast_stmt *) * if_->else_stmts_len);
+    if_->else_stmts = mem_arena_alloc(parser->arena, MEM_NODE_LIST,
+      sizeof(struct ast_stmt *) * if_->else_stmts_len);
 
     for (size_t i = 0; i < if_->else_stmts_len; i++) {
       if_->else_stmts[i] = stmts_inner[i];
@@ -654,7 +900,8 @@ bool parser_parse_if(struct parser *parser, struct ast_if *if_) {
   }
 
   if_->branches_len = vector_into_inner(branches_vec, (void **)&branches_inner);
-  if_->branches = arena_alloc(parser->arena, sizeof(struct ast_if_branch) * if_->branches_len);
+  if_->branches = mem_arena_alloc(parser->arena, MEM_NODE_IF_BRANCH,
+    sizeof(struct ast_if_branch) * if_->branches_len);
 
   for (size_t i = 0; i < if_->branches_len; i++) {
     if_->branches[i] = branches_inner[i];
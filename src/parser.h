@@ -17,10 +17,13 @@ struct parser parser_new(struct arena *arena, struct lexer *lex);
 bool parser_expect(struct parser *parser, token_type tt, struct token *tk);
 
 bool parser_parse_ast(struct parser *parser, struct ast *ast);
+bool parser_parse_import(struct parser *parser, struct ast_import *import);
 bool parser_parse_const(struct parser *parser, struct ast_const *c);
 bool parser_parse_expression(struct parser *parser, struct ast_expr *expr);
+bool parser_parse_params(struct parser *parser, struct ast_proc *proc);
 bool parser_parse_proc(struct parser *parser, struct ast_const *c);
 bool parser_parse_stmt(struct parser *parser, struct ast_stmt *proc);
+bool parser_parse_type(struct parser *parser, ast_type *type);
 bool parser_parse_let(struct parser *parser, struct ast_assign *assign);
 bool parser_parse_assign(struct parser *parser, struct ast_assign *assign);
 bool parser_parse_if(struct parser *parser, struct ast_if *if_);
@@ -0,0 +1,131 @@
+#include "pass.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "error.h"
+#include "ir.h"
+#include "opt.h"
+
+static const struct pass passes[] = {
+  { "fold", opt_fold, "folded %zu constant instructions" },
+  { "vn", opt_value_numbering, "value numbering eliminated %zu instructions" },
+  { "strength", opt_strength_reduce, "strength reduced %zu instructions" },
+  { "dce", opt_dead_code, "removed %zu dead instructions" },
+  { "cfg", opt_simplify_cfg, "removed %zu blocks" },
+};
+
+#define PASSES_LEN (sizeof(passes) / sizeof(passes[0]))
+#define PIPELINE_MAX 64
+
+static const char *pipelines[] = {
+  [0] = "",
+  [1] = "fold,vn,strength",
+  [2] = "cfg,fold,vn,strength,fold,cfg,vn,fold,dce",
+};
+
+#define OPT_LEVEL_MAX (sizeof(pipelines) / sizeof(pipelines[0]) - 1)
+
+const struct pass *pass_find(const char *name, size_t len) {
+  for (size_t i = 0; i < PASSES_LEN; i++) {
+    if (strlen(passes[i].name) == len && strncmp(passes[i].name, name, len) == 0)
+      return &passes[i];
+  }
+
+  return NULL;
+}
+
+static bool parse_pipeline(const char *pipeline, const struct pass **out, size_t *out_len) {
+  const char *start = pipeline, *end;
+  const struct pass *pass;
+
+  *out_len = 0;
+
+  while (*start != 0) {
+    end = strchr(start, ',');
+
+    if (end == NULL)
+      end = start + strlen(start);
+
+    if (end > start) {
+      pass = pass_find(start, end - start);
+
+      if (pass == NULL) {
+        fprint_error(stderr, "unknown pass '%.*s'", (int)(end - start), start);
+        fprint_help(stderr, "the passes are fold, vn, strength, dce and cfg");
+        return false;
+      }
+
+      if (*out_len >= PIPELINE_MAX) {
+        fprint_error(stderr, "too many passes, the limit is %d", PIPELINE_MAX);
+        return false;
+      }
+
+      out[(*out_len)++] = pass;
+    }
+
+    start = *end == ',' ? end + 1 : end;
+  }
+
+  return true;
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool pass_run_pipeline(struct ir_module *module, const struct pass_options *options) {
+  const struct pass *pipeline[PIPELINE_MAX];
+  uint64_t times[PIPELINE_MAX] = { 0 }, start;
+  size_t pipeline_len, changes;
+  char report[128];
+  struct ir_proc *proc;
+  int level = options->opt_level;
+
+  if (level > (int)OPT_LEVEL_MAX)
+    level = OPT_LEVEL_MAX;
+
+  if (!parse_pipeline(options->pipeline != NULL ? options->pipeline : pipelines[level],
+    pipeline, &pipeline_len))
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind != IR_ITEM_PROC)
+      continue;
+
+    proc = module->items[i].as.proc;
+
+    if (options->verify && !ir_proc_verify(proc, "lowering"))
+      return false;
+
+    for (size_t j = 0; j < pipeline_len; j++) {
+      start = now_ns();
+      changes = pipeline[j]->run(module, proc);
+      times[j] += now_ns() - start;
+
+      if (options->report && changes > 0) {
+        snprintf(report, sizeof(report), pipeline[j]->report, changes);
+        fprint_note(stderr, "%.*s: %s", (int)proc->ident.len, proc->ident.chars, report);
+      }
+
+      if (options->verify && !ir_proc_verify(proc, pipeline[j]->name))
+        return false;
+    }
+  }
+
+  if (options->times) {
+    fprintf(stderr, "%-12s %12s\n", "pass", "time (us)");
+
+    for (size_t j = 0; j < pipeline_len; j++)
+      fprintf(stderr, "%-12s %12.1f\n", pipeline[j]->name, times[j] / 1000.0);
+  }
+
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef PASS_H
+#define PASS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ir.h"
+
+struct pass {
+  const char *name;
+  /* Returns how many changes the pass made to `proc`. */
+  size_t (*run)(struct ir_module *module, struct ir_proc *proc);
+  /* printf format for --opt-report, taking the number of changes. */
+  const char *report;
+};
+
+struct pass_options {
+  int opt_level;
+  /* A comma separated list of pass names, overriding `opt_level`. */
+  const char *pipeline;
+  /* Verify the IR after lowering and after every pass. */
+  bool verify;
+  /* Print how long each pass took in total. */
+  bool times;
+  /* Print what each pass did to each procedure. */
+  bool report;
+};
+
+const struct pass *pass_find(const char *name, size_t len);
+
+/* Runs the passes selected by `options` over every procedure in `module`.
+ * Returns false if a pass name is unknown or the IR fails to verify. */
+bool pass_run_pipeline(struct ir_module *module, const struct pass_options *options);
+
+#endif /* PASS_H */
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+
+#include "perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "error.h"
+
+/* Reading the counters twice in a row is done this many times, and the
+ * least it counted is taken as what a read costs. */
+#define PERF_CALIBRATE_READS 16
+
+struct perf_thread {
+  /* Which perf_open the counters are from, ones from an earlier compile are
+   * closed. */
+  uint64_t generation;
+  int leader;
+  /* Where each counter is in a read of the group, or -1. */
+  int slots[PERF_COUNTERS_LEN];
+  size_t slots_len;
+};
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} perf_events[PERF_COUNTERS_LEN] = {
+  [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  [PERF_BRANCHES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+  [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+    | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  [PERF_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+static struct {
+  bool active;
+  uint64_t generation;
+  bool available[PERF_COUNTERS_LEN];
+  struct perf_sample overhead;
+  /* Every counter opened by any thread, to close them all at once. */
+  pthread_mutex_t lock;
+  size_t fds_len, fds_cap;
+  int *fds;
+} perf = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct perf_thread perf_thread;
+
+static int perf_event_open(enum perf_counter counter, int group) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = perf_events[counter].type;
+  attr.config = perf_events[counter].config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void perf_keep(int fd) {
+  pthread_mutex_lock(&perf.lock);
+
+  if (perf.fds_len >= perf.fds_cap) {
+    perf.fds_cap = perf.fds_cap == 0 ? 16 : perf.fds_cap * 2;
+    perf.fds = realloc(perf.fds, sizeof(int) * perf.fds_cap);
+  }
+
+  perf.fds[perf.fds_len++] = fd;
+
+  pthread_mutex_unlock(&perf.lock);
+}
+
+/* Opens the group of counters of this thread, led by the cycle counter. */
+static bool perf_thread_open(struct perf_thread *thread) {
+  int fd;
+
+  thread->generation = perf.generation;
+  thread->slots_len = 0;
+  thread->leader = perf_event_open(PERF_CYCLES, -1);
+
+  if (thread->leader < 0)
+    return false;
+
+  perf_keep(thread->leader);
+  thread->slots[PERF_CYCLES] = thread->slots_len++;
+
+  for (size_t i = PERF_CYCLES + 1; i < PERF_COUNTERS_LEN; i++) {
+    fd = perf_event_open(i, thread->leader);
+    thread->slots[i] = fd < 0 ? -1 : (int)thread->slots_len++;
+
+    if (fd >= 0)
+      perf_keep(fd);
+  }
+
+  return true;
+}
+
+bool perf_open() {
+  struct perf_sample a, delta;
+  int err;
+
+  perf_close();
+  perf.generation++;
+
+  if (!perf_thread_open(&perf_thread)) {
+    err = errno;
+    fprint_note(stderr, "hardware performance counters are unavailable: %s", strerror(err));
+
+    if (err == EACCES || err == EPERM)
+      fprint_help(stderr, "counting needs kernel.perf_event_paranoid to be 2 or less");
+    else if (err == ENOENT || err == EOPNOTSUPP || err == ENODEV)
+      fprint_help(stderr, "this CPU has no counters the kernel can use, virtual machines often don't");
+
+    return false;
+  }
+
+  for (size_t i = 0; i < PERF_COUNTERS_LEN; i++)
+    perf.available[i] = perf_thread.slots[i] >= 0;
+
+  if (!perf.available[PERF_INSTRUCTIONS]) {
+    fprint_note(stderr, "hardware performance counters are unavailable: instructions can't be counted");
+    perf_close();
+
+    return false;
+  }
+
+  perf.active = true;
+
+  // The cost of a read falls inside every interval that is measured.
+  memset(&perf.overhead, 0, sizeof(perf.overhead));
+
+  for (size_t i = 0; i < PERF_CALIBRATE_READS; i++) {
+    perf_read(&a);
+    perf_since(&delta, &a);
+
+    for (size_t j = 0; j < PERF_COUNTERS_LEN; j++) {
+      if (i == 0 || delta.counts[j] < perf.overhead.counts[j])
+        perf.overhead.counts[j] = delta.counts[j];
+    }
+  }
+
+  return true;
+}
+
+void perf_close() {
+  perf.active = false;
+
+  pthread_mutex_lock(&perf.lock);
+
+  for (size_t i = 0; i < perf.fds_len; i++)
+    close(perf.fds[i]);
+
+  free(perf.fds);
+  perf.fds = NULL;
+  perf.fds_len = perf.fds_cap = 0;
+
+  pthread_mutex_unlock(&perf.lock);
+}
+
+bool perf_active() {
+  return perf.active;
+}
+
+bool perf_available(enum perf_counter counter) {
+  return perf.active && perf.available[counter];
+}
+
+void perf_read(struct perf_sample *sample) {
+  uint64_t buf[3 + PERF_COUNTERS_LEN], value;
+
+  memset(sample, 0, sizeof(*sample));
+
+  if (!perf.active)
+    return;
+
+  if (perf_thread.generation != perf.generation && !perf_thread_open(&perf_thread))
+    return;
+
+  if (perf_thread.leader < 0 || read(perf_thread.leader, buf, sizeof(buf)) < (ssize_t)(sizeof(uint64_t) * 3))
+    return;
+
+  // buf holds the number of counters, the time the group was enabled and
+  // the time it ran, then the counts. Counters which had to share the PMU
+  // with others are scaled up to the whole time.
+  for (size_t i = 0; i < PERF_COUNTERS_LEN; i++) {
+    if (perf_thread.slots[i] < 0 || (uint64_t)perf_thread.slots[i] >= buf[0])
+      continue;
+
+    value = buf[3 + perf_thread.slots[i]];
+
+    if (buf[2] > 0 && buf[2] < buf[1])
+      value = (uint64_t)((double)value * buf[1] / buf[2]);
+
+    sample->counts[i] = value;
+  }
+}
+
+void perf_since(struct perf_sample *delta, const struct perf_sample *start) {
+  struct perf_sample now;
+
+  perf_read(&now);
+
+  // Scaled counts are estimates, which can come out lower than before.
+  for (size_t i = 0; i < PERF_COUNTERS_LEN; i++) {
+    if (now.counts[i] > start->counts[i] + perf.overhead.counts[i])
+      delta->counts[i] = now.counts[i] - start->counts[i] - perf.overhead.counts[i];
+    else
+      delta->counts[i] = 0;
+  }
+}
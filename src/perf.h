@@ -0,0 +1,38 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Hardware performance counters of this process, through perf_event_open.
+ * Each thread counts on its own group of counters, opened the first time
+ * it reads them. Only user space is counted. */
+enum perf_counter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCHES,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_COUNTERS_LEN,
+};
+
+struct perf_sample {
+  uint64_t counts[PERF_COUNTERS_LEN];
+};
+
+/* Starts counting. Returns false, and prints why as a note, if this machine
+ * or kernel won't count cycles and instructions for us. */
+bool perf_open();
+void perf_close();
+bool perf_active();
+/* Whether `counter` could be opened, machines lack some of them. */
+bool perf_available(enum perf_counter counter);
+
+/* Reads the counters of this thread. */
+void perf_read(struct perf_sample *sample);
+/* Sets `delta` to what was counted since `start`, less what reading the
+ * counters costs. */
+void perf_since(struct perf_sample *delta, const struct perf_sample *start);
+
+#endif /* PERF_H */
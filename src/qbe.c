@@ -0,0 +1,185 @@
+#include "qbe.h"
+
+#include "emit.h"
+#include "ir.h"
+
+static const char *qbe_types[] = {
+  [IR_TYPE_NONE] = "",
+  [IR_TYPE_W] = "w",
+  [IR_TYPE_L] = "l",
+  [IR_TYPE_SB] = "sb", [IR_TYPE_UB] = "ub", [IR_TYPE_SH] = "sh", [IR_TYPE_UH] = "uh",
+};
+
+/* Stores don't care about the signedness of sub-word types. */
+static const char *qbe_store_types[] = {
+  [IR_TYPE_W] = "w",
+  [IR_TYPE_L] = "l",
+  [IR_TYPE_SB] = "b", [IR_TYPE_UB] = "b", [IR_TYPE_SH] = "h", [IR_TYPE_UH] = "h",
+};
+
+static const char *qbe_operations[] = {
+  [IR_COPY] = "copy",
+  [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "mul", [IR_DIV] = "div", [IR_REM] = "rem",
+  [IR_UDIV] = "udiv", [IR_UREM] = "urem", [IR_NEG] = "neg",
+  [IR_AND] = "and", [IR_OR] = "or", [IR_XOR] = "xor", [IR_SHL] = "shl", [IR_SHR] = "shr", [IR_SAR] = "sar",
+  [IR_EXTSB] = "extsb", [IR_EXTUB] = "extub", [IR_EXTSH] = "extsh", [IR_EXTUH] = "extuh",
+  [IR_EXTSW] = "extsw", [IR_EXTUW] = "extuw",
+  [IR_CEQ] = "ceq", [IR_CNE] = "cne", [IR_CSGT] = "csgt", [IR_CSLT] = "cslt", [IR_CSGE] = "csge", [IR_CSLE] = "csle",
+  [IR_CUGT] = "cugt", [IR_CULT] = "cult", [IR_CUGE] = "cuge", [IR_CULE] = "cule",
+  [IR_ALLOC] = "alloc",
+  [IR_LOAD] = "load",
+  [IR_STORE] = "store",
+  [IR_CALL] = "call",
+};
+
+static void qbe_emit_value(struct string_buffer *out, struct ir_value *value) {
+  switch (value->kind) {
+    case IR_VALUE_NONE: break;
+    case IR_VALUE_TEMP: sb_printf(out, "%%t_%lu", value->as.temp); break;
+    case IR_VALUE_CONST: sb_printf(out, "%li", value->as.integer); break;
+    case IR_VALUE_GLOBAL: sb_printf(out, "$%.*s", value->as.global.len, value->as.global.chars); break;
+  }
+}
+
+static void qbe_emit_label(struct string_buffer *out, struct ir_proc *proc, struct ir_block *block) {
+  if (block == proc->blocks[0])
+    sb_printf(out, "@start");
+  else
+    sb_printf(out, "@L_%lu", block->id);
+}
+
+static void qbe_emit_inst(struct string_buffer *out, struct ir_inst *inst) {
+  sb_printf(out, "    ");
+
+  if (inst->type != IR_TYPE_NONE)
+    sb_printf(out, "%%t_%lu =%s ", inst->dest, qbe_types[inst->type]);
+
+  sb_printf(out, "%s", qbe_operations[inst->op]);
+
+  // Comparisons are suffixed with the class of their operands, loads and
+  // stores with the type in memory.
+  if (ir_op_is_comparison(inst->op) || inst->op == IR_LOAD)
+    sb_printf(out, "%s", qbe_types[inst->arg_type]);
+  else if (inst->op == IR_STORE)
+    sb_printf(out, "%s", qbe_store_types[inst->arg_type]);
+  else if (inst->op == IR_ALLOC)
+    sb_printf(out, "%d", inst->args[0].as.integer > 4 ? 8 : 4);
+
+  sb_printf(out, " ");
+  qbe_emit_value(out, &inst->args[0]);
+
+  if (inst->op == IR_CALL) {
+    sb_printf(out, " ( ");
+
+    for (size_t i = 0; i < inst->call_args_len; i++) {
+      if (inst->call_variadic && i == inst->call_fixed_len)
+        sb_printf(out, "..., ");
+
+      sb_printf(out, "%s ", qbe_types[inst->call_types[i]]);
+      qbe_emit_value(out, &inst->call_args[i]);
+      sb_printf(out, ", ");
+    }
+
+    if (inst->call_variadic && inst->call_fixed_len == inst->call_args_len)
+      sb_printf(out, "..., ");
+
+    sb_printf(out, ")");
+  } else if (inst->args[1].kind != IR_VALUE_NONE) {
+    sb_printf(out, ", ");
+    qbe_emit_value(out, &inst->args[1]);
+  }
+
+  sb_printf(out, "\n");
+}
+
+static void qbe_emit_jump(struct string_buffer *out, struct ir_proc *proc, struct ir_jump *jump) {
+  switch (jump->kind) {
+    case IR_JUMP_NONE: break;
+
+    case IR_JUMP_JMP: {
+      sb_printf(out, "    jmp ");
+      qbe_emit_label(out, proc, jump->targets[0]);
+      sb_printf(out, "\n");
+    } break;
+
+    case IR_JUMP_JNZ: {
+      sb_printf(out, "    jnz ");
+      qbe_emit_value(out, &jump->arg);
+      sb_printf(out, ", ");
+      qbe_emit_label(out, proc, jump->targets[0]);
+      sb_printf(out, ", ");
+      qbe_emit_label(out, proc, jump->targets[1]);
+      sb_printf(out, "\n");
+    } break;
+
+    case IR_JUMP_RET: {
+      sb_printf(out, "    ret ");
+      qbe_emit_value(out, &jump->arg);
+      sb_printf(out, "\n");
+    } break;
+  }
+}
+
+bool qbe_emit_proc(struct string_buffer *out, struct ir_proc *proc) {
+  struct ir_block *block;
+
+  sb_printf(out, "export function %s $%.*s ( ", qbe_types[proc->ret_type], proc->ident.len, proc->ident.chars);
+
+  for (size_t i = 0; i < proc->params_len; i++)
+    sb_printf(out, "%s %%t_%lu, ", qbe_types[proc->param_types[i]], proc->params[i]);
+
+  sb_printf(out, ") {\n");
+
+  for (size_t i = 0; i < proc->blocks_len; i++) {
+    block = proc->blocks[i];
+
+    qbe_emit_label(out, proc, block);
+    sb_printf(out, "\n");
+
+    for (size_t j = 0; j < block->insts_len; j++)
+      qbe_emit_inst(out, &block->insts[j]);
+
+    qbe_emit_jump(out, proc, &block->jump);
+  }
+
+  sb_printf(out, "}\n");
+
+  return true;
+}
+
+bool qbe_emit_data(struct string_buffer *out, struct ir_data *data) {
+  switch (data->kind) {
+    case IR_DATA_STRING: {
+      sb_printf(out, "data $%.*s = { b \"%.*s\", b 0 }\n", data->ident.len, data->ident.chars,
+        data->as.string.len, data->as.string.chars);
+    } break;
+
+    case IR_DATA_INTEGER: {
+      sb_printf(out, "data $%.*s = { l %li }\n", data->ident.len, data->ident.chars, data->as.integer);
+    } break;
+  }
+
+  return true;
+}
+
+bool qbe_emit_module(struct string_buffer *out, struct ir_module *module) {
+  struct ir_item *item;
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    item = &module->items[i];
+
+    switch (item->kind) {
+      case IR_ITEM_PROC: {
+        if (!qbe_emit_proc(out, item->as.proc))
+          return false;
+      } break;
+
+      case IR_ITEM_DATA: {
+        if (!qbe_emit_data(out, &item->as.data))
+          return false;
+      } break;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,15 @@
+#ifndef QBE_H
+#define QBE_H
+
+#include <stdbool.h>
+
+#include "emit.h"
+#include "ir.h"
+
+/* Lowers the IR to QBE's text SSA format, this is the last step before
+ * handing over to qbe. */
+bool qbe_emit_module(struct string_buffer *out, struct ir_module *module);
+bool qbe_emit_proc(struct string_buffer *out, struct ir_proc *proc);
+bool qbe_emit_data(struct string_buffer *out, struct ir_data *data);
+
+#endif /* QBE_H */
@@ -0,0 +1,435 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.h"
+
+#define SERVER_MAX_REQUEST (1 << 20)
+
+/* A request is this header, followed by the client's working directory and
+ * `argc` arguments, all NUL terminated. The client's stdin, stdout and
+ * stderr come with the header, and the reply is the exit status as an
+ * int32_t. */
+struct server_header {
+  uint32_t len;
+  uint32_t argc;
+};
+
+static const char *server_path;
+
+char *server_socket_path() {
+  const char *env = getenv("JOTUNHEIM_SOCKET"), *runtime = getenv("XDG_RUNTIME_DIR");
+  char path[108];
+  struct stat st;
+
+  if (env != NULL && env[0] != 0)
+    return strdup(env);
+
+  if (runtime != NULL && runtime[0] == '/') {
+    snprintf(path, sizeof(path), "%s/jotunheim.sock", runtime);
+    return strdup(path);
+  }
+
+  // Anyone can create names in /tmp, so the socket goes in a directory only
+  // this user can get into, and one made by anybody else is refused.
+  snprintf(path, sizeof(path), "/tmp/jotunheim-%ld", (long)getuid());
+
+  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+    fprint_error(stderr, "failed to create '%s': %s", path, strerror(errno));
+    return NULL;
+  }
+
+  if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid()
+    || (st.st_mode & 077) != 0)
+  {
+    fprint_error(stderr, "'%s' is not a directory private to this user", path);
+    fprint_help(stderr, "remove it, or set XDG_RUNTIME_DIR or JOTUNHEIM_SOCKET");
+    return NULL;
+  }
+
+  strcat(path, "/jotunheim.sock");
+
+  return strdup(path);
+}
+
+/* Whether the other end of the socket `fd` is run by this user. */
+static bool server_peer_trusted(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+static bool server_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprint_error(stderr, "the socket path '%s' is too long", path);
+    return false;
+  }
+
+  strcpy(addr->sun_path, path);
+
+  return true;
+}
+
+static bool server_write_all(int fd, const void *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, data, len);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    data = (const char *)data + n;
+    len -= n;
+  }
+
+  return true;
+}
+
+static bool server_read_all(int fd, void *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(fd, data, len);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    data = (char *)data + n;
+    len -= n;
+  }
+
+  return true;
+}
+
+/* Closes every descriptor that came with `msg`. */
+static void server_close_rights(struct msghdr *msg) {
+  struct cmsghdr *cmsg;
+  size_t len;
+  int fd;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    for (size_t i = 0; i < len; i++) {
+      memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+      close(fd);
+    }
+  }
+}
+
+/* Reads a request into `buf`, and points `argv` into it. */
+static bool server_receive(int conn, char **buf, int *argc, char ***argv, int fds[3]) {
+  struct server_header header;
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * 3)];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+  struct cmsghdr *cmsg;
+  char *p, *end;
+  ssize_t n;
+
+  n = recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+
+  // Nothing was received, not even descriptors.
+  if (n < 0)
+    return false;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+
+  if (n != sizeof(header) || (msg.msg_flags & MSG_CTRUNC) || cmsg == NULL
+    || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+    || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3) || CMSG_NXTHDR(&msg, cmsg) != NULL)
+  {
+    // The worker outlives the request, so whatever descriptors did come
+    // have to be closed.
+    server_close_rights(&msg);
+    return false;
+  }
+
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+
+  if (header.len == 0 || header.len > SERVER_MAX_REQUEST || header.argc > header.len)
+    goto fail;
+
+  *buf = malloc(header.len + 1);
+  (*buf)[header.len] = 0;
+
+  if (!server_read_all(conn, *buf, header.len)) {
+    free(*buf);
+    goto fail;
+  }
+
+  *argc = header.argc;
+  *argv = malloc(sizeof(char *) * (header.argc + 1));
+  end = *buf + header.len;
+  p = *buf + strlen(*buf) + 1;
+
+  for (uint32_t i = 0; i < header.argc; i++) {
+    if (p >= end) {
+      free(*argv);
+      free(*buf);
+      goto fail;
+    }
+
+    (*argv)[i] = p;
+    p += strlen(p) + 1;
+  }
+
+  (*argv)[header.argc] = NULL;
+
+  return true;
+
+fail:
+  for (int i = 0; i < 3; i++)
+    close(fds[i]);
+
+  return false;
+}
+
+static void server_worker(int fd, server_compile_fn compile) {
+  struct source_cache *cache = source_cache_new();
+  int saved[3], fds[3], argc, conn;
+  int32_t status;
+  char *buf, **argv;
+
+  for (int i = 0; i < 3; i++)
+    saved[i] = dup(i);
+
+  while (true) {
+    conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (conn < 0)
+      continue;
+
+    // Requests run code as this user, so only this user may make them.
+    if (!server_peer_trusted(conn)) {
+      close(conn);
+      continue;
+    }
+
+    if (!server_receive(conn, &buf, &argc, &argv, fds)) {
+      close(conn);
+      continue;
+    }
+
+    // The compile runs with the client's streams and working directory.
+    fflush(NULL);
+
+    for (int i = 0; i < 3; i++) {
+      dup2(fds[i], i);
+      close(fds[i]);
+    }
+
+    if (chdir(buf) != 0) {
+      fprintf(stderr, "Failed to change directory to %s. %s\n", buf, strerror(errno));
+      status = 1;
+    } else {
+      status = compile(argc, argv, cache);
+    }
+
+    fflush(NULL);
+    __fpurge(stdin);
+    clearerr(stdin);
+
+    for (int i = 0; i < 3; i++)
+      dup2(saved[i], i);
+
+    server_write_all(conn, &status, sizeof(status));
+    close(conn);
+    free(argv);
+    free(buf);
+  }
+}
+
+static pid_t server_spawn(int fd, server_compile_fn compile) {
+  pid_t pid = fork();
+
+  if (pid != 0)
+    return pid;
+
+  // Workers go when the server does.
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGPIPE, SIG_IGN);
+
+  server_worker(fd, compile);
+  _exit(0);
+}
+
+static void server_stop(int sig) {
+  unlink(server_path);
+  _exit(0);
+}
+
+bool server_run(const char *path, size_t workers_len, server_compile_fn compile) {
+  struct sockaddr_un addr;
+  pid_t *workers, pid;
+  int fd, probe, status;
+  mode_t mask;
+
+  if (!server_address(path, &addr))
+    return false;
+
+  // A socket nobody is listening on is left over from a server that died.
+  probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    close(probe);
+    fprint_error(stderr, "a compile server is already listening on '%s'", path);
+
+    return false;
+  }
+
+  close(probe);
+  unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  // Only this user can connect to the socket.
+  mask = umask(077);
+
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+    umask(mask);
+    fprint_error(stderr, "failed to listen on '%s': %s", path, strerror(errno));
+
+    if (fd >= 0)
+      close(fd);
+
+    return false;
+  }
+
+  umask(mask);
+  server_path = path;
+  signal(SIGINT, server_stop);
+  signal(SIGTERM, server_stop);
+
+  printf("Listening on %s with %zu workers\n", path, workers_len);
+  fflush(stdout);
+
+  workers = malloc(sizeof(pid_t) * workers_len);
+
+  for (size_t i = 0; i < workers_len; i++)
+    workers[i] = server_spawn(fd, compile);
+
+  while ((pid = wait(&status)) > 0 || errno == EINTR) {
+    for (size_t i = 0; i < workers_len; i++) {
+      if (workers[i] == pid)
+        workers[i] = server_spawn(fd, compile);
+    }
+  }
+
+  free(workers);
+  close(fd);
+  unlink(path);
+
+  return true;
+}
+
+int server_request(const char *path, int argc, char *argv[]) {
+  struct sockaddr_un addr;
+  struct server_header header = { .len = 0, .argc = argc };
+  int fds[3] = { 0, 1, 2 };
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+  struct cmsghdr *cmsg;
+  char *cwd, *payload, *p;
+  int32_t status;
+  int fd;
+
+  if (!server_address(path, &addr))
+    return 1;
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprint_error(stderr, "no compile server is listening on '%s'", path);
+    fprint_help(stderr, "start one with 'jotunheim --server'");
+    close(fd);
+
+    return 1;
+  }
+
+  // The streams and working directory only go to a server run by this user.
+  if (!server_peer_trusted(fd)) {
+    fprint_error(stderr, "the compile server on '%s' is run by another user", path);
+    close(fd);
+
+    return 1;
+  }
+
+  cwd = getcwd(NULL, 0);
+  header.len = strlen(cwd) + 1;
+
+  for (int i = 0; i < argc; i++)
+    header.len += strlen(argv[i]) + 1;
+
+  p = payload = malloc(header.len);
+  p = stpcpy(p, cwd) + 1;
+
+  for (int i = 0; i < argc; i++)
+    p = stpcpy(p, argv[i]) + 1;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(fd, &msg, 0) != sizeof(header) || !server_write_all(fd, payload, header.len)
+    || !server_read_all(fd, &status, sizeof(status)))
+  {
+    fprint_error(stderr, "the compile server closed the connection");
+    status = 1;
+  }
+
+  free(payload);
+  free(cwd);
+  close(fd);
+
+  return status;
+}
@@ -0,0 +1,29 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "source.h"
+
+/* Runs one compile like `jotunheim argv...` would, parsing through `cache`. */
+typedef int (*server_compile_fn)(int argc, char *argv[], struct source_cache *cache);
+
+/* $JOTUNHEIM_SOCKET, or jotunheim.sock in $XDG_RUNTIME_DIR, or in a
+ * directory in /tmp named after the user and private to them. Returns NULL if
+ * that directory can't be made or belongs to someone else. */
+char *server_socket_path();
+
+/* Listens on the Unix socket at `path`, and serves compile requests from
+ * this user with `workers` resident processes. Each worker keeps its own warm
+ * source cache and compiles one request at a time, a worker that dies is
+ * replaced.
+ * Only returns if the server can't be started. */
+bool server_run(const char *path, size_t workers, server_compile_fn compile);
+
+/* Hands the compile `argv` to the server at `path`, along with the working
+ * directory and the standard streams of this process, if the server is run
+ * by this user. Returns the exit status of the compile. */
+int server_request(const char *path, int argc, char *argv[]);
+
+#endif /* SERVER_H */
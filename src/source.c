@@ -0,0 +1,539 @@
+#define _GNU_SOURCE
+
+#include "source.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "error.h"
+#include "hashmap.h"
+#include "lexer.h"
+#include "mem.h"
+#include "parser.h"
+#include "trace.h"
+
+/* Workers take files from `sources->files` in the order they are found, and
+ * append the files those import. Loading is done once no file is left and
+ * no worker is still parsing one. */
+struct source_loader {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct sources *sources;
+  size_t files_cap;
+  size_t next, active;
+  struct hashmap *by_path;
+  size_t import_dirs_len;
+  const char **import_dirs;
+  /* #import also looks next to the root file, the top of the program. */
+  struct source_file *root;
+  struct source_cache *cache;
+  bool failed;
+};
+
+#define SOURCE_CACHE_SPARE_ARENAS 16
+
+struct source_cache_entry {
+  char *path;
+  struct source_parse *parse;
+};
+
+struct source_cache {
+  pthread_mutex_t lock;
+  struct hashmap *by_path;
+  /* The arenas of parses which went stale, reset and reused by the next
+   * parse rather than unmapped. */
+  size_t spare_len;
+  struct arena *spare[SOURCE_CACHE_SPARE_ARENAS];
+};
+
+static uint64_t source_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+  const struct source_file *file = *(struct source_file *const *)item;
+
+  return hashmap_sip(file->path, strlen(file->path), seed0, seed1);
+}
+
+static int source_compare(const void *a, const void *b, void *udata) {
+  return strcmp((*(struct source_file *const *)a)->path, (*(struct source_file *const *)b)->path);
+}
+
+static uint64_t source_cache_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+  const struct source_cache_entry *entry = item;
+
+  return hashmap_sip(entry->path, strlen(entry->path), seed0, seed1);
+}
+
+static int source_cache_compare(const void *a, const void *b, void *udata) {
+  return strcmp(((const struct source_cache_entry *)a)->path, ((const struct source_cache_entry *)b)->path);
+}
+
+struct source_cache *source_cache_new() {
+  struct source_cache *cache = calloc(1, sizeof(struct source_cache));
+
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->by_path = hashmap_new_with_allocator(mem_hashmap_malloc, mem_hashmap_realloc,
+    mem_hashmap_free, sizeof(struct source_cache_entry), 16, 0, 0,
+    source_cache_hash, source_cache_compare, NULL, NULL);
+
+  return cache;
+}
+
+static void source_parse_release(struct source_parse *parse) {
+  struct source_cache *cache = parse->cache;
+
+  if (__atomic_sub_fetch(&parse->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+  if (cache != NULL) {
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->spare_len < SOURCE_CACHE_SPARE_ARENAS) {
+      cache->spare[cache->spare_len++] = parse->arena;
+      parse->arena = NULL;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+  }
+
+  if (parse->arena != NULL)
+    arena_free(parse->arena);
+
+  free(parse->ast.consts);
+  free(parse->ast.imports);
+  free(parse->src);
+  free(parse);
+}
+
+void source_cache_free(struct source_cache *cache) {
+  struct source_cache_entry *entry;
+  size_t i = 0;
+
+  while (hashmap_iter(cache->by_path, &i, (void **)&entry)) {
+    if (entry->parse != NULL) {
+      entry->parse->cache = NULL;
+      source_parse_release(entry->parse);
+    }
+
+    free(entry->path);
+  }
+
+  for (i = 0; i < cache->spare_len; i++)
+    arena_free(cache->spare[i]);
+
+  hashmap_free(cache->by_path);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+void source_cache_scan(struct source_cache *cache, void (*fn)(const char *path, void *udata), void *udata) {
+  struct source_cache_entry *entry;
+  size_t i = 0;
+
+  pthread_mutex_lock(&cache->lock);
+
+  while (hashmap_iter(cache->by_path, &i, (void **)&entry))
+    fn(entry->path, udata);
+
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/* Returns the parse of `path` if it is cached and the file looks the same.
+ * A path which isn't in the cache yet is added without a parse, so files
+ * which fail to parse are remembered too. */
+static struct source_parse *source_cache_get(struct source_cache *cache, const char *path, struct stat *st) {
+  struct source_cache_entry key = { .path = (char *)path }, *entry;
+  struct source_parse *parse = NULL;
+
+  pthread_mutex_lock(&cache->lock);
+  entry = (struct source_cache_entry *)hashmap_get(cache->by_path, &key);
+
+  if (entry == NULL) {
+    key.path = strdup(path);
+    hashmap_set(cache->by_path, &key);
+  } else if (entry->parse != NULL && entry->parse->size == st->st_size
+    && entry->parse->mtime.tv_sec == st->st_mtim.tv_sec
+    && entry->parse->mtime.tv_nsec == st->st_mtim.tv_nsec)
+  {
+    parse = entry->parse;
+    __atomic_add_fetch(&parse->refs, 1, __ATOMIC_ACQ_REL);
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return parse;
+}
+
+static void source_cache_put(struct source_cache *cache, const char *path, struct source_parse *parse) {
+  struct source_cache_entry entry = { .path = strdup(path), .parse = parse }, replaced = { 0 };
+  const struct source_cache_entry *old;
+
+  __atomic_add_fetch(&parse->refs, 1, __ATOMIC_ACQ_REL);
+  parse->cache = cache;
+
+  pthread_mutex_lock(&cache->lock);
+  old = hashmap_set(cache->by_path, &entry);
+
+  if (old != NULL)
+    replaced = *old;
+
+  pthread_mutex_unlock(&cache->lock);
+
+  free(replaced.path);
+
+  if (replaced.parse != NULL)
+    source_parse_release(replaced.parse);
+}
+
+static struct arena *source_cache_arena(struct source_cache *cache) {
+  struct arena *arena = NULL;
+
+  pthread_mutex_lock(&cache->lock);
+
+  if (cache->spare_len > 0)
+    arena = cache->spare[--cache->spare_len];
+
+  pthread_mutex_unlock(&cache->lock);
+
+  if (arena == NULL)
+    return arena_new();
+
+  arena_reset(arena);
+
+  return arena;
+}
+
+static bool source_read(struct source_parse *parse, const char *path, const char *filename) {
+  FILE *fptr = fopen(path, "r");
+
+  if (fptr == NULL) {
+    fprintf(stderr, "Failed to open file %s. %s\n", filename, strerror(errno));
+    return false;
+  }
+
+  fseek(fptr, 0L, SEEK_END);
+  parse->src_len = ftell(fptr);
+  fseek(fptr, 0L, SEEK_SET);
+
+  parse->src = malloc(parse->src_len + 1);
+  parse->src_len = fread(parse->src, sizeof(char), parse->src_len, fptr);
+  parse->src[parse->src_len] = 0;
+
+  fclose(fptr);
+
+  return true;
+}
+
+/* Returns the canonical path of the file `import` in `file` refers to, or
+ * NULL if there is none. */
+static char *source_resolve(struct source_loader *loader, struct source_file *file, struct ast_import *import) {
+  struct string *name = &import->path;
+  const char *ext = import->search ? ".jh" : "";
+  int dir_len = strrchr(file->path, '/') - file->path;
+  char candidate[PATH_MAX], *path;
+
+  if (name->len > 0 && name->chars[0] == '/') {
+    snprintf(candidate, sizeof(candidate), "%.*s%s", (int)name->len, name->chars, ext);
+  } else {
+    snprintf(candidate, sizeof(candidate), "%.*s/%.*s%s", dir_len, file->path,
+      (int)name->len, name->chars, ext);
+  }
+
+  path = realpath(candidate, NULL);
+
+  for (size_t i = 0; path == NULL && import->search && i < loader->import_dirs_len; i++) {
+    snprintf(candidate, sizeof(candidate), "%s/%.*s.jh", loader->import_dirs[i],
+      (int)name->len, name->chars);
+    path = realpath(candidate, NULL);
+  }
+
+  if (path == NULL && import->search && file != loader->root) {
+    dir_len = strrchr(loader->root->path, '/') - loader->root->path;
+    snprintf(candidate, sizeof(candidate), "%.*s/%.*s.jh", dir_len, loader->root->path,
+      (int)name->len, name->chars);
+    path = realpath(candidate, NULL);
+  }
+
+  return path;
+}
+
+/* Returns the file at `path`, adding it to the files to parse if it is new.
+ * Takes ownership of `path`. Called with the lock held. */
+static struct source_file *source_add(struct source_loader *loader, char *path) {
+  struct sources *sources = loader->sources;
+  struct source_file key = { .path = path }, *file = &key, **found;
+
+  found = (struct source_file **)hashmap_get(loader->by_path, &file);
+
+  if (found != NULL) {
+    free(path);
+    return *found;
+  }
+
+  file = calloc(1, sizeof(struct source_file));
+  file->path = path;
+
+  if (sources->files_len >= loader->files_cap) {
+    loader->files_cap = loader->files_cap == 0 ? 16 : loader->files_cap * 2;
+    sources->files = realloc(sources->files, sizeof(struct source_file *) * loader->files_cap);
+  }
+
+  sources->files[sources->files_len++] = file;
+  hashmap_set(loader->by_path, &file);
+
+  return file;
+}
+
+/* Parses `file` and queues everything it imports. */
+static bool source_process(struct source_loader *loader, struct source_file *file, const char *filename) {
+  struct source_parse *parse = NULL;
+  struct ast_import *import;
+  struct stat st;
+  char **paths;
+  bool ok;
+
+  if (stat(file->path, &st) != 0) {
+    fprintf(stderr, "Failed to open file %s. %s\n", filename, strerror(errno));
+    return false;
+  }
+
+  if (loader->cache != NULL)
+    parse = source_cache_get(loader->cache, file->path, &st);
+
+  if (parse == NULL) {
+    parse = calloc(1, sizeof(struct source_parse));
+    parse->refs = 1;
+    parse->mtime = st.st_mtim;
+    parse->size = st.st_size;
+    file->parse = parse;
+
+    if (!source_read(parse, file->path, filename))
+      return false;
+
+    struct lexer lex = lexer_new(parse->src);
+    struct trace_mark mark = trace_mark();
+
+    // The parser lexes as it goes, so lexing is only timed apart when the
+    // whole file is lexed first.
+    if (trace_active()) {
+      lexer_lex_all(&lex);
+      trace_span(TRACE_LEX, strlen(file->path), file->path, mark, 0);
+      // The last token is the end of the file.
+      trace_items(TRACE_LEX, lex.tokens_len - 1);
+      mark = trace_mark();
+    }
+
+    parse->arena = loader->cache != NULL ? source_cache_arena(loader->cache) : arena_new();
+    struct parser parser = parser_new(parse->arena, &lex);
+
+    ok = parser_parse_ast(&parser, &parse->ast);
+    trace_span(TRACE_PARSE, strlen(file->path), file->path, mark, arena_used(parse->arena));
+    lexer_free(&lex);
+
+    if (ok && trace_active())
+      trace_items(TRACE_PARSE, ast_nodes(&parse->ast));
+
+    if (!ok)
+      return false;
+
+    if (loader->cache != NULL)
+      source_cache_put(loader->cache, file->path, parse);
+  }
+
+  file->parse = parse;
+
+  paths = calloc(parse->ast.imports_len + 1, sizeof(char *));
+  ok = true;
+
+  for (size_t i = 0; i < parse->ast.imports_len; i++) {
+    import = &parse->ast.imports[i];
+    paths[i] = source_resolve(loader, file, import);
+
+    if (paths[i] == NULL) {
+      fprint_error(stderr, "cannot find '%.*s'", import->path.len, import->path.chars);
+      fprint_error_ctx(stderr, parse->src, 1, 0, import->len, import->loc, "loaded here");
+
+      if (import->search)
+        fprint_help(stderr, "#import looks next to this file, in every --import-path, then next to the main file");
+      else
+        fprint_help(stderr, "#load paths are relative to the file loading them");
+
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    file->deps = calloc(parse->ast.imports_len + 1, sizeof(struct source_file *));
+
+    pthread_mutex_lock(&loader->lock);
+
+    for (size_t i = 0; i < parse->ast.imports_len; i++)
+      file->deps[i] = source_add(loader, paths[i]);
+
+    pthread_mutex_unlock(&loader->lock);
+  } else {
+    for (size_t i = 0; i < parse->ast.imports_len; i++)
+      free(paths[i]);
+  }
+
+  free(paths);
+
+  return ok;
+}
+
+static void *source_worker(void *udata) {
+  struct source_loader *loader = udata;
+  struct sources *sources = loader->sources;
+  struct source_file *file;
+  bool ok;
+
+  pthread_mutex_lock(&loader->lock);
+
+  while (true) {
+    while (!loader->failed && loader->next == sources->files_len && loader->active > 0)
+      pthread_cond_wait(&loader->cond, &loader->lock);
+
+    if (loader->failed || loader->next == sources->files_len)
+      break;
+
+    file = sources->files[loader->next++];
+    loader->active++;
+    pthread_mutex_unlock(&loader->lock);
+
+    ok = source_process(loader, file, file->path);
+
+    pthread_mutex_lock(&loader->lock);
+    loader->failed |= !ok;
+    loader->active--;
+    pthread_cond_broadcast(&loader->cond);
+  }
+
+  pthread_mutex_unlock(&loader->lock);
+
+  return NULL;
+}
+
+/* Appends `file` and then its imports to `files`, depth first. */
+static void source_order(struct source_file *file, struct hashmap *seen, struct source_file **files, size_t *files_len) {
+  if (hashmap_get(seen, &file) != NULL)
+    return;
+
+  hashmap_set(seen, &file);
+  files[(*files_len)++] = file;
+
+  for (size_t i = 0; i < file->parse->ast.imports_len; i++)
+    source_order(file->deps[i], seen, files, files_len);
+}
+
+bool sources_load(struct sources *sources, const char *filename,
+  size_t import_dirs_len, const char **import_dirs, size_t threads,
+  struct source_cache *cache)
+{
+  struct source_loader loader = {
+    .sources = sources,
+    .import_dirs_len = import_dirs_len,
+    .import_dirs = import_dirs,
+    .cache = cache,
+  };
+  struct source_file **files, *root;
+  struct hashmap *seen;
+  pthread_t *workers;
+  size_t workers_len = 0, files_len = 0, consts_len = 0;
+  char *path;
+
+  sources->files_len = 0;
+  sources->files = NULL;
+  sources->ast = (struct ast) { 0 };
+
+  path = realpath(filename, NULL);
+
+  if (path == NULL) {
+    fprintf(stderr, "Failed to open file %s. %s\n", filename, strerror(errno));
+    return false;
+  }
+
+  loader.by_path = hashmap_new_with_allocator(mem_hashmap_malloc, mem_hashmap_realloc,
+    mem_hashmap_free, sizeof(struct source_file *), 16, 0, 0,
+    source_hash, source_compare, NULL, NULL);
+  pthread_mutex_init(&loader.lock, NULL);
+  pthread_cond_init(&loader.cond, NULL);
+
+  // The root is parsed before any thread is started, most programs are a
+  // single file.
+  root = source_add(&loader, path);
+  loader.root = root;
+  loader.next = 1;
+  loader.failed = !source_process(&loader, root, filename);
+
+  if (!loader.failed && sources->files_len > 1 && threads > 1) {
+    workers = malloc(sizeof(pthread_t) * (threads - 1));
+
+    for (; workers_len < threads - 1; workers_len++) {
+      if (pthread_create(&workers[workers_len], NULL, source_worker, &loader) != 0)
+        break;
+    }
+
+    source_worker(&loader);
+
+    for (size_t i = 0; i < workers_len; i++)
+      pthread_join(workers[i], NULL);
+
+    free(workers);
+  } else if (!loader.failed) {
+    source_worker(&loader);
+  }
+
+  hashmap_free(loader.by_path);
+  pthread_mutex_destroy(&loader.lock);
+  pthread_cond_destroy(&loader.cond);
+
+  if (loader.failed)
+    return false;
+
+  files = malloc(sizeof(struct source_file *) * sources->files_len);
+  seen = hashmap_new_with_allocator(mem_hashmap_malloc, mem_hashmap_realloc,
+    mem_hashmap_free, sizeof(struct source_file *), 16, 0, 0,
+    source_hash, source_compare, NULL, NULL);
+
+  source_order(root, seen, files, &files_len);
+  hashmap_free(seen);
+  free(sources->files);
+  sources->files = files;
+
+  for (size_t i = 0; i < files_len; i++)
+    consts_len += files[i]->parse->ast.consts_len;
+
+  sources->ast.consts_len = consts_len;
+  sources->ast.consts = malloc(sizeof(struct ast_const) * (consts_len + 1));
+  consts_len = 0;
+
+  for (size_t i = 0; i < files_len; i++) {
+    memcpy(&sources->ast.consts[consts_len], files[i]->parse->ast.consts,
+      sizeof(struct ast_const) * files[i]->parse->ast.consts_len);
+    consts_len += files[i]->parse->ast.consts_len;
+  }
+
+  return true;
+}
+
+void sources_free(struct sources *sources) {
+  struct source_file *file;
+
+  for (size_t i = 0; i < sources->files_len; i++) {
+    file = sources->files[i];
+
+    if (file->parse != NULL)
+      source_parse_release(file->parse);
+
+    free(file->deps);
+    free(file->path);
+    free(file);
+  }
+
+  free(sources->files);
+  free(sources->ast.consts);
+}
@@ -0,0 +1,62 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "ast.h"
+
+struct source_cache;
+
+/* The parse of a file. Every parse gets its own arena and lexer, so that
+ * files can be parsed in parallel, and a compile server shares it between
+ * requests for as long as the file doesn't change. */
+struct source_parse {
+  char *src;
+  size_t src_len;
+  struct arena *arena;
+  struct ast ast;
+  /* How the file looked when it was read. */
+  struct timespec mtime;
+  off_t size;
+  /* Held by every load using it, and by the cache it is in. */
+  size_t refs;
+  struct source_cache *cache;
+};
+
+struct source_file {
+  /* The canonical path, files are only loaded once however many files
+   * import them. */
+  char *path;
+  struct source_parse *parse;
+  /* The files loaded by the imports of `parse`, in the same order. */
+  struct source_file **deps;
+};
+
+struct sources {
+  /* Ordered depth first from the root, the order doesn't depend on which
+   * thread parsed what. */
+  size_t files_len;
+  struct source_file **files;
+  /* The constants of every file, which emit_ast puts in one global scope. */
+  struct ast ast;
+};
+
+/* Parses `filename` and everything it imports, on up to `threads` threads.
+ * #import looks next to the importing file, then in `import_dirs`, then next
+ * to `filename`. Files which are in `cache`, if it isn't NULL, and haven't
+ * changed since are not parsed again. */
+bool sources_load(struct sources *sources, const char *filename,
+  size_t import_dirs_len, const char **import_dirs, size_t threads,
+  struct source_cache *cache);
+void sources_free(struct sources *sources);
+
+struct source_cache *source_cache_new();
+void source_cache_free(struct source_cache *cache);
+/* Calls `fn` with every path a load through `cache` has looked at, whether
+ * or not it parsed. */
+void source_cache_scan(struct source_cache *cache, void (*fn)(const char *path, void *udata), void *udata);
+
+#endif /* SOURCE_H */
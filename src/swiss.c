@@ -0,0 +1,271 @@
+#include "swiss.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* How many control bytes are compared at once. */
+#define SWISS_GROUP 16
+
+/* Control bytes of slots without an item, both with the top bit set. Full
+ * slots hold the low 7 bits of the hash of their item. */
+#define SWISS_EMPTY 0x80
+#define SWISS_DELETED 0xfe
+
+struct swiss {
+  void *(*malloc)(size_t);
+  void (*free)(void *);
+  uint64_t seed0, seed1;
+  uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1);
+  int (*compare)(const void *a, const void *b, void *udata);
+  void *udata;
+
+  size_t elsize;
+  /* A power of two, and a whole number of groups. */
+  size_t cap;
+  size_t count;
+  /* Deleted slots still make probes go on, so they count towards growing. */
+  size_t deleted;
+  /* cap control bytes followed by cap slots, in one allocation. */
+  uint8_t *ctrl;
+  char *slots;
+  /* Where swiss_set and swiss_delete copy the item they return. */
+  char spare[];
+};
+
+/* A bit for each of the 16 control bytes at `ctrl` which is `byte`. */
+static inline uint32_t swiss_match(const uint8_t *ctrl, uint8_t byte) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+  uint32_t bits = 0;
+
+  for (size_t i = 0; i < SWISS_GROUP; i++)
+    bits |= (uint32_t)(ctrl[i] == byte) << i;
+
+  return bits;
+#endif
+}
+
+/* A bit for each of the 16 slots at `ctrl` which is empty or deleted. */
+static inline uint32_t swiss_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+  uint32_t bits = 0;
+
+  for (size_t i = 0; i < SWISS_GROUP; i++)
+    bits |= (uint32_t)(ctrl[i] >> 7) << i;
+
+  return bits;
+#endif
+}
+
+static inline char *swiss_slot(struct swiss *map, size_t slot) {
+  return map->slots + map->elsize * slot;
+}
+
+/* The most items and deleted slots there can be before the table grows, 7/8
+ * of it, so that every probe ends at an empty slot. */
+static inline size_t swiss_max(size_t cap) {
+  return cap - cap / 8;
+}
+
+static void swiss_alloc(struct swiss *map, size_t cap) {
+  map->cap = cap;
+  map->ctrl = map->malloc(cap + cap * map->elsize);
+  map->slots = (char *)map->ctrl + cap;
+  memset(map->ctrl, SWISS_EMPTY, cap);
+}
+
+struct swiss *swiss_new_with_allocator(void *(*malloc)(size_t), void (*free)(void *),
+  size_t elsize, size_t cap, uint64_t seed0, uint64_t seed1,
+  uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1),
+  int (*compare)(const void *a, const void *b, void *udata),
+  void *udata)
+{
+  struct swiss *map = malloc(sizeof(struct swiss) + elsize);
+  size_t ncap = SWISS_GROUP;
+
+  while (ncap < cap)
+    ncap *= 2;
+
+  map->malloc = malloc;
+  map->free = free;
+  map->seed0 = seed0;
+  map->seed1 = seed1;
+  map->hash = hash;
+  map->compare = compare;
+  map->udata = udata;
+  map->elsize = elsize;
+  map->count = 0;
+  map->deleted = 0;
+  swiss_alloc(map, ncap);
+
+  return map;
+}
+
+struct swiss *swiss_new(size_t elsize, size_t cap, uint64_t seed0, uint64_t seed1,
+  uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1),
+  int (*compare)(const void *a, const void *b, void *udata),
+  void *udata)
+{
+  return swiss_new_with_allocator(malloc, free, elsize, cap, seed0, seed1, hash, compare, udata);
+}
+
+void swiss_free(struct swiss *map) {
+  if (map == NULL)
+    return;
+
+  map->free(map->ctrl);
+  map->free(map);
+}
+
+void swiss_clear(struct swiss *map) {
+  memset(map->ctrl, SWISS_EMPTY, map->cap);
+  map->count = 0;
+  map->deleted = 0;
+}
+
+size_t swiss_count(struct swiss *map) {
+  return map->count;
+}
+
+/* Returns the item equal to `item`, or NULL. Groups are probed at 1, 2, 3...
+ * groups from the last, which visits every group when there is a power of two
+ * of them. */
+static inline char *swiss_find(struct swiss *map, const void *item, uint64_t hash) {
+  size_t mask = map->cap / SWISS_GROUP - 1, group = (hash >> 7) & mask;
+  const uint8_t *ctrl;
+  char *slot;
+  uint32_t bits;
+
+  for (size_t i = 1; ; i++) {
+    ctrl = &map->ctrl[group * SWISS_GROUP];
+
+    for (bits = swiss_match(ctrl, hash & 0x7f); bits != 0; bits &= bits - 1) {
+      slot = swiss_slot(map, group * SWISS_GROUP + __builtin_ctz(bits));
+
+      if (map->compare(item, slot, map->udata) == 0)
+        return slot;
+    }
+
+    // An item is never put past a group with an empty slot.
+    if (swiss_match(ctrl, SWISS_EMPTY) != 0)
+      return NULL;
+
+    group = (group + i) & mask;
+  }
+}
+
+/* Returns the first empty or deleted slot on the probe of `hash`. */
+static size_t swiss_find_free(struct swiss *map, uint64_t hash) {
+  size_t mask = map->cap / SWISS_GROUP - 1, group = (hash >> 7) & mask;
+  uint32_t bits;
+
+  for (size_t i = 1; ; i++) {
+    bits = swiss_match_free(&map->ctrl[group * SWISS_GROUP]);
+
+    if (bits != 0)
+      return group * SWISS_GROUP + __builtin_ctz(bits);
+
+    group = (group + i) & mask;
+  }
+}
+
+/* Moves every item to a new table of `cap` slots, dropping deleted ones. */
+static void swiss_resize(struct swiss *map, size_t cap) {
+  uint8_t *ctrl = map->ctrl;
+  char *slots = map->slots;
+  size_t old_cap = map->cap, slot;
+  uint64_t hash;
+
+  swiss_alloc(map, cap);
+  map->deleted = 0;
+
+  for (size_t i = 0; i < old_cap; i++) {
+    if (ctrl[i] & 0x80)
+      continue;
+
+    hash = map->hash(slots + map->elsize * i, map->seed0, map->seed1);
+    slot = swiss_find_free(map, hash);
+    map->ctrl[slot] = hash & 0x7f;
+    memcpy(swiss_slot(map, slot), slots + map->elsize * i, map->elsize);
+  }
+
+  map->free(ctrl);
+}
+
+const void *swiss_get(struct swiss *map, const void *item) {
+  return swiss_find(map, item, map->hash(item, map->seed0, map->seed1));
+}
+
+const void *swiss_set(struct swiss *map, const void *item) {
+  uint64_t hash = map->hash(item, map->seed0, map->seed1);
+  char *found = swiss_find(map, item, hash);
+  size_t slot;
+
+  if (found != NULL) {
+    memcpy(map->spare, found, map->elsize);
+    memcpy(found, item, map->elsize);
+
+    return map->spare;
+  }
+
+  // Mostly deleted slots are cleaned up without growing.
+  if (map->count + map->deleted + 1 > swiss_max(map->cap))
+    swiss_resize(map, map->count + 1 > swiss_max(map->cap) / 2 ? map->cap * 2 : map->cap);
+
+  slot = swiss_find_free(map, hash);
+
+  if (map->ctrl[slot] == SWISS_DELETED)
+    map->deleted--;
+
+  map->ctrl[slot] = hash & 0x7f;
+  memcpy(swiss_slot(map, slot), item, map->elsize);
+  map->count++;
+
+  return NULL;
+}
+
+const void *swiss_delete(struct swiss *map, const void *item) {
+  char *found = swiss_find(map, item, map->hash(item, map->seed0, map->seed1));
+  size_t slot;
+  uint8_t *group;
+
+  if (found == NULL)
+    return NULL;
+
+  slot = (found - map->slots) / map->elsize;
+  memcpy(map->spare, found, map->elsize);
+  map->count--;
+
+  // A group with an empty slot has had one since the table was last built,
+  // so no probe ever went past it and the slot can be empty again.
+  group = &map->ctrl[slot / SWISS_GROUP * SWISS_GROUP];
+
+  if (swiss_match(group, SWISS_EMPTY) != 0) {
+    map->ctrl[slot] = SWISS_EMPTY;
+  } else {
+    map->ctrl[slot] = SWISS_DELETED;
+    map->deleted++;
+  }
+
+  return map->spare;
+}
+
+bool swiss_iter(struct swiss *map, size_t *i, void **item) {
+  for (; *i < map->cap; (*i)++) {
+    if (!(map->ctrl[*i] & 0x80)) {
+      *item = swiss_slot(map, (*i)++);
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,42 @@
+#ifndef SWISS_H
+#define SWISS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An open addressing hash table in the style of Abseil's Swiss tables. Next to
+ * the items is one control byte per slot, holding 7 bits of the item's hash or
+ * marking the slot empty or deleted, and lookups compare a group of 16 control
+ * bytes at once with SSE2. It takes the same hash and compare functions as
+ * hashmap.h, and swiss_set and swiss_get behave like hashmap_set and
+ * hashmap_get. Scopes still use hashmap.h: with a handful of identifiers in
+ * a map, hashing them is most of the work and this table is no faster there,
+ * see the swiss/ benchmarks of bench/micro.c. */
+struct swiss;
+
+struct swiss *swiss_new_with_allocator(void *(*malloc)(size_t), void (*free)(void *),
+  size_t elsize, size_t cap, uint64_t seed0, uint64_t seed1,
+  uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1),
+  int (*compare)(const void *a, const void *b, void *udata),
+  void *udata);
+struct swiss *swiss_new(size_t elsize, size_t cap, uint64_t seed0, uint64_t seed1,
+  uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1),
+  int (*compare)(const void *a, const void *b, void *udata),
+  void *udata);
+void swiss_free(struct swiss *map);
+void swiss_clear(struct swiss *map);
+size_t swiss_count(struct swiss *map);
+
+/* Returns the item equal to `item`, or NULL. */
+const void *swiss_get(struct swiss *map, const void *item);
+/* Inserts a copy of `item`, replacing an equal one. Returns the item which
+ * was replaced, valid until the next call which changes `map`, or NULL. */
+const void *swiss_set(struct swiss *map, const void *item);
+/* Removes the item equal to `item`, and returns it like swiss_set, or NULL
+ * if there was none. */
+const void *swiss_delete(struct swiss *map, const void *item);
+/* Steps through the items, starting with `*i` at 0, like hashmap_iter. */
+bool swiss_iter(struct swiss *map, size_t *i, void **item);
+
+#endif /* SWISS_H */
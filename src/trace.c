@@ -0,0 +1,588 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+
+#define TRACE_REPORT_PROCS 10
+
+struct trace_event {
+  enum trace_phase phase;
+  char *detail;
+  uint64_t start, end, cpu;
+  size_t mem;
+  pid_t pid, tid;
+  struct mem_sample allocs;
+  struct perf_sample counters;
+};
+
+static const char *trace_phase_names[] = {
+  [TRACE_LEX] = "lex",
+  [TRACE_PARSE] = "parse",
+  [TRACE_EMIT] = "emit",
+  [TRACE_PASSES] = "passes",
+  [TRACE_SSA] = "ssa",
+  [TRACE_QBE] = "qbe",
+  [TRACE_CC] = "cc",
+  [TRACE_RUN] = "run",
+  [TRACE_PROC] = "proc",
+  [TRACE_SCOPE] = "scopes",
+};
+
+/* What trace_items counts in each phase. */
+static const char *trace_item_names[] = {
+  [TRACE_LEX] = "tokens",
+  [TRACE_PARSE] = "nodes",
+  [TRACE_EMIT] = "insts",
+  [TRACE_SSA] = "bytes",
+};
+
+/* A phase added up over all its spans. */
+struct trace_total {
+  uint64_t wall, cpu;
+  size_t mem, spans;
+};
+
+static struct {
+  bool active;
+  pthread_mutex_t lock;
+  size_t events_len, events_cap;
+  struct trace_event *events;
+  uint64_t start;
+  struct rusage self, children;
+  /* What the hardware counters counted in each phase. */
+  struct perf_sample counters[TRACE_SCOPE + 1];
+  struct mem_sample allocs[TRACE_SCOPE + 1];
+  uint64_t items[TRACE_SCOPE + 1];
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t trace_clock(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t trace_rusage_cpu(const struct rusage *usage) {
+  return (uint64_t)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000000
+    + (uint64_t)(usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) * 1000;
+}
+
+static void trace_clear() {
+  for (size_t i = 0; i < trace.events_len; i++)
+    free(trace.events[i].detail);
+
+  free(trace.events);
+  trace.events = NULL;
+  trace.events_len = trace.events_cap = 0;
+}
+
+void trace_start(bool counters) {
+  trace_clear();
+  memset(trace.counters, 0, sizeof(trace.counters));
+  memset(trace.allocs, 0, sizeof(trace.allocs));
+  memset(trace.items, 0, sizeof(trace.items));
+
+  if (counters)
+    perf_open();
+
+  trace.start = trace_clock(CLOCK_MONOTONIC);
+  getrusage(RUSAGE_SELF, &trace.self);
+  getrusage(RUSAGE_CHILDREN, &trace.children);
+  trace.active = true;
+}
+
+bool trace_active() {
+  return trace.active;
+}
+
+struct trace_mark trace_mark() {
+  if (!trace.active)
+    return (struct trace_mark) { 0 };
+
+  struct trace_mark mark = {
+    .wall = trace_clock(CLOCK_MONOTONIC),
+    .cpu = trace_clock(CLOCK_THREAD_CPUTIME_ID),
+  };
+
+  mem_read(&mark.allocs);
+
+  // The counters are read last, and first at the end of the span, so they
+  // count as little of the tracing itself as possible.
+  perf_read(&mark.counters);
+
+  return mark;
+}
+
+size_t trace_heap() {
+  struct mallinfo2 info;
+
+  if (!trace.active)
+    return 0;
+
+  info = mallinfo2();
+
+  return info.uordblks + info.hblkhd;
+}
+
+size_t trace_heap_since(size_t heap) {
+  size_t now = trace_heap();
+
+  return now > heap ? now - heap : 0;
+}
+
+static void trace_add_counters(enum trace_phase phase, const struct perf_sample *counters) {
+  for (size_t i = 0; i < PERF_COUNTERS_LEN; i++)
+    trace.counters[phase].counts[i] += counters->counts[i];
+}
+
+static void trace_add(struct trace_event *event) {
+  pthread_mutex_lock(&trace.lock);
+
+  trace_add_counters(event->phase, &event->counters);
+  trace.allocs[event->phase].allocs += event->allocs.allocs;
+  trace.allocs[event->phase].bytes += event->allocs.bytes;
+
+  if (trace.events_len >= trace.events_cap) {
+    trace.events_cap = trace.events_cap == 0 ? 64 : trace.events_cap * 2;
+    trace.events = realloc(trace.events, sizeof(struct trace_event) * trace.events_cap);
+  }
+
+  trace.events[trace.events_len++] = *event;
+
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_span(enum trace_phase phase, int detail_len, const char *detail,
+  struct trace_mark start, size_t mem)
+{
+  struct trace_event event = { .phase = phase, .start = start.wall, .mem = mem };
+
+  if (!trace.active)
+    return;
+
+  if (perf_active())
+    perf_since(&event.counters, &start.counters);
+
+  event.end = trace_clock(CLOCK_MONOTONIC);
+  event.cpu = trace_clock(CLOCK_THREAD_CPUTIME_ID) - start.cpu;
+  mem_read(&event.allocs);
+  event.allocs.allocs -= start.allocs.allocs;
+  event.allocs.bytes -= start.allocs.bytes;
+  event.pid = getpid();
+  event.tid = gettid();
+
+  if (detail != NULL)
+    event.detail = strndup(detail, detail_len);
+
+  trace_add(&event);
+}
+
+void trace_count(enum trace_phase phase, const struct perf_sample *start) {
+  struct perf_sample counters;
+
+  if (!perf_active())
+    return;
+
+  perf_since(&counters, start);
+
+  pthread_mutex_lock(&trace.lock);
+  trace_add_counters(phase, &counters);
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_items(enum trace_phase phase, uint64_t items) {
+  if (!trace.active)
+    return;
+
+  __atomic_add_fetch(&trace.items[phase], items, __ATOMIC_RELAXED);
+}
+
+void trace_child(enum trace_phase phase, char *argv[], pid_t pid,
+  struct trace_mark start, const struct rusage *usage)
+{
+  struct trace_event event = { .phase = phase, .start = start.wall, .pid = pid, .tid = pid };
+  size_t len = 0;
+
+  if (!trace.active)
+    return;
+
+  event.end = trace_clock(CLOCK_MONOTONIC);
+  event.cpu = trace_rusage_cpu(usage);
+  event.mem = (size_t)usage->ru_maxrss * 1024;
+
+  for (size_t i = 0; argv[i] != NULL; i++)
+    len += strlen(argv[i]) + 1;
+
+  event.detail = malloc(len + 1);
+  event.detail[0] = 0;
+
+  for (size_t i = 0; argv[i] != NULL; i++) {
+    if (i > 0)
+      strcat(event.detail, " ");
+
+    strcat(event.detail, argv[i]);
+  }
+
+  trace_add(&event);
+}
+
+static int trace_compare_start(const void *a, const void *b) {
+  const struct trace_event *x = *(const struct trace_event **)a, *y = *(const struct trace_event **)b;
+
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+
+  // A span which started at the same time as another but ends later
+  // contains it.
+  return x->end > y->end ? -1 : x->end < y->end;
+}
+
+struct trace_proc {
+  struct trace_event *event;
+  uint64_t self;
+};
+
+static int trace_compare_self(const void *a, const void *b) {
+  const struct trace_proc *x = a, *y = b;
+
+  return x->self > y->self ? -1 : x->self < y->self;
+}
+
+/* Prints the time of each procedure, not counting the procedures emitted
+ * while it was, which are the ones it is the first to call. */
+static void trace_report_procs() {
+  struct trace_event **events = malloc(sizeof(struct trace_event *) * (trace.events_len + 1));
+  struct trace_proc *procs = malloc(sizeof(struct trace_proc) * (trace.events_len + 1));
+  size_t *stack = malloc(sizeof(size_t) * (trace.events_len + 1));
+  size_t events_len = 0, stack_len = 0;
+
+  for (size_t i = 0; i < trace.events_len; i++) {
+    if (trace.events[i].phase == TRACE_PROC)
+      events[events_len++] = &trace.events[i];
+  }
+
+  qsort(events, events_len, sizeof(struct trace_event *), trace_compare_start);
+
+  for (size_t i = 0; i < events_len; i++) {
+    while (stack_len > 0 && procs[stack[stack_len - 1]].event->end <= events[i]->start)
+      stack_len--;
+
+    procs[i].event = events[i];
+    procs[i].self = events[i]->end - events[i]->start;
+
+    if (stack_len > 0)
+      procs[stack[stack_len - 1]].self -= procs[i].self;
+
+    stack[stack_len++] = i;
+  }
+
+  qsort(procs, events_len, sizeof(struct trace_proc), trace_compare_self);
+
+  if (events_len > 0)
+    fprintf(stderr, "\n%-24s %12s\n", "proc", "emit (us)");
+
+  for (size_t i = 0; i < events_len && i < TRACE_REPORT_PROCS; i++)
+    fprintf(stderr, "%-24s %12.1f\n", procs[i].event->detail, procs[i].self / 1000.0);
+
+  if (events_len > TRACE_REPORT_PROCS)
+    fprintf(stderr, "... and %zu more\n", events_len - TRACE_REPORT_PROCS);
+
+  free(stack);
+  free(procs);
+  free(events);
+}
+
+/* Adds up the spans of each phase but TRACE_PROC, and the whole compile in
+ * `total`, what this process and its children used since trace_start. */
+static void trace_sum(struct trace_total phases[TRACE_PROC], struct trace_total *total,
+  long *maxrss, uint64_t end)
+{
+  struct trace_event *event;
+  struct rusage self, children;
+  pid_t pid = getpid();
+
+  memset(phases, 0, sizeof(struct trace_total) * TRACE_PROC);
+
+  for (size_t i = 0; i < trace.events_len; i++) {
+    event = &trace.events[i];
+
+    if (event->phase == TRACE_PROC)
+      continue;
+
+    phases[event->phase].wall += event->end - event->start;
+    phases[event->phase].cpu += event->cpu;
+    phases[event->phase].spans++;
+
+    // What a phase allocated adds up, but child processes each have their
+    // own memory, so they count by the biggest.
+    if (event->pid == pid)
+      phases[event->phase].mem += event->mem;
+    else if (event->mem > phases[event->phase].mem)
+      phases[event->phase].mem = event->mem;
+  }
+
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+
+  total->wall = end - trace.start;
+  total->cpu = trace_rusage_cpu(&self) - trace_rusage_cpu(&trace.self)
+    + trace_rusage_cpu(&children) - trace_rusage_cpu(&trace.children);
+  *maxrss = self.ru_maxrss;
+}
+
+static void trace_report(uint64_t end) {
+  struct trace_total phases[TRACE_PROC], total;
+  long maxrss;
+
+  trace_sum(phases, &total, &maxrss, end);
+
+  fprintf(stderr, "%-12s %12s %12s %12s %12s\n", "phase", "wall (ms)", "cpu (ms)", "mem (KiB)",
+    "items");
+
+  for (size_t i = 0; i < TRACE_PROC; i++) {
+    if (phases[i].spans == 0)
+      continue;
+
+    fprintf(stderr, "%-12s %12.3f %12.3f %12zu", trace_phase_names[i],
+      phases[i].wall / 1e6, phases[i].cpu / 1e6, phases[i].mem / 1024);
+
+    if (trace.items[i] > 0)
+      fprintf(stderr, " %12lu %s", trace.items[i], trace_item_names[i]);
+
+    fprintf(stderr, "\n");
+  }
+
+  fprintf(stderr, "%-12s %12.3f %12.3f %12ld\n", "total", total.wall / 1e6, total.cpu / 1e6,
+    maxrss);
+
+  trace_report_procs();
+}
+
+/* Writes what trace_report prints as one JSON object, for tools which keep
+ * track of how fast compiles are. */
+static bool trace_write_report(const char *path, uint64_t end) {
+  FILE *fptr = fopen(path, "w");
+  struct trace_total phases[TRACE_PROC], total;
+  long maxrss;
+  bool first = true;
+
+  if (fptr == NULL) {
+    fprint_error(stderr, "failed to write the report to '%s': %s", path, strerror(errno));
+    return false;
+  }
+
+  trace_sum(phases, &total, &maxrss, end);
+
+  fprintf(fptr, "{\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"mem_kib\":%ld},\"phases\":{",
+    total.wall / 1e6, total.cpu / 1e6, maxrss);
+
+  for (size_t i = 0; i < TRACE_PROC; i++) {
+    if (phases[i].spans == 0)
+      continue;
+
+    fprintf(fptr, "%s\n\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"mem_kib\":%zu",
+      first ? "" : ",", trace_phase_names[i], phases[i].wall / 1e6, phases[i].cpu / 1e6,
+      phases[i].mem / 1024);
+
+    if (trace.items[i] > 0)
+      fprintf(fptr, ",\"%s\":%lu", trace_item_names[i], trace.items[i]);
+
+    fprintf(fptr, "}");
+    first = false;
+  }
+
+  fprintf(fptr, "\n}}\n");
+
+  if (fclose(fptr) != 0) {
+    fprint_error(stderr, "failed to write the report to '%s': %s", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+/* Prints a rate of `count` per `per`, scaled by `scale`, or a dash if the
+ * counter isn't there. */
+static void trace_report_rate(enum perf_counter counter, uint64_t count, uint64_t per, double scale) {
+  if (perf_available(counter) && per > 0)
+    fprintf(stderr, " %12.2f", (double)count * scale / per);
+  else
+    fprintf(stderr, " %12s", "-");
+}
+
+/* Prints what the hardware counters counted in each phase, as instructions
+ * per cycle, cache misses per thousand instructions and the share of
+ * branches which were mispredicted. */
+static void trace_report_counters() {
+  uint64_t *counts;
+
+  fprintf(stderr, "%-12s %14s %14s %12s %12s %12s %12s\n", "phase", "cycles", "instructions",
+    "IPC", "L1d MPKI", "LLC MPKI", "br miss %");
+
+  for (size_t i = 0; i <= TRACE_SCOPE; i++) {
+    counts = trace.counters[i].counts;
+
+    // Only this process is counted, qbe and cc aren't.
+    if (i == TRACE_PROC || counts[PERF_INSTRUCTIONS] == 0)
+      continue;
+
+    fprintf(stderr, "%-12s %14lu %14lu", i == TRACE_SCOPE ? "emit scopes" : trace_phase_names[i],
+      counts[PERF_CYCLES], counts[PERF_INSTRUCTIONS]);
+    trace_report_rate(PERF_CYCLES, counts[PERF_INSTRUCTIONS], counts[PERF_CYCLES], 1);
+    trace_report_rate(PERF_L1D_MISSES, counts[PERF_L1D_MISSES], counts[PERF_INSTRUCTIONS], 1000);
+    trace_report_rate(PERF_LLC_MISSES, counts[PERF_LLC_MISSES], counts[PERF_INSTRUCTIONS], 1000);
+    trace_report_rate(PERF_BRANCH_MISSES, counts[PERF_BRANCH_MISSES], counts[PERF_BRANCHES], 100);
+    fprintf(stderr, "\n");
+  }
+}
+
+/* Prints the counted allocations made in each phase. */
+static void trace_report_allocs() {
+  fprintf(stderr, "%-12s %12s %12s\n", "phase", "allocs", "bytes");
+
+  for (size_t i = 0; i < TRACE_PROC; i++) {
+    if (trace.allocs[i].allocs > 0)
+      fprintf(stderr, "%-12s %12lu %12lu\n", trace_phase_names[i], trace.allocs[i].allocs, trace.allocs[i].bytes);
+  }
+}
+
+static void trace_write_string(FILE *fptr, const char *s) {
+  fputc('"', fptr);
+
+  for (; *s != 0; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fptr, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fptr, "\\u%04x", *s);
+    else
+      fputc(*s, fptr);
+  }
+
+  fputc('"', fptr);
+}
+
+static void trace_write_name(FILE *fptr, const char *kind, pid_t pid, pid_t tid, const char *name) {
+  fprintf(fptr, ",\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":",
+    kind, (long)pid, (long)tid);
+  trace_write_string(fptr, name);
+  fprintf(fptr, "}}");
+}
+
+/* Writes the events in the Chrome trace event format, which Perfetto and
+ * chrome://tracing open. Child processes show up as processes of their own. */
+static bool trace_write(const char *path) {
+  FILE *fptr = fopen(path, "w");
+  struct trace_event *event;
+  pid_t pid = getpid(), *seen;
+  size_t seen_len = 0;
+  bool found;
+
+  if (fptr == NULL) {
+    fprint_error(stderr, "failed to write the trace to '%s': %s", path, strerror(errno));
+    return false;
+  }
+
+  fprintf(fptr, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(fptr, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"jotunheim\"}}",
+    (long)pid, (long)pid);
+
+  seen = malloc(sizeof(pid_t) * (trace.events_len + 1));
+
+  for (size_t i = 0; i < trace.events_len; i++) {
+    event = &trace.events[i];
+    found = false;
+
+    for (size_t j = 0; j < seen_len && !found; j++)
+      found = seen[j] == event->tid;
+
+    if (found)
+      continue;
+
+    seen[seen_len++] = event->tid;
+
+    if (event->pid != pid)
+      trace_write_name(fptr, "process_name", event->pid, event->tid, trace_phase_names[event->phase]);
+    else
+      trace_write_name(fptr, "thread_name", event->pid, event->tid, event->tid == pid ? "main" : "loader");
+  }
+
+  free(seen);
+
+  for (size_t i = 0; i < trace.events_len; i++) {
+    event = &trace.events[i];
+
+    fprintf(fptr, ",\n{\"name\":");
+    trace_write_string(fptr, event->phase == TRACE_PROC ? event->detail : trace_phase_names[event->phase]);
+    fprintf(fptr, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld,"
+      "\"args\":{\"cpu_us\":%.3f,\"mem_bytes\":%zu",
+      event->phase == TRACE_PROC ? "emit" : "phase",
+      (event->start - trace.start) / 1e3, (event->end - event->start) / 1e3,
+      (long)event->pid, (long)event->tid, event->cpu / 1e3, event->mem);
+
+    if (event->counters.counts[PERF_INSTRUCTIONS] > 0) {
+      fprintf(fptr, ",\"cycles\":%lu,\"instructions\":%lu",
+        event->counters.counts[PERF_CYCLES], event->counters.counts[PERF_INSTRUCTIONS]);
+    }
+
+    if (event->phase != TRACE_PROC && event->detail != NULL) {
+      fprintf(fptr, ",\"%s\":", event->pid == pid ? "file" : "command");
+      trace_write_string(fptr, event->detail);
+    }
+
+    fprintf(fptr, "}}");
+  }
+
+  fprintf(fptr, "\n]}\n");
+
+  if (fclose(fptr) != 0) {
+    fprint_error(stderr, "failed to write the trace to '%s': %s", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool trace_finish(bool report, const char *report_path, const char *trace_path) {
+  uint64_t end = trace_clock(CLOCK_MONOTONIC);
+  bool ok = true, counters = perf_active();
+
+  trace.active = false;
+
+  if (report)
+    trace_report(end);
+
+  if (counters) {
+    if (report)
+      fprintf(stderr, "\n");
+
+    trace_report_counters();
+    perf_close();
+  }
+
+  if (mem_active()) {
+    if (report || counters)
+      fprintf(stderr, "\n");
+
+    trace_report_allocs();
+  }
+
+  if (report_path != NULL)
+    ok = trace_write_report(report_path, end);
+
+  if (trace_path != NULL)
+    ok = trace_write(trace_path) && ok;
+
+  trace_clear();
+
+  return ok;
+}
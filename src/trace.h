@@ -0,0 +1,72 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "mem.h"
+#include "perf.h"
+
+/* Where the time of a compile goes, for --time-report and --trace. Spans
+ * are only recorded between trace_start and trace_finish, the rest of the
+ * time every call here returns straight away. */
+enum trace_phase {
+  TRACE_LEX,
+  TRACE_PARSE,
+  TRACE_EMIT,
+  TRACE_PASSES,
+  TRACE_SSA,
+  TRACE_QBE,
+  TRACE_CC,
+  TRACE_RUN,
+  /* The emission of one procedure, nested in TRACE_EMIT. */
+  TRACE_PROC,
+  /* Lookups and insertions in scopes, which are only counted. */
+  TRACE_SCOPE,
+};
+
+/* When a span started, on the wall clock, in CPU time of the thread, on
+ * the hardware counters if they are on and in counted allocations. */
+struct trace_mark {
+  uint64_t wall;
+  uint64_t cpu;
+  struct mem_sample allocs;
+  struct perf_sample counters;
+};
+
+/* Starts recording, and counting with the hardware counters if `counters`
+ * and the machine has them. */
+void trace_start(bool counters);
+/* Prints the report to stderr if `report`, what the hardware counters
+ * counted if they were on, and the allocations of each phase if they were
+ * counted. Writes the report as JSON to `report_path` and the Chrome trace
+ * to `trace_path` if they aren't NULL. Returns false if either couldn't be
+ * written. */
+bool trace_finish(bool report, const char *report_path, const char *trace_path);
+bool trace_active();
+
+struct trace_mark trace_mark();
+/* Bytes malloc has handed out. */
+size_t trace_heap();
+/* How many more bytes malloc has handed out than `heap`, or 0 if fewer. */
+size_t trace_heap_since(size_t heap);
+
+/* Records that `phase` ran on this thread from `start` until now, and took
+ * `mem` bytes. `detail`, a file or procedure name, is copied. */
+void trace_span(enum trace_phase phase, int detail_len, const char *detail,
+  struct trace_mark start, size_t mem);
+/* Adds what the hardware counters counted since `start` to `phase`, for
+ * operations too small and too many to record one by one. */
+void trace_count(enum trace_phase phase, const struct perf_sample *start);
+/* Adds `items` to what `phase` went through: tokens lexed, nodes parsed,
+ * instructions emitted or bytes of SSA written. */
+void trace_items(enum trace_phase phase, uint64_t items);
+/* Records that `phase` ran as the child process `pid`, running `argv`, from
+ * `start` until now, using what `usage` says. */
+void trace_child(enum trace_phase phase, char *argv[], pid_t pid,
+  struct trace_mark start, const struct rusage *usage);
+
+#endif /* TRACE_H */
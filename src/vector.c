@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mem.h"
+
 struct vector {
   size_t elsize;
   size_t cap;
@@ -20,12 +22,12 @@ struct vector *vector_new(size_t elsize, size_t cap,
   }
 
   size_t size = sizeof(struct vector);
-  struct vector *vec = malloc(size);
+  struct vector *vec = mem_malloc(MEM_VECTOR, size);
 
   vec->elsize = elsize;
   vec->cap = cap;
   vec->len = 0;
-  vec->items = malloc(elsize * cap);
+  vec->items = mem_malloc(MEM_VECTOR, elsize * cap);
   vec->elfree = elfree;
   return vec;
 }
@@ -46,15 +48,15 @@ static void free_items(struct vector *vec) {
 void vector_free(struct vector *vec) {
   if (!vec) return;
   free_items(vec);
-  free(vec->items);
-  free(vec);
+  mem_free(MEM_VECTOR, vec->items);
+  mem_free(MEM_VECTOR, vec);
 }
 
 
 void vector_push(struct vector *vec, const void *item) {
   if (vec->len >= vec->cap) {
     vec->cap = vec->cap == 0 ? 16 : vec->cap * 2;
-    vec->items = realloc(vec->items, vec->cap * vec->elsize);
+    vec->items = mem_realloc(MEM_VECTOR, vec->items, vec->cap * vec->elsize);
   }
 
   memcpy(store_for(vec, vec->len++), item, vec->elsize);
@@ -73,7 +75,8 @@ const void *vector_get(struct vector *vec, size_t i) {
 size_t vector_into_inner(struct vector *vec, void **items) {
   size_t len = vec->len;
   *items = vec->items;
-  free(vec);
+  mem_disown(MEM_VECTOR, vec->items);
+  mem_free(MEM_VECTOR, vec);
 
   return len;
 }
@@ -0,0 +1,672 @@
+#define _GNU_SOURCE
+
+#include "vm.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "ir.h"
+
+#define VM_MAX_REGS (1 << 22)
+#define VM_MAX_FRAMES (1 << 18)
+#define VM_STACK_SIZE (8 << 20)
+#define VM_MAX_NATIVE_ARGS 16
+
+/* Every instruction reads and writes registers. Word operations only look at
+ * the lower 32 bits of their operands, like in QBE the upper half of a word
+ * register is unspecified, so word and long variants only exist where the
+ * lower half of the result would differ. */
+#define VM_OPS(X) \
+  X(MOV) \
+  X(ADD) X(SUB) X(MUL) X(NEG) X(AND) X(OR) X(XOR) \
+  X(DIV_W) X(DIV_L) X(REM_W) X(REM_L) X(UDIV_W) X(UDIV_L) X(UREM_W) X(UREM_L) \
+  X(SHL_W) X(SHL_L) X(SHR_W) X(SHR_L) X(SAR_W) X(SAR_L) \
+  X(EXTSB) X(EXTUB) X(EXTSH) X(EXTUH) X(EXTSW) X(EXTUW) \
+  X(CEQ_W) X(CEQ_L) X(CNE_W) X(CNE_L) \
+  X(CSGT_W) X(CSGT_L) X(CSLT_W) X(CSLT_L) X(CSGE_W) X(CSGE_L) X(CSLE_W) X(CSLE_L) \
+  X(CUGT_W) X(CUGT_L) X(CULT_W) X(CULT_L) X(CUGE_W) X(CUGE_L) X(CULE_W) X(CULE_L) \
+  X(ALLOC) \
+  X(LOADSB) X(LOADUB) X(LOADSH) X(LOADUH) X(LOADW) X(LOADL) \
+  X(STOREB) X(STOREH) X(STOREW) X(STOREL) \
+  X(CALL) X(CALL_NATIVE) X(CALL_DYN) \
+  X(JMP) X(JNZ) X(RET)
+
+#define VM_ENUM(op) VM_##op,
+
+typedef enum {
+  VM_OPS(VM_ENUM)
+} vm_op;
+
+/* IR_ALLOC: `a` is the size.
+ * IR_CALL: `a` is the index of the procedure, or the register holding the
+ * callee, the `argc` argument registers start at `b` in `call_args`.
+ * VM_JMP: `a` is the target. VM_JNZ: jumps to `b` if `a` is non-zero, else
+ * to `dest`. */
+struct vm_inst {
+  uint16_t op;
+  uint16_t argc;
+  uint32_t dest;
+  uint32_t a, b;
+};
+
+/* Constants and the addresses of globals are kept in registers following the
+ * temporaries, which are filled in on every call. */
+struct vm_proc {
+  struct ir_proc *ir;
+
+  size_t insts_len;
+  struct vm_inst *insts;
+
+  uint32_t regs_len;
+  size_t consts_len, consts_cap;
+  int64_t *consts;
+
+  size_t call_args_len, call_args_cap;
+  uint32_t *call_args;
+};
+
+struct vm {
+  struct ir_module *module;
+
+  size_t procs_len;
+  struct vm_proc *procs;
+  /* The contents of the data definitions, indexed like module->items. */
+  void **data;
+};
+
+struct vm_frame {
+  struct vm_proc *proc;
+  struct vm_inst *pc;
+  int64_t *regs;
+  uint8_t *sp;
+  uint32_t dest;
+};
+
+typedef int64_t (*vm_native_fn)(int64_t, ...);
+
+static const vm_op vm_word_ops[] = {
+  [IR_COPY] = VM_MOV,
+  [IR_ADD] = VM_ADD, [IR_SUB] = VM_SUB, [IR_MUL] = VM_MUL, [IR_NEG] = VM_NEG,
+  [IR_DIV] = VM_DIV_W, [IR_REM] = VM_REM_W, [IR_UDIV] = VM_UDIV_W, [IR_UREM] = VM_UREM_W,
+  [IR_AND] = VM_AND, [IR_OR] = VM_OR, [IR_XOR] = VM_XOR,
+  [IR_SHL] = VM_SHL_W, [IR_SHR] = VM_SHR_W, [IR_SAR] = VM_SAR_W,
+  [IR_EXTSB] = VM_EXTSB, [IR_EXTUB] = VM_EXTUB, [IR_EXTSH] = VM_EXTSH, [IR_EXTUH] = VM_EXTUH,
+  [IR_EXTSW] = VM_EXTSW, [IR_EXTUW] = VM_EXTUW,
+  [IR_CEQ] = VM_CEQ_W, [IR_CNE] = VM_CNE_W,
+  [IR_CSGT] = VM_CSGT_W, [IR_CSLT] = VM_CSLT_W, [IR_CSGE] = VM_CSGE_W, [IR_CSLE] = VM_CSLE_W,
+  [IR_CUGT] = VM_CUGT_W, [IR_CULT] = VM_CULT_W, [IR_CUGE] = VM_CUGE_W, [IR_CULE] = VM_CULE_W,
+};
+
+static const vm_op vm_long_ops[] = {
+  [IR_COPY] = VM_MOV,
+  [IR_ADD] = VM_ADD, [IR_SUB] = VM_SUB, [IR_MUL] = VM_MUL, [IR_NEG] = VM_NEG,
+  [IR_DIV] = VM_DIV_L, [IR_REM] = VM_REM_L, [IR_UDIV] = VM_UDIV_L, [IR_UREM] = VM_UREM_L,
+  [IR_AND] = VM_AND, [IR_OR] = VM_OR, [IR_XOR] = VM_XOR,
+  [IR_SHL] = VM_SHL_L, [IR_SHR] = VM_SHR_L, [IR_SAR] = VM_SAR_L,
+  [IR_EXTSB] = VM_EXTSB, [IR_EXTUB] = VM_EXTUB, [IR_EXTSH] = VM_EXTSH, [IR_EXTUH] = VM_EXTUH,
+  [IR_EXTSW] = VM_EXTSW, [IR_EXTUW] = VM_EXTUW,
+  [IR_CEQ] = VM_CEQ_L, [IR_CNE] = VM_CNE_L,
+  [IR_CSGT] = VM_CSGT_L, [IR_CSLT] = VM_CSLT_L, [IR_CSGE] = VM_CSGE_L, [IR_CSLE] = VM_CSLE_L,
+  [IR_CUGT] = VM_CUGT_L, [IR_CULT] = VM_CULT_L, [IR_CUGE] = VM_CUGE_L, [IR_CULE] = VM_CULE_L,
+};
+
+static const vm_op vm_load_ops[] = {
+  [IR_TYPE_SB] = VM_LOADSB, [IR_TYPE_UB] = VM_LOADUB,
+  [IR_TYPE_SH] = VM_LOADSH, [IR_TYPE_UH] = VM_LOADUH,
+  [IR_TYPE_W] = VM_LOADW, [IR_TYPE_L] = VM_LOADL,
+};
+
+static const vm_op vm_store_ops[] = {
+  [IR_TYPE_SB] = VM_STOREB, [IR_TYPE_UB] = VM_STOREB,
+  [IR_TYPE_SH] = VM_STOREH, [IR_TYPE_UH] = VM_STOREH,
+  [IR_TYPE_W] = VM_STOREW, [IR_TYPE_L] = VM_STOREL,
+};
+
+/* Decodes the escape sequences of a string literal, as the assembler does
+ * for the data QBE emits. */
+static char *vm_unescape(struct string *string) {
+  char *out = malloc(string->len + 1), *c = out;
+  const char *s = string->chars, *end = string->chars + string->len;
+
+  while (s < end) {
+    if (*s != '\\' || s + 1 == end) {
+      *c++ = *s++;
+      continue;
+    }
+
+    s++;
+
+    switch (*s) {
+      case 'n': *c++ = '\n'; s++; break;
+      case 't': *c++ = '\t'; s++; break;
+      case 'r': *c++ = '\r'; s++; break;
+      case 'x': {
+        s++;
+        *c++ = (char)strtol(s, (char **)&s, 16);
+      } break;
+
+      default: {
+        if (*s >= '0' && *s <= '7') {
+          int value = 0;
+
+          for (int i = 0; i < 3 && *s >= '0' && *s <= '7'; i++)
+            value = value * 8 + *s++ - '0';
+
+          *c++ = (char)value;
+        } else {
+          *c++ = *s++;
+        }
+      } break;
+    }
+  }
+
+  *c = 0;
+
+  return out;
+}
+
+void *vm_foreign(struct ident *ident) {
+  char name[256];
+  void *address;
+
+  snprintf(name, sizeof(name), "%.*s", (int)ident->len, ident->chars);
+  address = dlsym(RTLD_DEFAULT, name);
+
+  if (address == NULL) {
+    fprint_error(stderr, "undefined symbol '%s'", name);
+    fprint_note(stderr, "foreign procedures are looked up in the libraries loaded by the compiler");
+  }
+
+  return address;
+}
+
+void **vm_load_data(struct ir_module *module) {
+  void **data = calloc(module->items_len + 1, sizeof(void *));
+  struct ir_item *item;
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    item = &module->items[i];
+
+    if (item->kind != IR_ITEM_DATA)
+      continue;
+
+    if (item->as.data.kind == IR_DATA_STRING) {
+      data[i] = vm_unescape(&item->as.data.as.string);
+    } else {
+      data[i] = malloc(sizeof(int64_t));
+      *(int64_t *)data[i] = item->as.data.as.integer;
+    }
+  }
+
+  return data;
+}
+
+void vm_free_data(struct ir_module *module, void **data) {
+  for (size_t i = 0; i < module->items_len; i++)
+    free(data[i]);
+
+  free(data);
+}
+
+static uint32_t vm_const(struct vm_proc *proc, int64_t value) {
+  for (size_t i = 0; i < proc->consts_len; i++) {
+    if (proc->consts[i] == value)
+      return proc->ir->temps_len + i;
+  }
+
+  if (proc->consts_len >= proc->consts_cap) {
+    proc->consts_cap = proc->consts_cap == 0 ? 8 : proc->consts_cap * 2;
+    proc->consts = realloc(proc->consts, sizeof(int64_t) * proc->consts_cap);
+  }
+
+  proc->consts[proc->consts_len] = value;
+
+  return proc->ir->temps_len + proc->consts_len++;
+}
+
+/* Procedures are referred to by the address of their vm_proc, data by the
+ * address of its contents and anything else is looked up with dlsym. */
+static bool vm_global(struct vm *vm, struct ident *ident, struct vm_proc **proc, void **address) {
+  struct ir_item *item;
+  size_t j = 0;
+
+  *proc = NULL;
+
+  for (size_t i = 0; i < vm->module->items_len; i++) {
+    item = &vm->module->items[i];
+
+    if (item->kind == IR_ITEM_PROC) {
+      if (item->as.proc->ident.len == ident->len
+        && strncmp(item->as.proc->ident.chars, ident->chars, ident->len) == 0)
+      {
+        *proc = &vm->procs[j];
+        *address = *proc;
+
+        return true;
+      }
+
+      j++;
+    } else if (item->as.data.ident.len == ident->len
+      && strncmp(item->as.data.ident.chars, ident->chars, ident->len) == 0)
+    {
+      *address = vm->data[i];
+
+      return true;
+    }
+  }
+
+  *address = vm_foreign(ident);
+
+  return *address != NULL;
+}
+
+static bool vm_operand(struct vm *vm, struct vm_proc *proc, struct ir_value *value, uint32_t *reg) {
+  struct vm_proc *callee;
+  void *address;
+
+  switch (value->kind) {
+    case IR_VALUE_NONE: *reg = vm_const(proc, 0); break;
+    case IR_VALUE_TEMP: *reg = value->as.temp; break;
+    case IR_VALUE_CONST: *reg = vm_const(proc, value->as.integer); break;
+
+    case IR_VALUE_GLOBAL: {
+      if (!vm_global(vm, &value->as.global, &callee, &address))
+        return false;
+
+      *reg = vm_const(proc, (int64_t)address);
+    } break;
+  }
+
+  return true;
+}
+
+static bool vm_compile_call(struct vm *vm, struct vm_proc *proc, struct ir_inst *inst, struct vm_inst *out) {
+  struct vm_proc *callee = NULL;
+  void *address;
+
+  out->dest = inst->dest;
+  out->argc = inst->call_args_len;
+  out->b = proc->call_args_len;
+
+  if (inst->args[0].kind == IR_VALUE_GLOBAL) {
+    if (!vm_global(vm, &inst->args[0].as.global, &callee, &address))
+      return false;
+
+    if (callee != NULL) {
+      out->op = VM_CALL;
+      out->a = callee - vm->procs;
+    } else {
+      out->op = VM_CALL_NATIVE;
+      out->a = vm_const(proc, (int64_t)address);
+    }
+  } else {
+    out->op = VM_CALL_DYN;
+
+    if (!vm_operand(vm, proc, &inst->args[0], &out->a))
+      return false;
+  }
+
+  if (callee == NULL && inst->call_args_len > VM_MAX_NATIVE_ARGS) {
+    fprint_error(stderr, "%.*s: foreign calls take at most %d arguments", (int)proc->ir->ident.len,
+      proc->ir->ident.chars, VM_MAX_NATIVE_ARGS);
+
+    return false;
+  }
+
+  for (size_t i = 0; i < inst->call_args_len; i++) {
+    if (proc->call_args_len >= proc->call_args_cap) {
+      proc->call_args_cap = proc->call_args_cap == 0 ? 16 : proc->call_args_cap * 2;
+      proc->call_args = realloc(proc->call_args, sizeof(uint32_t) * proc->call_args_cap);
+    }
+
+    if (!vm_operand(vm, proc, &inst->call_args[i], &proc->call_args[proc->call_args_len++]))
+      return false;
+  }
+
+  return true;
+}
+
+static bool vm_compile_inst(struct vm *vm, struct vm_proc *proc, struct ir_inst *inst, struct vm_inst *out) {
+  out->dest = inst->dest;
+
+  switch (inst->op) {
+    case IR_ALLOC: {
+      out->op = VM_ALLOC;
+      out->a = inst->args[0].as.integer;
+
+      return true;
+    }
+
+    case IR_LOAD: {
+      out->op = vm_load_ops[inst->arg_type];
+
+      return vm_operand(vm, proc, &inst->args[0], &out->a);
+    }
+
+    case IR_STORE: {
+      out->op = vm_store_ops[inst->arg_type];
+
+      return vm_operand(vm, proc, &inst->args[0], &out->a)
+        && vm_operand(vm, proc, &inst->args[1], &out->b);
+    }
+
+    case IR_CALL:
+      return vm_compile_call(vm, proc, inst, out);
+
+    default: {
+      if (ir_op_is_comparison(inst->op))
+        out->op = (inst->arg_type == IR_TYPE_W ? vm_word_ops : vm_long_ops)[inst->op];
+      else
+        out->op = (inst->type == IR_TYPE_W ? vm_word_ops : vm_long_ops)[inst->op];
+
+      return vm_operand(vm, proc, &inst->args[0], &out->a)
+        && vm_operand(vm, proc, &inst->args[1], &out->b);
+    }
+  }
+}
+
+/* Lays the blocks out in order, a jump to the next block falls through. */
+static bool vm_compile_proc(struct vm *vm, struct vm_proc *proc) {
+  struct ir_proc *ir = proc->ir;
+  struct ir_block *block;
+  struct ir_jump *jump;
+  struct vm_inst *out;
+  size_t *starts = malloc(sizeof(size_t) * (ir->next_block_id + 1)), len = 0;
+  bool ok = true;
+
+  for (size_t i = 0; i < ir->blocks_len; i++) {
+    block = ir->blocks[i];
+    starts[block->id] = len;
+    len += block->insts_len;
+
+    if (block->jump.kind != IR_JUMP_JMP || i + 1 == ir->blocks_len || block->jump.targets[0] != ir->blocks[i + 1])
+      len++;
+  }
+
+  proc->insts_len = len;
+  proc->insts = calloc(len, sizeof(struct vm_inst));
+  out = proc->insts;
+
+  for (size_t i = 0; i < ir->blocks_len && ok; i++) {
+    block = ir->blocks[i];
+    jump = &block->jump;
+
+    for (size_t j = 0; j < block->insts_len && ok; j++)
+      ok = vm_compile_inst(vm, proc, &block->insts[j], out++);
+
+    if (out == proc->insts + (i + 1 < ir->blocks_len ? starts[ir->blocks[i + 1]->id] : len))
+      continue;
+
+    switch (jump->kind) {
+      case IR_JUMP_NONE:
+      case IR_JUMP_RET: {
+        out->op = VM_RET;
+        ok = ok && vm_operand(vm, proc, &jump->arg, &out->a);
+      } break;
+
+      case IR_JUMP_JMP: {
+        out->op = VM_JMP;
+        out->a = starts[jump->targets[0]->id];
+      } break;
+
+      case IR_JUMP_JNZ: {
+        out->op = VM_JNZ;
+        ok = ok && vm_operand(vm, proc, &jump->arg, &out->a);
+        out->b = starts[jump->targets[0]->id];
+        out->dest = starts[jump->targets[1]->id];
+      } break;
+    }
+
+    out++;
+  }
+
+  proc->regs_len = ir->temps_len + proc->consts_len;
+
+  free(starts);
+
+  return ok;
+}
+
+#define R(r) regs[(r)]
+#define DISPATCH() goto *labels[pc->op]
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+
+#define VM_LABEL(op) [VM_##op] = &&op_##op,
+
+#define BINARY(op, type, expr) \
+  op_##op: { type lhs = (type)R(pc->a), rhs = (type)R(pc->b); R(pc->dest) = (int64_t)(expr); } NEXT();
+#define UNARY(op, expr) \
+  op_##op: { int64_t x = R(pc->a); R(pc->dest) = (int64_t)(expr); } NEXT();
+
+/* The interpreter keeps its own stack of frames, so deep recursion in the
+ * program doesn't recurse in C. */
+static bool vm_exec(struct vm *vm, struct vm_proc *entry, int64_t *result) {
+  static void *labels[] = { VM_OPS(VM_LABEL) };
+  int64_t *regs_base = malloc(sizeof(int64_t) * VM_MAX_REGS), *regs = regs_base, *callee_regs;
+  int64_t native_args[VM_MAX_NATIVE_ARGS];
+  struct vm_frame *frames = malloc(sizeof(struct vm_frame) * VM_MAX_FRAMES);
+  uint8_t *stack = malloc(VM_STACK_SIZE), *sp = stack;
+  struct vm_proc *proc = entry, *callee;
+  struct vm_inst *pc;
+  uint32_t *args;
+  size_t depth = 0;
+  bool ok = true;
+
+  for (size_t i = 0; i < proc->ir->params_len; i++)
+    R(proc->ir->params[i]) = 0;
+
+  memcpy(regs + proc->ir->temps_len, proc->consts, sizeof(int64_t) * proc->consts_len);
+  pc = proc->insts;
+  DISPATCH();
+
+  op_MOV: R(pc->dest) = R(pc->a); NEXT();
+
+  BINARY(ADD, uint64_t, lhs + rhs)
+  BINARY(SUB, uint64_t, lhs - rhs)
+  BINARY(MUL, uint64_t, lhs * rhs)
+  BINARY(AND, uint64_t, lhs & rhs)
+  BINARY(OR, uint64_t, lhs | rhs)
+  BINARY(XOR, uint64_t, lhs ^ rhs)
+  UNARY(NEG, 0 - (uint64_t)x)
+
+  BINARY(DIV_W, int32_t, lhs / rhs)
+  BINARY(DIV_L, int64_t, lhs / rhs)
+  BINARY(REM_W, int32_t, lhs % rhs)
+  BINARY(REM_L, int64_t, lhs % rhs)
+  BINARY(UDIV_W, uint32_t, (int32_t)(lhs / rhs))
+  BINARY(UDIV_L, uint64_t, lhs / rhs)
+  BINARY(UREM_W, uint32_t, (int32_t)(lhs % rhs))
+  BINARY(UREM_L, uint64_t, lhs % rhs)
+
+  BINARY(SHL_W, uint32_t, (int32_t)(lhs << (rhs & 31)))
+  BINARY(SHL_L, uint64_t, lhs << (rhs & 63))
+  BINARY(SHR_W, uint32_t, (int32_t)(lhs >> (rhs & 31)))
+  BINARY(SHR_L, uint64_t, lhs >> (rhs & 63))
+  BINARY(SAR_W, int32_t, lhs >> (rhs & 31))
+  BINARY(SAR_L, int64_t, lhs >> (rhs & 63))
+
+  UNARY(EXTSB, (int8_t)x)
+  UNARY(EXTUB, (uint8_t)x)
+  UNARY(EXTSH, (int16_t)x)
+  UNARY(EXTUH, (uint16_t)x)
+  UNARY(EXTSW, (int32_t)x)
+  UNARY(EXTUW, (uint32_t)x)
+
+  BINARY(CEQ_W, int32_t, lhs == rhs)
+  BINARY(CEQ_L, int64_t, lhs == rhs)
+  BINARY(CNE_W, int32_t, lhs != rhs)
+  BINARY(CNE_L, int64_t, lhs != rhs)
+  BINARY(CSGT_W, int32_t, lhs > rhs)
+  BINARY(CSGT_L, int64_t, lhs > rhs)
+  BINARY(CSLT_W, int32_t, lhs < rhs)
+  BINARY(CSLT_L, int64_t, lhs < rhs)
+  BINARY(CSGE_W, int32_t, lhs >= rhs)
+  BINARY(CSGE_L, int64_t, lhs >= rhs)
+  BINARY(CSLE_W, int32_t, lhs <= rhs)
+  BINARY(CSLE_L, int64_t, lhs <= rhs)
+  BINARY(CUGT_W, uint32_t, lhs > rhs)
+  BINARY(CUGT_L, uint64_t, lhs > rhs)
+  BINARY(CULT_W, uint32_t, lhs < rhs)
+  BINARY(CULT_L, uint64_t, lhs < rhs)
+  BINARY(CUGE_W, uint32_t, lhs >= rhs)
+  BINARY(CUGE_L, uint64_t, lhs >= rhs)
+  BINARY(CULE_W, uint32_t, lhs <= rhs)
+  BINARY(CULE_L, uint64_t, lhs <= rhs)
+
+  op_ALLOC: {
+    if (sp + pc->a > stack + VM_STACK_SIZE)
+      goto overflow;
+
+    R(pc->dest) = (int64_t)sp;
+    sp += (pc->a + 15) & ~15;
+  } NEXT();
+
+  UNARY(LOADSB, *(int8_t *)x)
+  UNARY(LOADUB, *(uint8_t *)x)
+  UNARY(LOADSH, *(int16_t *)x)
+  UNARY(LOADUH, *(uint16_t *)x)
+  UNARY(LOADW, *(int32_t *)x)
+  UNARY(LOADL, *(int64_t *)x)
+
+  op_STOREB: *(int8_t *)R(pc->b) = (int8_t)R(pc->a); NEXT();
+  op_STOREH: *(int16_t *)R(pc->b) = (int16_t)R(pc->a); NEXT();
+  op_STOREW: *(int32_t *)R(pc->b) = (int32_t)R(pc->a); NEXT();
+  op_STOREL: *(int64_t *)R(pc->b) = R(pc->a); NEXT();
+
+  op_CALL_DYN: {
+    callee = (struct vm_proc *)R(pc->a);
+
+    if (callee >= vm->procs && callee < vm->procs + vm->procs_len)
+      goto call;
+  } // fallthrough
+
+  op_CALL_NATIVE: {
+    args = &proc->call_args[pc->b];
+    memset(native_args, 0, sizeof(native_args));
+
+    for (uint16_t i = 0; i < pc->argc; i++)
+      native_args[i] = R(args[i]);
+
+    // Extra arguments are ignored by the C calling convention, so every
+    // foreign procedure can be called through the same variadic prototype.
+    R(pc->dest) = ((vm_native_fn)R(pc->a))(native_args[0], native_args[1], native_args[2],
+      native_args[3], native_args[4], native_args[5], native_args[6], native_args[7],
+      native_args[8], native_args[9], native_args[10], native_args[11],
+      native_args[12], native_args[13], native_args[14], native_args[15]);
+  } NEXT();
+
+  op_CALL: {
+    callee = &vm->procs[pc->a];
+
+  call:
+    callee_regs = regs + proc->regs_len;
+    args = &proc->call_args[pc->b];
+
+    if (depth + 1 >= VM_MAX_FRAMES || callee_regs + callee->regs_len > regs_base + VM_MAX_REGS)
+      goto overflow;
+
+    for (uint16_t i = 0; i < pc->argc && i < callee->ir->params_len; i++)
+      callee_regs[callee->ir->params[i]] = R(args[i]);
+
+    frames[depth++] = (struct vm_frame) {
+      .proc = proc,
+      .pc = pc + 1,
+      .regs = regs,
+      .sp = sp,
+      .dest = pc->dest,
+    };
+
+    proc = callee;
+    regs = callee_regs;
+    memcpy(regs + proc->ir->temps_len, proc->consts, sizeof(int64_t) * proc->consts_len);
+    pc = proc->insts;
+  } DISPATCH();
+
+  op_JMP: pc = &proc->insts[pc->a]; DISPATCH();
+  op_JNZ: pc = &proc->insts[(uint32_t)R(pc->a) != 0 ? pc->b : pc->dest]; DISPATCH();
+
+  op_RET: {
+    int64_t value = R(pc->a);
+
+    if (depth == 0) {
+      *result = value;
+      goto done;
+    }
+
+    struct vm_frame *frame = &frames[--depth];
+
+    proc = frame->proc;
+    regs = frame->regs;
+    sp = frame->sp;
+    pc = frame->pc;
+    R(frame->dest) = value;
+  } DISPATCH();
+
+overflow:
+  fprint_error(stderr, "stack overflow in %.*s", (int)proc->ir->ident.len, proc->ir->ident.chars);
+  ok = false;
+
+done:
+  free(regs_base);
+  free(frames);
+  free(stack);
+
+  return ok;
+}
+
+bool vm_run_module(struct ir_module *module, int64_t *result) {
+  struct ident main_ident = { .len = 4, .chars = "main" };
+  struct vm_proc *entry = NULL;
+  struct vm vm = {
+    .module = module,
+    .procs_len = 0,
+    .data = vm_load_data(module),
+  };
+  size_t j = 0;
+  bool ok = true;
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind == IR_ITEM_PROC)
+      vm.procs_len++;
+  }
+
+  vm.procs = calloc(vm.procs_len + 1, sizeof(struct vm_proc));
+
+  for (size_t i = 0; i < module->items_len; i++) {
+    if (module->items[i].kind == IR_ITEM_PROC)
+      vm.procs[j++].ir = module->items[i].as.proc;
+  }
+
+  for (size_t i = 0; i < vm.procs_len && ok; i++)
+    ok = vm_compile_proc(&vm, &vm.procs[i]);
+
+  for (size_t i = 0; i < vm.procs_len && ok; i++) {
+    if (vm.procs[i].ir->ident.len == main_ident.len
+      && strncmp(vm.procs[i].ir->ident.chars, main_ident.chars, main_ident.len) == 0)
+    {
+      entry = &vm.procs[i];
+    }
+  }
+
+  if (ok && entry == NULL) {
+    fprint_error(stderr, "there is no main procedure to run");
+    ok = false;
+  }
+
+  if (ok)
+    ok = vm_exec(&vm, entry, result);
+
+  for (size_t i = 0; i < vm.procs_len; i++) {
+    free(vm.procs[i].insts);
+    free(vm.procs[i].consts);
+    free(vm.procs[i].call_args);
+  }
+
+  free(vm.procs);
+  vm_free_data(module, vm.data);
+
+  return ok;
+}
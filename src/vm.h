@@ -0,0 +1,24 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+/* Compiles the procedures of `module` to register bytecode and runs its
+ * main procedure in the compiler's process. Foreign procedures are looked up
+ * with dlsym and called with the C calling convention.
+ * Returns false if the module can't be run, otherwise main's return value is
+ * stored in `result`. */
+bool vm_run_module(struct ir_module *module, int64_t *result);
+
+/* Looks up a foreign procedure or variable, reporting it if it is missing. */
+void *vm_foreign(struct ident *ident);
+
+/* The contents of the data definitions of `module`, indexed like its items,
+ * with escape sequences decoded. */
+void **vm_load_data(struct ir_module *module);
+void vm_free_data(struct ir_module *module, void **data);
+
+#endif /* VM_H */
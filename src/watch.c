@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include "watch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "source.h"
+
+/* Editors often save by replacing a file, which would end a watch on the
+ * file itself, so the directories holding the files are watched instead. */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+
+/* Events which arrive this soon after the first one belong to the same
+ * change, like a save which writes several files. */
+#define WATCH_SETTLE_MS 20
+
+struct watch_dir {
+  int wd;
+  char *path;
+};
+
+struct watch {
+  int fd;
+  size_t dirs_len, dirs_cap;
+  struct watch_dir *dirs;
+  /* The files the last compile looked at. */
+  size_t files_len, files_cap;
+  char **files;
+};
+
+static uint64_t watch_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void watch_add(const char *path, void *udata) {
+  struct watch *watch = udata;
+  const char *slash = strrchr(path, '/');
+  char dir[PATH_MAX];
+  int wd;
+
+  if (watch->files_len >= watch->files_cap) {
+    watch->files_cap = watch->files_cap == 0 ? 16 : watch->files_cap * 2;
+    watch->files = realloc(watch->files, sizeof(char *) * watch->files_cap);
+  }
+
+  watch->files[watch->files_len++] = strdup(path);
+
+  snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+  wd = inotify_add_watch(watch->fd, dir, WATCH_EVENTS);
+
+  if (wd < 0)
+    return;
+
+  for (size_t i = 0; i < watch->dirs_len; i++) {
+    if (watch->dirs[i].wd == wd)
+      return;
+  }
+
+  if (watch->dirs_len >= watch->dirs_cap) {
+    watch->dirs_cap = watch->dirs_cap == 0 ? 4 : watch->dirs_cap * 2;
+    watch->dirs = realloc(watch->dirs, sizeof(struct watch_dir) * watch->dirs_cap);
+  }
+
+  watch->dirs[watch->dirs_len++] = (struct watch_dir) { .wd = wd, .path = strdup(dir) };
+}
+
+/* Returns the watched file `event` is about, or NULL. */
+static const char *watch_file(struct watch *watch, struct inotify_event *event) {
+  const char *dir = NULL;
+  size_t dir_len;
+
+  if (event->len == 0)
+    return NULL;
+
+  for (size_t i = 0; i < watch->dirs_len && dir == NULL; i++) {
+    if (watch->dirs[i].wd == event->wd)
+      dir = watch->dirs[i].path;
+  }
+
+  if (dir == NULL)
+    return NULL;
+
+  dir_len = strcmp(dir, "/") == 0 ? 0 : strlen(dir);
+
+  for (size_t i = 0; i < watch->files_len; i++) {
+    if (strncmp(watch->files[i], dir, dir_len) == 0 && watch->files[i][dir_len] == '/'
+      && strcmp(&watch->files[i][dir_len + 1], event->name) == 0)
+    {
+      return watch->files[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* Blocks until a watched file changes, and returns the first one that did.
+ * Returns NULL if reading events fails. */
+static char *watch_wait(struct watch *watch) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *event;
+  struct pollfd pfd = { .fd = watch->fd, .events = POLLIN };
+  const char *file;
+  char *changed = NULL;
+  ssize_t len;
+
+  while (true) {
+    // Once something changed, only wait for the rest of the change.
+    if (changed != NULL && poll(&pfd, 1, WATCH_SETTLE_MS) <= 0)
+      return changed;
+
+    len = read(watch->fd, buf, sizeof(buf));
+
+    if (len < 0 && errno == EINTR)
+      continue;
+
+    if (len <= 0) {
+      free(changed);
+      return NULL;
+    }
+
+    for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event *)p;
+      file = watch_file(watch, event);
+
+      if (file != NULL && changed == NULL)
+        changed = strdup(file);
+    }
+  }
+}
+
+/* Returns the absolute path of `arg`, which only needs its directory to
+ * exist, or NULL. */
+static char *watch_path(const char *arg) {
+  const char *slash = strrchr(arg, '/'), *name = slash == NULL ? arg : slash + 1;
+  char dir[PATH_MAX], *path = realpath(arg, NULL), *root;
+  size_t len;
+
+  if (path != NULL || errno != ENOENT || name[0] == 0)
+    return path;
+
+  if (slash == NULL)
+    snprintf(dir, sizeof(dir), ".");
+  else
+    snprintf(dir, sizeof(dir), "%.*s", slash == arg ? 1 : (int)(slash - arg), arg);
+
+  root = realpath(dir, NULL);
+
+  if (root == NULL)
+    return NULL;
+
+  len = strlen(root) + strlen(name) + 2;
+  path = malloc(len);
+  snprintf(path, len, "%s/%s", strcmp(root, "/") == 0 ? "" : root, name);
+  free(root);
+
+  return path;
+}
+
+static void watch_clear_files(struct watch *watch) {
+  for (size_t i = 0; i < watch->files_len; i++)
+    free(watch->files[i]);
+
+  watch->files_len = 0;
+}
+
+int watch_run(int argc, char *argv[], server_compile_fn compile) {
+  struct source_cache *cache = source_cache_new();
+  struct watch watch = { .fd = inotify_init1(IN_CLOEXEC) };
+  char **watch_argv = malloc(sizeof(char *) * (argc + 2)), *changed = NULL, *root;
+  uint64_t start;
+
+  if (watch.fd < 0) {
+    fprint_error(stderr, "failed to start watching files: %s", strerror(errno));
+    source_cache_free(cache);
+    free(watch_argv);
+
+    return 1;
+  }
+
+  // Builds go through the object cache, so only procedures that changed are
+  // assembled again.
+  memcpy(watch_argv, argv, sizeof(char *) * argc);
+  watch_argv[argc] = "--incremental";
+  watch_argv[argc + 1] = NULL;
+
+  while (true) {
+    start = watch_now_ns();
+    compile(argc + 1, watch_argv, cache);
+    fflush(stdout);
+
+    if (changed == NULL) {
+      fprintf(stderr, "Compiled in %.1f ms, watching for changes.\n", (watch_now_ns() - start) / 1e6);
+    } else {
+      fprintf(stderr, "Recompiled %s in %.1f ms.\n", changed, (watch_now_ns() - start) / 1e6);
+    }
+
+    free(changed);
+
+    watch_clear_files(&watch);
+    source_cache_scan(cache, watch_add, &watch);
+
+    // The input itself is watched even if it couldn't be read yet.
+    for (int i = 1; i < argc; i++) {
+      if (argv[i][0] != '-' && strcmp(argv[i], "run") != 0 && (root = watch_path(argv[i])) != NULL) {
+        watch_add(root, &watch);
+        free(root);
+      }
+    }
+
+    if (watch.dirs_len == 0) {
+      fprint_error(stderr, "there is nothing to watch");
+      fprint_help(stderr, "check that the input's directory exists");
+      break;
+    }
+
+    changed = watch_wait(&watch);
+
+    if (changed == NULL) {
+      fprint_error(stderr, "failed to read file changes: %s", strerror(errno));
+      break;
+    }
+  }
+
+  watch_clear_files(&watch);
+  free(watch.files);
+
+  for (size_t i = 0; i < watch.dirs_len; i++)
+    free(watch.dirs[i].path);
+
+  free(watch.dirs);
+  close(watch.fd);
+  source_cache_free(cache);
+  free(watch_argv);
+
+  return 1;
+}
@@ -0,0 +1,12 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "server.h"
+
+/* Compiles `argv` like `jotunheim argv...`, and again whenever one of the
+ * files it loaded changes. Unchanged files keep their parse between
+ * compiles, and builds are incremental. Only returns if inotify fails, or
+ * if not even the directory of the input exists. */
+int watch_run(int argc, char *argv[], server_compile_fn compile);
+
+#endif /* WATCH_H */